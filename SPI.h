@@ -14,7 +14,11 @@
 #ifndef SPI_H_
 #define SPI_H_
 
+#ifdef NRF_SIM
+#include "nrf_sim.h"				//simulated nrf on host (see nrf_sim.h)
+#else
 #include <avr/io.h>
+#endif
 
 /** ATmega8**/
 #define DDR_SPI		DDRB
@@ -58,6 +62,63 @@
 //DORD = 0 (MSB transmitted first); DORD = 1 (LSB transmitted first)
 #define Data_Format		0
 
+/*SPI_Engine (bulk transfers of SPI_Transfer_Async())
+* SPI_Engine		Hardware
+*	0			SPI polled by caller, SPI_Transfer_Async() returns when transfer is done
+*	1			SPI interrupt (SPI_STC_vect) clocks out next byte, caller runs meanwhile
+*	2			USART0 in Master SPI Mode (USART_RX_vect). Transmit is double buffered, two
+*				bytes are in flight so SCK does not stop between bytes. ATmega48/88/168/328 only,
+*				nrf is wired to XCK0 (PD4) = SCK, TXD0 (PD1) = MOSI and RXD0 (PD0) = MISO
+* SPI_Transfer() always polls the hardware of SPI_Engine (SPI for 0 and 1, USART0 for 2).
+*
+* CPU cycles for a 33 byte transfer (W_TX_PAYLOAD of 32 bytes), estimated from instruction
+* timings of avr-gcc -Os code. bus = CSN low to CSN high, cpu = cycles taken from main program.
+* Gap is SCK idle time per byte (SPIF seen, byte stored, next byte written to SPDR).
+*
+*	Path					Gap			fosc/2			fosc/4			fosc/16
+*											bus / cpu		bus / cpu		bus / cpu
+*	SPI_Read_Write() loop	20			1188 / 1188		1716 / 1716		4884 / 4884
+*	SPI_Transfer() (0, 1)	6			726 / 726		1254 / 1254		4422 / 4422
+*	SPI_Transfer() (2)		0 (4 at /2)	660 / 660		1056 / 1056		4224 / 4224
+*	SPI_Transfer_Async() 1	50			2970 / 2970		2970 / 2970		5874 / 2970
+*	SPI_Transfer_Async() 2	0			2970 / 2970		2970 / 2970		4224 / 2970
+*
+* An interrupt costs about 90 cycles (entry, prologue saving registers for the completion
+* callback, epilogue and reti), so below fosc/16 bytes come no faster than interrupts (90).
+* Engine 1 and 2 pay off from fosc/16 down: at fosc/16 the main program gets about 2900
+* cycles (360us at 8MHz) back per 32 byte payload.
+*/
+#ifndef SPI_Engine
+#define SPI_Engine		0
+#endif
+/*Estimated cycles of above table, not measured (nrf_sim.h charges them, so nrf_bench repeats them)*/
+/*Estimated cycles of above table (timing of engines in nrf_sim.h)*/
+#define SPI_CYCLES_RW		20			//SCK idle per byte of SPI_Read_Write() loop (call, poll, ret, store, loop)
+#define SPI_CYCLES_BULK		6			//SCK idle per byte of SPI_Transfer() (poll and write of next byte)
+#define SPI_CYCLES_ISR		90			//cycles of one SPI_STC_vect
+#define SPI_CYCLES_ISR_GAP	50			//SCK idle per byte of SPI_STC_vect (entry to write of next byte)
+
+#define SPI_Fill		0xFF			//byte clocked out when no transmit buffer is given
+
+#if SPI_Engine == 2
+#ifdef NRF_SIM
+#error "nrf_sim.h models SPI_Engine 0 and 1 only"
+#endif
+#ifndef UMSEL01
+#error "SPI_Engine 2 needs USART0 with Master SPI Mode (ATmega48/88/168/328)"
+#endif
+#define DDR_XCK		DDRD
+#define XCK			PIND4
+
+//UBRR0 giving SCK of SPI_Speed (SCK = fosc/(2*(UBRR0+1)))
+#define SPI_UBRR	((SPI_Speed == 4) ? 0 : (SPI_Speed == 0) ? 1 : (SPI_Speed == 5) ? 3 : (SPI_Speed == 1) ? 7 : \
+					 (SPI_Speed == 6) ? 15 : (SPI_Speed == 2 || SPI_Speed == 7) ? 31 : 63)
+#endif
+
+#if SPI_Engine == 1 && SPI_interrupt == 1
+#error "SPI_Engine 1 owns SPI_STC_vect, set SPI_interrupt to 0"
+#endif
+
 
 /*****************************************************************
 					FUNCTION DECLERATIONS
@@ -86,12 +147,93 @@ void SS_low(void);
 ****************************************************************************/
 unsigned char SPI_Read_Write(unsigned char data);
 
+/****************************************************************************
+* Description : Transfers a buffer (eg. command byte and payload) in one call,
+*				polling SPI. Next byte is written as soon as last one is done
+* Parameters  : const unsigned char *tx = bytes to transmit (0 = SPI_Fill)
+*				unsigned char *rx = received bytes (0 = discard, may be tx)
+*				unsigned char n = number of bytes
+****************************************************************************/
+void SPI_Transfer(const unsigned char *tx, unsigned char *rx, unsigned char n);
+
+/****************************************************************************
+* Description : Starts a transfer driven by interrupt of SPI_Engine and returns.
+*				Waits for a transfer still running. tx and rx must stay valid till
+*				done() is called (from interrupt, or before return if SPI_Engine
+*				is 0). Interrupts must be enabled for the transfer to progress,
+*				otherwise SPI_Wait() completes it
+* Parameters  : const unsigned char *tx = bytes to transmit (0 = SPI_Fill)
+*				unsigned char *rx = received bytes (0 = discard, may be tx)
+*				unsigned char n = number of bytes
+*				void (*done)(void) = called when last byte is received (0 = none)
+****************************************************************************/
+void SPI_Transfer_Async(const unsigned char *tx, unsigned char *rx, unsigned char n, void (*done)(void));
+
+/****************************************************************************
+* Description : Waits till transfer of SPI_Transfer_Async() is done. With
+*				interrupts disabled (eg. in an interrupt) it moves the bytes itself
+****************************************************************************/
+void SPI_Wait(void);
+
 
 /**************************************************
 			FUNCTION DEFINATIONS
 **************************************************/
 
+//Data register, received byte flag and interrupt of SPI_Engine
+#if SPI_Engine == 2
+#define SPI_Put(data)		UDR0 = (data)
+#define SPI_Get()			UDR0
+#define SPI_Ready()			(UCSR0A & (1<<RXC0))
+#define SPI_Irq_on()		UCSR0B |= (1<<RXCIE0)
+#define SPI_Irq_off()		UCSR0B &= ~(1<<RXCIE0)
+#define SPI_Free()			(UCSR0A & (1<<UDRE0))
+#define SPI_vect			USART_RX_vect
+#define SPI_Depth			2				//bytes in flight (UDR0 and shift register)
+#else
+#ifdef NRF_SIM
+#define SPI_Put(data)		nrf_sim_spdr_write(data)
+#define SPI_Get()			nrf_sim_spdr_read()
+#else
+#define SPI_Put(data)		SPDR = (data)
+#define SPI_Get()			SPDR
+#endif
+#define SPI_Ready()			(SPSR & (1<<SPIF))
+#define SPI_Irq_on()		SPCR |= (1<<SPIE)
+#define SPI_Irq_off()		SPCR &= ~(1<<SPIE)
+#define SPI_Free()			1
+#define SPI_vect			SPI_STC_vect
+#define SPI_Depth			1
+#endif
+
+//Simulated CPU time (nrf_sim.h) and busy waiting
+#ifdef NRF_SIM
+#define SPI_Cycles(n)		nrf_sim_cpu(n)
+#define SPI_Spin()			nrf_sim_delay_ns(500)
+#else
+#define SPI_Cycles(n)
+#define SPI_Spin()
+#endif
+
+volatile unsigned char SPI_Busy = 0;		//1 = SPI_Transfer_Async() in progress
+#if SPI_Engine != 0
+static const unsigned char *spi_tx;
+static unsigned char *spi_rx;
+static unsigned char spi_send, spi_recv;	//bytes left to write and to read
+static void (*spi_done)(void);
+#endif
+
 void SPI_init(){
+#if SPI_Engine == 2
+	//USART0 in Master SPI Mode (baud rate is set after transmitter is enabled)
+	UBRR0 = 0;
+	DDR_XCK |= (1<<XCK);
+	UCSR0C = (1<<UMSEL01) | (1<<UMSEL00) | ((Data_Format == 1) ? (1<<UDORD0) : 0) |
+			 ((SPI_Mode & 1) ? (1<<UCPHA0) : 0) | ((SPI_Mode & 2) ? (1<<UCPOL0) : 0);
+	UCSR0B = (1<<RXEN0) | (1<<TXEN0);
+	UBRR0 = SPI_UBRR;
+	return;
+#endif
 	//Master Mode
 	if(Operation_Mode == 1){
 		DDR_SPI |= ((1<<MOSI) | (1<<SCK) | (1<<SS));
@@ -151,10 +293,118 @@ void SS_low(){
 }
 
 unsigned char SPI_Read_Write(unsigned char data){
+#ifdef NRF_SIM
+	SPI_Cycles(SPI_CYCLES_RW);
+	return nrf_sim_spi(data);
+#else
 	//Transmission starts as soon as data is put in SPDR
-	SPDR = data;
+	SPI_Put(data);
+	while(!SPI_Ready());
+	return SPI_Get();
+#endif
+}
+
+void SPI_Transfer(const unsigned char *tx, unsigned char *rx, unsigned char n){
+	unsigned char in;
+	if(!n) return;
+#ifdef NRF_SIM
+	do{
+		SPI_Cycles(SPI_CYCLES_BULK);
+		in = nrf_sim_spi(tx ? *tx++ : SPI_Fill);
+		if(rx) *rx++ = in;
+	}while(--n);
+#elif SPI_Engine == 2
+	//keeps UDR0 and shift register loaded, receive buffer (2 bytes) can not overrun
+	unsigned char sent = 0, got = 0;
+	while(got < n){
+		if(sent < n && (unsigned char)(sent - got) < SPI_Depth && SPI_Free()){
+			UDR0 = tx ? tx[sent] : SPI_Fill;
+			sent++;
+		}
+		if(SPI_Ready()){
+			in = UDR0;
+			if(rx) rx[got] = in;
+			got++;
+		}
+	}
+#else
+	//next byte is fetched while current one shifts. Received byte stays in SPDR
+	//read buffer till next one is complete, so it is read after next write
+	unsigned char out;
+	SPDR = tx ? *tx++ : SPI_Fill;
+	while(--n){
+		out = tx ? *tx++ : SPI_Fill;
+		while(!(SPSR & (1<<SPIF)));
+		SPDR = out;
+		in = SPDR;
+		if(rx) *rx++ = in;
+	}
 	while(!(SPSR & (1<<SPIF)));
-	return SPDR;
+	in = SPDR;
+	if(rx) *rx = in;
+#endif
+}
+
+#if SPI_Engine != 0
+//Moves one byte of SPI_Transfer_Async(), called when a byte is received
+static void SPI_Next(void){
+	unsigned char in;
+	if(spi_send){
+		spi_send--;
+		SPI_Put(spi_tx ? *spi_tx++ : SPI_Fill);	//before reading, SCK idles less
+	}
+	in = SPI_Get();
+	if(spi_rx) *spi_rx++ = in;
+	if(--spi_recv == 0){
+		SPI_Irq_off();
+		SPI_Busy = 0;
+		if(spi_done) spi_done();
+	}
+}
+
+ISR(SPI_vect){
+	SPI_Cycles(SPI_CYCLES_ISR_GAP);
+	SPI_Next();
+	SPI_Cycles(SPI_CYCLES_ISR - SPI_CYCLES_ISR_GAP);
+}
+#endif
+
+void SPI_Transfer_Async(const unsigned char *tx, unsigned char *rx, unsigned char n, void (*done)(void)){
+	SPI_Wait();
+#if SPI_Engine == 0
+	SPI_Transfer(tx, rx, n);
+	if(done) done();
+#else
+	if(!n){
+		if(done) done();
+		return;
+	}
+	spi_tx = tx;
+	spi_rx = rx;
+	spi_send = n;
+	spi_recv = n;
+	spi_done = done;
+	SPI_Busy = 1;
+	for(unsigned char i = 0; i < SPI_Depth && spi_send; i++){
+		while(!SPI_Free());
+		spi_send--;
+		SPI_Put(spi_tx ? *spi_tx++ : SPI_Fill);
+	}
+	SPI_Irq_on();
+#endif
+}
+
+void SPI_Wait(){
+	while(SPI_Busy){
+	#if SPI_Engine != 0
+		if(!(SREG & 0x80) && SPI_Ready()){
+			SPI_Cycles(SPI_CYCLES_BULK);
+			SPI_Next();
+			continue;
+		}
+	#endif
+		SPI_Spin();
+	}
 }
 
 #endif /* SPI_H_ */
\ No newline at end of file
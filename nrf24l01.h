@@ -16,8 +16,13 @@
 
 /*ATmega8*/
 
+#ifndef NRF_SIM
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
+#endif
 #include "nrf_mnemonics.h"
 #include "SPI.h"
 
@@ -25,13 +30,160 @@
 
 #define CE				PINB1
 #define CSN				PINB2
-//#define IRQ				PINB0	//(use same port as CE and CSN)(comment it out if you want to use IRQ)
-									//(also modify nrf_transmit(), nrf_receive() and nrf_init()) 
 #define Cont_DDR		DDRB
 #define Cont_Pull		PORTB
 #define Cont_read		PINB
+
+/*IRQ line (only used when NRF_IRQ_MODE is 1)*/
+#define IRQ				PIND2								//nrf IRQ pin is connected to INT0
+#define Irq_DDR			DDRD
+#define Irq_Pull		PORTD
+#define Irq_read		PIND
+#define Irq_vect		INT0_vect							//external interrupt vector of IRQ pin
+#define Irq_sense		MCUCR &= ~((1<<ISC01)|(1<<ISC00))	//low level of INT0 generates interrupt
+#define Irq_enable		GICR |= (1<<INT0)					//enables INT0
+
+/*Second and third radio (NRF_RADIOS 2 or 3). SPI lines are shared, CE, CSN and IRQ are per radio*/
+#define CE_1			PINC0
+#define CSN_1			PINC1
+#define Cont_DDR_1		DDRC
+#define Cont_Pull_1		PORTC
+#define IRQ_1			PIND3								//IRQ of second radio is connected to INT1
+#define Irq_vect_1		INT1_vect
+#define Irq_sense_1		MCUCR &= ~((1<<ISC11)|(1<<ISC10))	//low level of INT1 generates interrupt
+#define Irq_enable_1	GICR |= (1<<INT1)
+#define CE_2			PINC2
+#define CSN_2			PINC3
+#define Cont_DDR_2		DDRC
+#define Cont_Pull_2		PORTC								//third radio has no external interrupt left (NRF_IRQ_MODE 0 only)
 /*********************************************/
 
+/*Radios*/
+#ifndef NRF_RADIOS
+#define NRF_RADIOS			1			//nrf modules driven by this MCU (1 to 3). Functions act on radio picked with nrf_select(),
+										//every radio has its own state, queues and statistics
+#endif
+
+/*Interrupt mode*/
+#ifndef NRF_IRQ_MODE
+#define NRF_IRQ_MODE		0			// 0: poll STATUS register over SPI until nrf changes state
+										// 1: wait for IRQ pin (external interrupt). Call sei() after nrf24l01_init()
+#endif
+#ifndef NRF_IRQ_SLEEP
+#define NRF_IRQ_SLEEP		1			// 1: CPU sleeps (idle mode) while waiting for IRQ ; 0: busy wait on event flags
+#endif
+
+/*Power up timing*/
+#define NRF_POR_TIMEOUT_MS	110			//Max wait for power on reset in nrf24l01_init() (100ms as per datasheet). nrf is probed every 1ms
+#define NRF_TPD2STBY_US		1500		//Power down to standby delay (Tpd2stby : 1500us with crystal, 150us with external clock)
+
+/*Clock of non blocking mode (nrf_poll())*/
+#ifndef NRF_CLOCK_US
+#define NRF_CLOCK_US()		nrf_clock_get()	//Microseconds (unsigned long). Add timer period to nrf_clock_us from a timer interrupt or define NRF_CLOCK_US() before including this file
+#endif
+
+/*Listening mode*/
+#define NRF_RX_QUEUE		2			//Number of payloads buffered in RAM per data pipe while listening (power of 2, 38 bytes each)
+
+/*ACK Payload queue (used if EN_ACK_PAY is 1)*/
+#define NRF_ACK_QUEUE		2			//Number of ACK Payloads queued in RAM per data pipe (power of 2, 33 bytes each)
+#define NRF_ACK_DEPTH		1			//ACK Payloads of one data pipe kept in TX FIFO at a time (1 to 3). 1 keeps a silent pipe from blocking the others
+
+/*Link statistics*/
+#ifndef NRF_STATS
+#define NRF_STATS			0			// 1: count link events (read with nrf_stats_snapshot()). Costs one SPI read of OBSERVE_TX per payload sent with auto ack
+										// 0: counting code is not compiled
+#endif
+
+/*Retransmit tuning*/
+#define NRF_SOFT_RETRIES	6			//Max times nrf_send() sends a payload again after MAX_RT (straight from TX FIFO)
+#define NRF_ACK_PAY_MAX		32			//Largest ACK Payload expected from PRX if EN_ACK_PAY is 1 (sets minimum ARD)
+#ifndef NRF_RETR_ADAPT
+#define NRF_RETR_ADAPT		0			// 1: ARD is kept at minimum for data rate and NRF_ACK_PAY_MAX, ARC and software retries of nrf_send()
+										//    follow ARC_CNT of OBSERVE_TX (one SPI read per payload). Can be paused at run time with nrf_cur->nrf_retr_auto
+										// 0: ARD and ARC stay as set below
+#endif
+#define NRF_RETR_WINDOW		16			//Payloads observed before ARC and software retries are changed
+#define NRF_RETR_ABSENT		4			//Windows in a row with nothing through at full retries before peer is taken as absent
+
+/*Control frames (nrf_ctrl_send()) : NRF_CTRL_MAGIC, type, value, check byte*/
+#ifndef NRF_CTRL_FRAMES
+#define NRF_CTRL_FRAMES		0			// 1: listening mode acts on control frames of peer (eg. channel change) instead of queuing them.
+										//    Width of receiving pipe must be 4 or dynamic. Application payloads of 4 bytes should not start with NRF_CTRL_MAGIC
+#endif
+#define NRF_CTRL_MAGIC		0xC7
+
+/*Frequency hopping (nrf_hop_start()). Payloads carry a 3 byte header : slot, blacklist entry, time in slot (1/256)*/
+#ifndef NRF_HOP
+#define NRF_HOP				0			// 1: compile hopping mode. PTX sends with nrf_hop_send(), PRX calls nrf_hop_poll() from main loop while listening
+#endif
+#define NRF_HOP_LEN			16			//Channels in hop sequence (power of 2, max 32)
+#define NRF_HOP_FIRST		2			//Hop channels are picked from NRF_HOP_FIRST to NRF_HOP_LAST
+#define NRF_HOP_LAST		80
+#define NRF_HOP_SLOT_US		20000ul		//Time on each channel (NRF_CLOCK_US())
+#define NRF_HOP_GUARD_US	2000		//PTX does not start a payload in last NRF_HOP_GUARD_US of a slot, PRX hops NRF_HOP_GUARD_US/2 early
+#define NRF_HOP_FAILS		3			//Payloads failing one after another on a channel that blacklist it (till slot counter wraps, 256 slots)
+#define NRF_HOP_LOST		(2 * NRF_HOP_LEN)	//Slots without a payload after which PRX waits on first channel of sequence for PTX
+
+/*Data rate control (nrf_rate_poll())*/
+#ifndef NRF_RATE_ADAPT
+#define NRF_RATE_ADAPT		0			// 1: PTX steps data rate between 2Mbps, 1Mbps and 250kbps on MAX_RT and ARC_CNT of OBSERVE_TX (one SPI read
+										//    per payload, needs auto ack) and takes PRX along with a control frame (NRF_CTRL_FRAMES 1 on PRX).
+										//    Both ends fall back to 250kbps when link is lost (nRF24L01+ only)
+#endif
+#define NRF_RATE_WINDOW		32			//Payloads observed before data rate is changed
+#define NRF_RATE_HOLD		2			//Windows to wait before trying a higher data rate (doubles after each failed try, max 64)
+#define NRF_RATE_LOST_MS	1000		//Time without ACK (PTX) or payload (PRX) after which data rate falls back to 250kbps
+
+/*Fragmentation (nrf_frag_send()). Frames carry a 2 byte header : message number (bit 7 = last frame), frame number*/
+#ifndef NRF_FRAG
+#define NRF_FRAG			0			// 1: compile fragmentation layer. Messages upto 65535 bytes are cut in frames, sent with
+										//    nrf_transmit_stream() and put together on PRX by listening mode (needs auto ack)
+#endif
+#define NRF_FRAG_SIZE		32			//Frame width, 8 to 32 (RX_Payload_Px of receiving pipe unless it has dynamic payload length)
+#define NRF_FRAG_WINDOW		32			//Frames sent ahead of oldest frame not yet ACKed (max 32)
+#define NRF_FRAG_BATCH		6			//Frames handed to nrf_transmit_stream() at a time (NRF_FRAG_SIZE bytes of RAM each)
+#define NRF_FRAG_FAILS		8			//Batches in a row without a frame ACKed after which nrf_frag_send() gives up
+
+/*Star network (nrf_hub_poll()). Every leaf sends in its own time slot and hub answers each payload with a grant in ACK Payload :
+  delay to next payload, length of cycle (both in 8us) and a request byte*/
+#ifndef NRF_HUB
+#define NRF_HUB				0			// 1: compile hub (PRX). Leaves are put on data pipes 1 to 5 in turn (needs ERX_P1-5, DPL_P1-5 and EN_ACK_PAY)
+										// 2: compile leaf (PTX, nrf_leaf_send(), needs EN_ACK_PAY). Address of a leaf is Data_Pipe1 with LSByte set to its id
+										// 3: compile both (hub and leaves on radios of one program, as nrf_bench does)
+#endif
+#define NRF_HUB_NODES		32			//Leaves of hub (max 250), one slot each per cycle
+#define NRF_HUB_SLOT_US		2000ul		//Time of each slot. Hub takes payload of a leaf 3/4 into its slot (NRF_CLOCK_US() of nrf_rx_slot), slot has to
+										//hold settling, payload, ACK, one retransmit and time hub takes to read payload
+#define NRF_HUB_LOST		4			//Payloads failing one after another after which leaf takes itself as out of sync
+#define NRF_HUB_RETRY_US	200000ul	//Leaf out of sync sends again after a random time upto this, till a payload comes back with a grant.
+										//Keep it several cycles long, leaves out of sync collide with those in sync
+
+/*Multi-hop routing (nrf_route_send()). Payloads carry a 5 byte header : destination, source, last hop, sequence number, hops.
+  Address of node n is Data_Pipe1 with LSByte n*/
+#ifndef NRF_ROUTE
+#define NRF_ROUTE			0			// 1: compile routing layer. Nodes listen on data pipe 1 and relay payloads of other nodes
+										//    (needs auto ack, ERX_P1, EN_DPL, DPL_P0 and DPL_P1)
+#endif
+#define NRF_ROUTE_NODES		16			//Node addresses are 1 to NRF_ROUTE_NODES-1, one routing table entry each (2 bytes)
+#define NRF_ROUTE_QUEUE		4			//Payloads a relay holds for forwarding (power of 2, 33 bytes each)
+#define NRF_ROUTE_HOPS		8			//Payloads are dropped after this many hops (routing loops)
+#define NRF_ROUTE_SEEN		8			//Last payloads (source and sequence number) remembered to drop duplicates
+
+/*Unacknowledged streaming (nrf_stream_write()). Payloads carry a 2 byte sequence number (LSByte first)*/
+#ifndef NRF_STREAM
+#define NRF_STREAM			0			// 1: compile streaming mode. PTX keeps TX FIFO full of payloads sent without ACK (W_TX_PAYLOAD_NOACK,
+										//    needs EN_DYN_ACK), PRX counts payloads missing from sequence and jitter of arrival times
+#endif
+
+/*Deadlines of blocking functions on NRF_CLOCK_US() (0 = wait forever). When one runs out nrf_recover() finds out whether nrf is
+  still there and sets it up again if it was reset. Can be changed at run time with nrf_cur->nrf_deadline_tx and nrf_cur->nrf_deadline_rx*/
+#define NRF_TX_DEADLINE_US	100000ul	//Longest wait for TX_DS or MAX_RT of a payload (nrf_send(), nrf_transmit_stream()). ARC retransmits take
+										//at most 16 x (4000us + airtime), nrf_send() waits upto NRF_SOFT_RETRIES + 1 times
+#define NRF_RX_DEADLINE_US	0			//Longest wait for a payload (nrf_recv(), nrf_recv_ackpayload()), waits forever as these always did.
+										//With a deadline returning checks that nrf is still there (a wait forever hangs on a reset or
+										//missing nrf), call again to keep waiting
+
 /***REFER DATASHEET FOR CHANGING THESE VALUES***/
 
 /*NRF CONFIG REG*/
@@ -47,12 +199,24 @@
 										// 0: disables auto ack on all data pipes
 										
 /*NRF Enable data pipe (Enable Rx addresses)*/
+#ifndef ERX_P5
 #define ERX_P5				0			// Enable data pipe 5
+#endif
+#ifndef ERX_P4
 #define ERX_P4				0			// Enable data pipe 4
+#endif
+#ifndef ERX_P3
 #define ERX_P3				0			// Enable data pipe 3
+#endif
+#ifndef ERX_P2
 #define ERX_P2				0			// Enable data pipe 2
+#endif
+#ifndef ERX_P1
 #define ERX_P1				0			// Enable data pipe 1
+#endif
+#ifndef ERX_P0
 #define ERX_P0				1			// Enable data pipe 0
+#endif
 
 /*Setup Address Width of TX/RX (common for all data pipes)*/
 #define AW					3			// 0 = 00; 1 = 01; 2 = 10; 3 = 11;			
@@ -82,6 +246,18 @@
 /*Transmitter address*/
 #define tx_address			0xE7E7E7E7E7ull		//used for PTX device only. LSByte written first.Should be same as data pipe address of the receiver sending to
 
+/*Second and third radio (NRF_RADIOS 2 or 3), settings not listed here are same as first radio*/
+#define Frequency_1			2440ul		//Frequency of second radio
+#define RF_PWR_1			RF_PWR		//RF Output Power of second radio
+#define Data_Pipe0_1		Data_Pipe0	//Receive Add for data pipe0 of second radio
+#define Data_Pipe1_1		Data_Pipe1	//Receive Add for data pipe1 of second radio (MSBytes of data pipes 2-5, hub and routing addresses)
+#define tx_address_1		tx_address	//Transmitter address of second radio
+#define Frequency_2			2478ul		//Frequency of third radio
+#define RF_PWR_2			RF_PWR
+#define Data_Pipe0_2		Data_Pipe0
+#define Data_Pipe1_2		Data_Pipe1
+#define tx_address_2		tx_address
+
 /*Setup RX Payload Size (for data pipe 0-5) (Can take value form 0x00-0x20 i.e form 1byte to 32byte (0 is pipe not used))*/
 #define RX_Payload_P0		1			//RX Payload size of data pipe 0
 #define RX_Payload_P1		0			//RX Payload size of data pipe 1
@@ -91,17 +267,232 @@
 #define RX_Payload_P5		0			//RX Payload size of data pipe 5
 
 /*Enable dynamic Payload length*/
+#ifndef DPL_P5
 #define DPL_P5				0			//Enable dynamic payload length on pipe5
+#endif
+#ifndef DPL_P4
 #define DPL_P4				0			//Enable dynamic payload length on pipe4
+#endif
+#ifndef DPL_P3
 #define DPL_P3				0			//Enable dynamic payload length on pipe3
+#endif
+#ifndef DPL_P2
 #define DPL_P2				0			//Enable dynamic payload length on pipe2
+#endif
+#ifndef DPL_P1
 #define DPL_P1				0			//Enable dynamic payload length on pipe1
+#endif
+#ifndef DPL_P0
 #define DPL_P0				0			//Enable dynamic payload length on pipe0
+#endif
 
 /*Setup Feature register*/
+#ifndef EN_DPL
 #define EN_DPL				0			//Enables Dynamic Payload length
+#endif
+#ifndef EN_ACK_PAY
 #define	EN_ACK_PAY			0			//Enables Payload with ACK
+#endif
+#ifndef EN_DYN_ACK
 #define	EN_DYN_ACK			0			//Enables the W_TX_PAYLOAD_NOACK command 
+#endif
+
+/*Results of nrf_send() (also left in nrf_cur->nrf_result by nrf_transmit() and receive functions)*/
+#define NRF_TX_FAILED		0			//no ACK received after max retransmits
+#define NRF_TX_SENT			1			//payload sent (and ACKed if auto ack is enabled)
+#define NRF_TX_ACK_PAYLOAD	2			//payload ACKed with ACK Payload
+#define NRF_TIMEOUT			3			//no event of nrf before deadline (NRF_TX_DEADLINE_US, NRF_RX_DEADLINE_US), nrf answers and holds its settings
+#define NRF_NO_CHIP			4			//nrf does not answer on SPI, or was reset and could not be set up again
+#define NRF_RX_DONE			1			//payload received (nrf_result of receive functions)
+#define NRF_TX_OK(result)	((unsigned char)((result) - NRF_TX_SENT) <= NRF_TX_ACK_PAYLOAD - NRF_TX_SENT)	//NRF_TX_SENT or NRF_TX_ACK_PAYLOAD
+
+/*Results of nrf_frag_recv()*/
+#define NRF_FRAG_WAIT		0			//message not complete yet
+#define NRF_FRAG_DONE		1			//message complete in buffer of nrf_frag_listen()
+#define NRF_FRAG_OVERFLOW	2			//message longer than buffer, rest of it dropped
+
+/*Routing table (nrf_route_set())*/
+#define NRF_ROUTE_DEFAULT	0			//destination of default route, taken for destinations without a route of their own
+#define NRF_ROUTE_NONE		0xFF		//no next hop (removes route)
+
+/*States of nrf in non blocking mode (nrf_poll())*/
+#define NRF_STATE_PD		0			//power down
+#define NRF_STATE_STBY		1			//standby-I (powered up, CE low)
+#define NRF_STATE_TX		2			//transmitting payload of nrf_send_async()
+#define NRF_STATE_RX		3			//receiving (listening mode)
+
+/*Control frame types*/
+#define NRF_CTRL_CHANNEL	1			//peer moves to RF channel given as value
+#define NRF_CTRL_RATE		2			//peer switches to data rate given as value (NRF_RATE_250K, NRF_RATE_1M or NRF_RATE_2M)
+
+/*Data rates (nrf_set_rate())*/
+#define NRF_RATE_250K		0
+#define NRF_RATE_1M			1
+#define NRF_RATE_2M			2
+
+#define NRF_CHANNELS		126			//RF channels 0 to 125 (2400 to 2525 MHz)
+
+/*Slot of software RX queues. Filled by nrf_rx_drain() (from nrf_irq_handler() if NRF_IRQ_MODE is 1), used in place with nrf_rx_peek()*/
+struct nrf_rx_slot {
+	unsigned char data[32];
+	unsigned char size;					//width of payload
+	unsigned char pipe;					//data pipe payload came in on
+	unsigned long time;					//NRF_CLOCK_US() when payload was read from RX FIFO
+};
+
+/*Link statistics (NRF_STATS). Counters wrap around, compare two snapshots or reset them*/
+struct nrf_stats {
+	unsigned long tx_sent;				//payloads done (TX_DS, or MAX_RT after last software retry), each counted once
+	unsigned long tx_acked;				//payloads ACKed (TX_DS with auto ack)
+	unsigned long tx_retrans;			//retransmits (ARC_CNT of OBSERVE_TX summed at every TX_DS and MAX_RT)
+	unsigned long tx_lost;				//MAX_RT events (nrf_send() tries a payload again upto 6 times)
+	unsigned long tx_retries;			//software retries, payload sent again from TX FIFO after MAX_RT (nrf_send(), nrf_transmit_stream())
+	unsigned long tx_arc[16];			//ACKed payloads by retransmits they needed (tx_arc[ARC_CNT]++)
+	unsigned char tx_plos;				//PLOS_CNT of OBSERVE_TX at last payload (lost packets since RF_CH was written, max 15)
+	unsigned long rx_count[6];			//payloads read from RX FIFO per data pipe in listening mode
+	unsigned long rx_dropped[6];		//payloads dropped per data pipe because its queue was full
+	unsigned long rx_fifo_full;			//RX FIFO full (RX_FULL of FIFO_STATUS, one SPI read) when nrf_rx_drain() started, nrf drops payloads arriving then
+	unsigned long spi_count;			//SPI transactions done
+	unsigned long spi_saved;			//SPI transactions avoided by shadow copy and merged STATUS clears
+	unsigned long spi_bytes;			//bytes clocked over SPI (command bytes included)
+	unsigned long wait_us;				//time spent waiting for nrf in nrf_wait_status() (NRF_CLOCK_US(), to resolution of its timer)
+	unsigned long timeouts;				//deadlines run out in nrf_wait_status()
+	unsigned long resets;				//nrf found reset and set up again by nrf_recover()
+};
+
+/*Report of last message sent or received in fragments (NRF_FRAG)*/
+struct nrf_frag_stats {
+	unsigned int bytes;					//size of message
+	unsigned int frames;				//frames of message
+	unsigned int sent;					//frames handed to nrf, retransmits included (sender)
+	unsigned int resent;				//frames sent again after max retransmits (sender)
+	unsigned int dups;					//frames received again because their ACK was lost (receiver)
+	unsigned int dropped;				//frames dropped while message was complete or too long for buffer (receiver, not reset)
+	unsigned long time_us;				//first frame to last frame ACKed (sender) or received (receiver) on NRF_CLOCK_US()
+	unsigned long goodput;				//bytes of message per second over time_us
+};
+
+/*Counters of routing layer (NRF_ROUTE). Counters wrap around, compare two reports or reset them*/
+struct nrf_route_stats {
+	unsigned long sent;					//payloads of this node ACKed by next hop
+	unsigned long failed;				//payloads of this node not ACKed by next hop
+	unsigned long delivered;			//payloads for this node passed to function of nrf_route_attach()
+	unsigned long forwarded;			//payloads of other nodes ACKed by next hop
+	unsigned long lost;					//payloads of other nodes not ACKed by next hop
+	unsigned long full;					//payloads of other nodes dropped because forwarding queue was full
+	unsigned long expired;				//payloads dropped after NRF_ROUTE_HOPS hops
+	unsigned long dups;					//payloads received again (retransmitted by a relay or routing loop), dropped
+};
+
+/*Report of stream received (NRF_STREAM)*/
+struct nrf_stream_stats {
+	unsigned long received;				//payloads received
+	unsigned long lost;					//payloads missing from sequence
+	unsigned long gaps;					//runs of payloads missing
+	unsigned long late;					//payloads older than last one (out of order), dropped
+	unsigned int max_gap;				//longest run of payloads missing
+	unsigned long loss_ppm;				//lost / (received + lost) in parts per million
+	unsigned long interval_us;			//average time between payloads (time across a gap is shared by payloads missing)
+	unsigned long jitter_us;			//average deviation of time between payloads from interval_us
+};
+
+/*Register values built from settings above (written by nrf24l01_init())*/
+#define NRF_AW_BYTES		(AW + 2)
+#define NRF_EN_AA			(ENAA_Px ? 0x3F : 0x00)
+#define NRF_EN_RXADDR		((ERX_P5<<5)|(ERX_P4<<4)|(ERX_P3<<3)|(ERX_P2<<2)|(ERX_P1<<1)|(ERX_P0))
+#define NRF_SETUP_RETR		((ARD<<4)|(ARC))
+#define NRF_RF_CH			(Frequency - 2400)
+#define NRF_RF_SETUP		((CONT_WAVE<<7)|(RF_DR_LOW<<5)|(PLL_LOCK<<4)|(RF_DR_HIGH<<3)|(RF_PWR<<1))
+//setting of radio n (0 to NRF_RADIOS-1), constant if n is
+#define NRF_OF(n, v0, v1, v2)	((n) == 0 ? (v0) : (n) == 1 ? (v1) : (v2))
+#define NRF_RF_CH_OF(n)		(NRF_OF(n, Frequency, Frequency_1, Frequency_2) - 2400)
+#define NRF_RF_SETUP_OF(n)	((NRF_RF_SETUP & ~(3<<1)) | (NRF_OF(n, RF_PWR, RF_PWR_1, RF_PWR_2)<<1))
+#define NRF_PIPE0_OF(n)		NRF_OF(n, 0ull + Data_Pipe0, 0ull + Data_Pipe0_1, 0ull + Data_Pipe0_2)
+#define NRF_PIPE1_OF(n)		NRF_OF(n, 0ull + Data_Pipe1, 0ull + Data_Pipe1_1, 0ull + Data_Pipe1_2)
+#define NRF_TX_ADDR_OF(n)	NRF_OF(n, 0ull + tx_address, 0ull + tx_address_1, 0ull + tx_address_2)
+#define NRF_DYNPD			((DPL_P5<<5)|(DPL_P4<<4)|(DPL_P3<<3)|(DPL_P2<<2)|(DPL_P1<<1)|(DPL_P0))
+#define NRF_FEATURE			((EN_DPL<<2)|(EN_ACK_PAY<<1)|(EN_DYN_ACK))
+
+/*Minimum ARD for ACK Payload of ack bytes (datasheet : 500us at 250kbps and 250us more per 8 bytes of ACK Payload,
+  500us at 1Mbps above 5 bytes and at 2Mbps above 15 bytes)*/
+#define NRF_ARD_MIN(ack)	(RF_DR_LOW ? ((ack) + 7) / 8 + 1 : RF_DR_HIGH ? ((ack) > 15) : ((ack) > 5))
+
+/*Settings are checked at compile time*/
+#if AW < 1 || AW > 3
+#error "AW must be 1 (3 byte address), 2 (4 byte address) or 3 (5 byte address)"
+#endif
+#if Data_Pipe0 > 0xFFFFFFFFFFull || Data_Pipe1 > 0xFFFFFFFFFFull || tx_address > 0xFFFFFFFFFFull || \
+	Data_Pipe0_1 > 0xFFFFFFFFFFull || Data_Pipe1_1 > 0xFFFFFFFFFFull || tx_address_1 > 0xFFFFFFFFFFull || \
+	Data_Pipe0_2 > 0xFFFFFFFFFFull || Data_Pipe1_2 > 0xFFFFFFFFFFull || tx_address_2 > 0xFFFFFFFFFFull
+#error "Data_Pipe0, Data_Pipe1 and tx_address (and those of second and third radio) can not be longer than 5 bytes"
+#endif
+#if RF_PWR > 3 || RF_PWR_1 > 3 || RF_PWR_2 > 3
+#error "RF_PWR (and RF_PWR_1, RF_PWR_2) must be from 0 to 3"
+#endif
+#if Data_Pipe2 > 0xFF || Data_Pipe3 > 0xFF || Data_Pipe4 > 0xFF || Data_Pipe5 > 0xFF
+#error "Data_Pipe2 to Data_Pipe5 are 1 byte (LSByte of address)"
+#endif
+#if Frequency < 2400 || Frequency > 2525 || Frequency_1 < 2400 || Frequency_1 > 2525 || Frequency_2 < 2400 || Frequency_2 > 2525
+#error "Frequency must be from 2400 to 2525 (MHz)"
+#endif
+#if NRF_RADIOS < 1 || NRF_RADIOS > 3 || (NRF_RADIOS == 3 && NRF_IRQ_MODE == 1)
+#error "NRF_RADIOS must be from 1 to 3 (upto 2 with NRF_IRQ_MODE 1, one external interrupt per radio)"
+#endif
+#if ARD > 15 || ARC > 15
+#error "ARD and ARC must be from 0 to 15"
+#endif
+#if NRF_RATE_ADAPT == 1 && (NRF_RATE_WINDOW < 1 || NRF_RATE_WINDOW > 255 || ENAA_Px == 0)
+#error "NRF_RATE_ADAPT needs auto ack (ENAA_Px) and NRF_RATE_WINDOW from 1 to 255"
+#endif
+#if NRF_FRAG == 1 && (NRF_FRAG_SIZE < 8 || NRF_FRAG_SIZE > 32 || NRF_FRAG_WINDOW < 1 || NRF_FRAG_WINDOW > 32 || NRF_FRAG_BATCH < 1 || ENAA_Px == 0)
+#error "NRF_FRAG needs auto ack (ENAA_Px), NRF_FRAG_SIZE from 8 to 32, NRF_FRAG_WINDOW from 1 to 32 and NRF_FRAG_BATCH above 0"
+#endif
+#if (NRF_HUB & 1) && (EN_ACK_PAY == 0 || (NRF_EN_RXADDR & 0x3E) != 0x3E || (NRF_DYNPD & 0x3E) != 0x3E)
+#error "Hub (NRF_HUB 1 or 3) needs EN_ACK_PAY, data pipes 1 to 5 (ERX_P1-5) and dynamic payload length on them (DPL_P1-5)"
+#endif
+#if (NRF_HUB & 2) && EN_ACK_PAY == 0
+#error "Leaf (NRF_HUB 2 or 3) needs EN_ACK_PAY (grant of hub comes in ACK Payload)"
+#endif
+#if NRF_HUB != 0 && (NRF_HUB_NODES < 1 || NRF_HUB_NODES > 250 || NRF_HUB_NODES * NRF_HUB_SLOT_US * 3 / 2 > 65535ul * 8)
+#error "NRF_HUB_NODES must be from 1 to 250 and 1.5 cycles (NRF_HUB_NODES * NRF_HUB_SLOT_US) fit in 16 bits of 8us"
+#endif
+#if NRF_ROUTE == 1 && (ENAA_Px == 0 || ERX_P1 == 0 || EN_DPL == 0 || DPL_P0 == 0 || DPL_P1 == 0 || NRF_HUB != 0)
+#error "NRF_ROUTE needs auto ack (ENAA_Px), data pipe 1 (ERX_P1) and dynamic payload length (EN_DPL, DPL_P0, DPL_P1), and can not be used with NRF_HUB"
+#endif
+#if NRF_ROUTE == 1 && (NRF_ROUTE_NODES < 2 || NRF_ROUTE_NODES > 255 || (NRF_ROUTE_QUEUE & (NRF_ROUTE_QUEUE - 1)) || NRF_ROUTE_HOPS < 1 || NRF_ROUTE_SEEN < 1)
+#error "NRF_ROUTE_NODES must be from 2 to 255, NRF_ROUTE_QUEUE a power of 2, NRF_ROUTE_HOPS and NRF_ROUTE_SEEN above 0"
+#endif
+#if NRF_STREAM == 1 && EN_DYN_ACK == 0
+#error "NRF_STREAM needs EN_DYN_ACK (W_TX_PAYLOAD_NOACK)"
+#endif
+#if NRF_HOP == 1 && (NRF_HOP_LEN > 32 || (NRF_HOP_LEN & (NRF_HOP_LEN - 1)) || NRF_HOP_LAST - NRF_HOP_FIRST + 1 < NRF_HOP_LEN || NRF_HOP_LAST > 125)
+#error "NRF_HOP_LEN must be a power of 2 upto 32 and fit in channels NRF_HOP_FIRST to NRF_HOP_LAST (max 125)"
+#endif
+#if ARD < NRF_ARD_MIN(EN_ACK_PAY ? NRF_ACK_PAY_MAX : 0)
+#error "ARD too short for data rate and ACK Payload, ACK would be missed (see NRF_ARD_MIN)"
+#endif
+#if RF_PWR > 3
+#error "RF_PWR must be from 0 to 3"
+#endif
+#if RF_DR_LOW == 1 && RF_DR_HIGH == 1
+#error "RF_DR_LOW and RF_DR_HIGH both set is reserved"
+#endif
+#if RX_Payload_P0 > 32 || RX_Payload_P1 > 32 || RX_Payload_P2 > 32 || RX_Payload_P3 > 32 || RX_Payload_P4 > 32 || RX_Payload_P5 > 32
+#error "RX_Payload_Px can not be more than 32 bytes"
+#endif
+#if (ERX_P0 && !DPL_P0 && !RX_Payload_P0) || (ERX_P1 && !DPL_P1 && !RX_Payload_P1) || (ERX_P2 && !DPL_P2 && !RX_Payload_P2) || \
+	(ERX_P3 && !DPL_P3 && !RX_Payload_P3) || (ERX_P4 && !DPL_P4 && !RX_Payload_P4) || (ERX_P5 && !DPL_P5 && !RX_Payload_P5)
+#error "Enabled data pipe (ERX_Px) needs RX_Payload_Px or dynamic payload length (DPL_Px)"
+#endif
+#if NRF_DYNPD != 0 && EN_DPL == 0
+#error "DPL_Px needs EN_DPL"
+#endif
+#if EN_ACK_PAY == 1 && (EN_DPL == 0 || DPL_P0 == 0)
+#error "EN_ACK_PAY needs EN_DPL and DPL_P0 (ACK Payloads have dynamic length)"
+#endif
+#if EN_ACK_PAY == 1 && ENAA_Px == 0
+#error "EN_ACK_PAY needs auto ack (ENAA_Px)"
+#endif
 
 /**********IMPORTANT FUNCTIONS*************/
 
@@ -109,14 +500,20 @@
 * Description : initialize nrf24l01+ module with important commands and settings such as auto acknowledgment,
 *				Data pipe, Address width, Re-transmission setting, RF channel setting, RF setup(speed),
 *				RX and TX addresses, RX payload size for each data pipe, Dynamic payload and other features
-*				like auto acknowledgment payload etc.
+*				like auto acknowledgment payload etc. Waits for power on reset of nrf by probing it, then
+*				writes only registers differing from their reset value and reads all of them back.
+*				With NRF_RADIOS above 1 it sets up radio picked with nrf_select() (channel, RF power
+*				and addresses of Frequency_1, RF_PWR_1 ... for second radio), call it once per radio.
 *				REFER DATASHEET AND MAKE CHANGES ABOVE
+* Returns	  : unsigned char nrf24l01_init = 1 if nrf is configured ; 0 if nrf does not respond or
+*				a register does not read back as written
 **************************************************************************************************/
-void nrf24l01_init(void);
+unsigned char nrf24l01_init(void);
 
 /*************************************************************************************************
 * Description : Configure nrf24l01+ as PRIMARY TX or PRIMARY RX as well as powers module.
-*				use this after initializing
+*				use this after initializing. Waits Tpd2stby (NRF_TPD2STBY_US) only when module was
+*				powered down and is powered up
 * Parameters  : PWR_UP = power up module (1 = ON) (0 = OFF)
 *				PRIM_RX = Primary RX or mode (1 = PRX) (0 = PTX)
 **************************************************************************************************/
@@ -126,432 +523,3122 @@ void nrf_config(unsigned char PWR_UP, unsigned char PRIM_RX);
 * Description : Transmits the array of data in TX FIFO. Supports simple transmission WITHOUT
 *				ACK, transmission with ACK and transmission with ACK PAYLOAD.
 * Parameters  : unsigned char *data = array of data to be transmitted in TX FIFO
-*				unsigned char Byte_size = size of array of data (max 5 bytes)
-* Returns	  : unsigned char *nrf_transmit = returns array of data that is ACK Payload
+*				unsigned char Byte_size = size of array of data (max 32 bytes)
+* Returns	  : unsigned char *nrf_transmit = returns array of data that is ACK Payload (0 if there
+*				is none, result of nrf_send() is left in nrf_result)
 **************************************************************************************************/
 unsigned char *nrf_transmit(unsigned char *data, unsigned char Byte_size);
 
+/*************************************************************************************************
+* Description : Same as nrf_transmit() but payload is sent straight from caller's array and ACK
+*				Payload is read straight into caller's array. Each wait for TX_DS or MAX_RT ends
+*				after nrf_deadline_tx, nrf is then checked with nrf_recover()
+* Parameters  : const unsigned char *data = array of data to be transmitted in TX FIFO
+*				unsigned char Byte_size = size of array of data (max 32 bytes)
+*				unsigned char *ack = array of 32 bytes receiving ACK Payload (0 = discard it)
+*				unsigned char *ack_size = size of ACK Payload read in ack (0 = no ACK Payload)
+* Returns	  : unsigned char nrf_send = NRF_TX_FAILED, NRF_TX_SENT, NRF_TX_ACK_PAYLOAD, NRF_TIMEOUT
+*				or NRF_NO_CHIP
+**************************************************************************************************/
+unsigned char nrf_send(const unsigned char *data, unsigned char Byte_size, unsigned char *ack, unsigned char *ack_size);
+
+/*************************************************************************************************
+* Description : Transmits a stream of payloads keeping upto 3 of them queued in TX FIFO. CE is
+*				kept high while TX FIFO is not empty and FIFO is refilled as payloads are sent.
+*				Supports transmission WITHOUT ACK and with ACK.
+* Parameters  : unsigned char *data = array of count payloads of Byte_size bytes each
+*				unsigned char Byte_size = size of each payload (max 32 bytes)
+*				unsigned char count = number of payloads to be transmitted
+*				unsigned char *result = array of count results (1 = sent ; 0 = failed after max
+*				retransmits, each time it was sent again from TX FIFO upto nrf_retr_soft times)
+*				(use 0 if not needed)
+* Returns     : unsigned char nrf_transmit_stream = number of payloads sent successfully. Payloads
+*				left when nrf_deadline_tx runs out are failed (NRF_TIMEOUT or NRF_NO_CHIP in nrf_result)
+**************************************************************************************************/
+unsigned char nrf_transmit_stream(const unsigned char *data, unsigned char Byte_size, unsigned char count, unsigned char *result);
+
 /*************************************************************************************************
 * Description : Returns the Received data stored in RX FIFO. Supports ACK and noACK
-* Parameters  : unsigned char Rec_Byte_Size = size of array of received data in RX FIFO
-* Returns     : unsigned char *nrf_receive = array of data that is present in RX FIFO
+* Parameters  : unsigned char Rec_Byte_Size = max size of received data (32 bytes if dynamic payload
+*				length is enabled, width of data pipe otherwise)
+* Returns     : unsigned char *nrf_receive = array of data that is present in RX FIFO (0 if no
+*				payload came before nrf_deadline_rx, NRF_TIMEOUT or NRF_NO_CHIP is left in nrf_result)
 **************************************************************************************************/
 unsigned char *nrf_receive(unsigned char Rec_Byte_size);
 
+/*************************************************************************************************
+* Description : Same as nrf_receive() but payload is read straight into caller's array
+* Parameters  : unsigned char *data = array receiving payload
+*				unsigned char Rec_Byte_Size = size of array data (max size of payload read)
+* Returns     : unsigned char nrf_recv = size of payload read in data (width of payload reported
+*				by R_RX_PL_WID if dynamic payload length is enabled on data pipe). 0 if no payload
+*				came before nrf_deadline_rx (nrf_result = NRF_TIMEOUT or NRF_NO_CHIP)
+**************************************************************************************************/
+unsigned char nrf_recv(unsigned char *data, unsigned char Rec_Byte_size);
+
 /*************************************************************************************************
 * Description : Returns the Received data stored in RX FIFO. Supports ACK with Payload
 * Parameters  : unsigned char *data = Array of data in ACK Payload
-*				unsigned char Ack_Byte_Size = size of array of ACK Payload(max 5 bytes)
-*				unsigned char Rec_Byte_Size = size of array of received data in RX FIFO
-* Returns     : unsigned char *nrf_receive = array of data that is present in RX FIFO
+*				unsigned char Ack_Byte_Size = size of array of ACK Payload(max 32 bytes)
+*				unsigned char Rec_Byte_Size = max size of received data
+* Returns     : unsigned char *nrf_receive = array of data that is present in RX FIFO (0 if no
+*				payload came before nrf_deadline_rx)
 **************************************************************************************************/
 unsigned char *nrf_receive_ackpayload(unsigned char *data, unsigned char Ack_Byte_size, unsigned char Rec_Byte_size);
 
 /*************************************************************************************************
-* Description : Returns array of data read from particular register (eg. STATUS, RX FIFO)
+* Description : Same as nrf_receive_ackpayload() but ACK Payload is sent straight from caller's
+*				array and payload is read straight into caller's array
+* Parameters  : const unsigned char *ack = Array of data in ACK Payload
+*				unsigned char Ack_Byte_Size = size of array of ACK Payload (max 32 bytes)
+*				unsigned char *data = array receiving payload
+*				unsigned char Rec_Byte_Size = size of array data (max size of payload read)
+* Returns     : unsigned char nrf_recv_ackpayload = size of payload read in data (0 if no payload
+*				came before nrf_deadline_rx)
+**************************************************************************************************/
+unsigned char nrf_recv_ackpayload(const unsigned char *ack, unsigned char Ack_Byte_size, unsigned char *data, unsigned char Rec_Byte_size);
+
+/*************************************************************************************************
+* Description : Starts listening mode. CE stays high and every payload received is moved from
+*				RX FIFO to software queue of its data pipe (NRF_RX_QUEUE payloads each) or to the
+*				function attached to data pipe with nrf_pipe_attach(). Configure module as PRX
+*				with nrf_config(1,1) before calling this
+**************************************************************************************************/
+void nrf_listen(void);
+
+/*************************************************************************************************
+* Description : Stops listening mode (CE low). Payloads in software queue are kept
+**************************************************************************************************/
+void nrf_listen_stop(void);
+
+/*************************************************************************************************
+* Description : Moves all payloads present in RX FIFO to software queue. Call it regularly from
+*				main loop in listening mode (done by nrf_irq_handler() if NRF_IRQ_MODE is 1)
+* Returns     : unsigned char nrf_listen_poll = number of payloads read from RX FIFO
+**************************************************************************************************/
+unsigned char nrf_listen_poll(void);
+
+/*************************************************************************************************
+* Description : Moves all payloads present in RX FIFO to software queues whether listening or not.
+*				Used by nrf_listen_poll() and by nrf_transmit_stream() for ACK Payloads, which are
+*				then read from queue of data pipe 0 with nrf_pipe_read(0,data)
+* Returns     : unsigned char nrf_rx_drain = number of payloads read from RX FIFO
+**************************************************************************************************/
+unsigned char nrf_rx_drain(void);
+
+/*************************************************************************************************
+* Description : Returns number of payloads waiting in software queues of all data pipes
+**************************************************************************************************/
+unsigned char nrf_rx_available(void);
+
+/*************************************************************************************************
+* Description : Copies oldest payload of lowest data pipe having one to data and removes it from queue
+* Parameters  : unsigned char *data = array of 32 bytes receiving payload
+* Returns     : unsigned char nrf_rx_read = size of payload (0 = all queues empty)
+**************************************************************************************************/
+unsigned char nrf_rx_read(unsigned char *data);
+
+/*************************************************************************************************
+* Description : Returns number of payloads waiting in software queue of a data pipe
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+**************************************************************************************************/
+unsigned char nrf_pipe_available(unsigned char pipe);
+
+/*************************************************************************************************
+* Description : Copies oldest payload received on a data pipe to data and removes it from queue
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+*				unsigned char *data = array of 32 bytes receiving payload
+* Returns     : unsigned char nrf_pipe_read = size of payload (0 = queue empty)
+**************************************************************************************************/
+unsigned char nrf_pipe_read(unsigned char pipe, unsigned char *data);
+
+/*************************************************************************************************
+* Description : Returns oldest payload of lowest data pipe having one without copying it. Payload
+*				stays in its queue slot, which is not filled again till nrf_rx_release(). Queues
+*				have one writer (nrf_rx_drain()) and one reader, so neither side disables interrupts
+* Returns     : const struct nrf_rx_slot *nrf_rx_peek = slot holding payload, its size, data pipe
+*				and time it was read from RX FIFO (0 = all queues empty)
+**************************************************************************************************/
+const struct nrf_rx_slot *nrf_rx_peek(void);
+
+/*************************************************************************************************
+* Description : Same as nrf_rx_peek() for one data pipe
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+* Returns     : const struct nrf_rx_slot *nrf_pipe_peek = slot holding oldest payload (0 = queue empty)
+**************************************************************************************************/
+const struct nrf_rx_slot *nrf_pipe_peek(unsigned char pipe);
+
+/*************************************************************************************************
+* Description : Removes payload returned by nrf_rx_peek() or nrf_pipe_peek() from its queue, slot
+*				can be filled again
+* Parameters  : const struct nrf_rx_slot *slot = slot returned by nrf_rx_peek() or nrf_pipe_peek()
+**************************************************************************************************/
+void nrf_rx_release(const struct nrf_rx_slot *slot);
+
+/*************************************************************************************************
+* Description : Attaches a function receiving payloads of a data pipe in listening mode instead of
+*				its software queue (called from nrf_irq_handler() if NRF_IRQ_MODE is 1)
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+*				void (*callback)(...) = function receiving payload and its size (0 = use queue)
+**************************************************************************************************/
+void nrf_pipe_attach(unsigned char pipe, void (*callback)(const unsigned char *data, unsigned char size));
+
+/*************************************************************************************************
+* Description : Queues an ACK Payload for a data pipe (PRX only, EN_ACK_PAY must be 1). Queued
+*				payloads are moved to TX FIFO with W_ACK_PAYLOAD as earlier ones are sent, so each
+*				payload received on the pipe is answered with the next one in queue
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+*				const unsigned char *data = array of data in ACK Payload
+*				unsigned char Byte_size = size of array of data (max 32 bytes)
+* Returns     : unsigned char nrf_ack_write = 1 if queued ; 0 if queue of data pipe is full
+**************************************************************************************************/
+unsigned char nrf_ack_write(unsigned char pipe, const unsigned char *data, unsigned char Byte_size);
+
+/*************************************************************************************************
+* Description : Returns number of ACK Payloads of a data pipe waiting in RAM (not yet in TX FIFO)
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+**************************************************************************************************/
+unsigned char nrf_ack_pending(unsigned char pipe);
+
+/*************************************************************************************************
+* Description : Moves queued ACK Payloads to TX FIFO, round robin over data pipes and upto
+*				NRF_ACK_DEPTH per pipe, till TX FIFO is full. Called by nrf_ack_write() and by
+*				nrf_listen_poll() after payloads are received
+**************************************************************************************************/
+void nrf_ack_refill(void);
+
+/*************************************************************************************************
+* Description : Returns width of payload at top of RX FIFO. Width is read with R_RX_PL_WID on
+*				data pipes using dynamic payload length, otherwise it is RX_PW_Px of the pipe.
+*				RX FIFO is flushed if R_RX_PL_WID reports more than 32 bytes (as per datasheet)
+* Parameters  : unsigned char *pipe = data pipe of payload (7 if RX FIFO is empty or flushed)
+* Returns     : unsigned char nrf_rx_width = width of payload (0 if RX FIFO is empty or flushed)
+**************************************************************************************************/
+unsigned char nrf_rx_width(unsigned char *pipe);
+
+/*************************************************************************************************
+* Description : Returns array of data read from particular register (eg. STATUS, RX FIFO).
+*				Array (one per radio) is overwritten by next call, use read_nrf_buf() in new code
+* Parameters  : unsigned char Register = register address from which data is to be read (use mnemonics)
+*				unsigned char Byte_size = size of data that is being read (max 32 bytes)
+* Returns     : unsigned char *read_nrf =  array of data read from register
+**************************************************************************************************/
+unsigned char *read_nrf(unsigned char Register, unsigned char Byte_size);
+
+/*************************************************************************************************
+* Description : Reads data from particular register (eg. FIFO_STATUS, RX FIFO) into array given by
+*				caller. Can be used from main program and interrupt at the same time. Single byte
+*				registers only changed by this library are read from shadow copy without SPI
 * Parameters  : unsigned char Register = register address from which data is to be read (use mnemonics)
-*				unsigned char Byte_size = size of data that is being read (max 5 bytes)
-* Returns     : static unsigned char *read_nrf =  array of data read from register
+*				unsigned char *data = array receiving data read from register
+*				unsigned char Byte_size = size of data that is being read (max 32 bytes)
+* Returns     : unsigned char read_nrf_buf = STATUS register clocked out with the command
 **************************************************************************************************/
-static unsigned char *read_nrf(unsigned char Register, unsigned char Byte_size);
+unsigned char read_nrf_buf(unsigned char Register, unsigned char *data, unsigned char Byte_size);
 
 /*************************************************************************************************
-* Description : writes array of data to the following registers (eg. TX FIFO).
+* Description : writes array of data to the following registers (eg. TX FIFO). Writing a single
+*				byte register with value it already holds (shadow copy) is skipped
 * Parameters  : unsigned char Register = Register address to which data is to written (use mnemonics)
-*				unsigned char *data = array data that is to be written
-*				unsigned char Byte_size = size of data that is to be written (max 5 bytes)
+*				const unsigned char *data = array data that is to be written
+*				unsigned char Byte_size = size of data that is to be written (max 32 bytes)
+* Returns     : unsigned char write_nrf = STATUS register clocked out with the command
 **************************************************************************************************/
-void write_nrf(unsigned char Register,unsigned char *data, unsigned char Byte_size);
+unsigned char write_nrf(unsigned char Register,const unsigned char *data, unsigned char Byte_size);
 
+/*************************************************************************************************
+* Description : Clocks a command and its data in one bulk transfer driven by SPI_Engine (SPI.h)
+*				and returns without waiting if SPI_Engine is 1 or 2. Data is copied, caller may
+*				reuse it at once. Other SPI functions wait till the transfer is done
+* Parameters  : unsigned char Command = command byte (eg. W_TX_PAYLOAD, W_ACK_PAYLOAD, R_RX_PAYLOAD)
+*				const unsigned char *data = bytes following command (0 = NOP)
+*				unsigned char *rx = receives bytes clocked out after STATUS (0 = discard). Must
+*				stay valid till callback is called
+*				unsigned char Byte_size = size of data (max 32 bytes)
+*				void (*callback)(unsigned char status) = called with STATUS when CSN is high
+*				again, from SPI interrupt if SPI_Engine is 1 or 2 (0 = none)
+**************************************************************************************************/
+void nrf_spi_async(unsigned char Command, const unsigned char *data, unsigned char *rx, unsigned char Byte_size, void (*callback)(unsigned char status));
 
-/******************OTHER FUNCTIONS****************************/
+/*************************************************************************************************
+* Description : Clears TX_DS, MAX_RT and RX_DR flags in a single write of STATUS. Flags already
+*				cleared as per last STATUS clocked out of nrf (nrf_status) are not written again
+* Parameters  : unsigned char flags = STATUS flags to clear (other bits are ignored)
+**************************************************************************************************/
+void nrf_clear_status(unsigned char flags);
 
 /*************************************************************************************************
-* Description : enables auto ack ON or OFF on all data pipes
+* Description : Forgets register values cached by read_nrf_buf() and write_nrf(). Use it if nrf
+*				may have been reset or was written without these functions
 **************************************************************************************************/
-void autoack(void);
+void nrf_shadow_reset(void);
 
 /*************************************************************************************************
-* Description : enables or disables data pipe/s (from 0 to 5)
+* Description : Returns value of a single byte register from shadow copy (read from nrf if not
+*				cached yet). Not counted in nrf_spi_saved
+* Parameters  : unsigned char Register = register address (eg. DYNPD, RF_SETUP)
 **************************************************************************************************/
-void enable_pipe(void);
+unsigned char nrf_shadow_get(unsigned char Register);
 
 /*************************************************************************************************
-* Description : Sets TX and RX address width of the module
+* Description : Waits till nrf raises any of the requested events. Polls STATUS register if
+*				NRF_IRQ_MODE is 0, otherwise sleeps till nrf_irq_handler() reports the event (a
+*				timer interrupt running NRF_CLOCK_US() wakes it to check deadline). Interrupts are
+*				left as caller had them, called with interrupts off it runs nrf_irq_handler() itself
+* Parameters  : unsigned char mask = STATUS flags to wait for (eg. (1<<TX_DS)|(1<<MAX_RT))
+*				unsigned long deadline_us = longest wait on NRF_CLOCK_US() (0 = no limit)
+* Returns     : unsigned char nrf_wait_status = STATUS flags raised by nrf (0 if deadline ran
+*				out or STATUS does not read as from nrf, bit 7 set)
 **************************************************************************************************/
-void address_width(void);
+unsigned char nrf_wait_status(unsigned char mask, unsigned long deadline_us);
 
 /*************************************************************************************************
-* Description : Sets the Re-Transmission register of module
+* Description : Checks that nrf answers on SPI and still holds registers of shadow copy. A brown
+*				out or loose supply resets them : nrf is then set up again from shadow copy,
+*				RX_ADDR_P0, RX_ADDR_P1 and TX_ADDR last written and register image of nrf24l01_init()
+*				without waiting for power on reset. Called by blocking functions when a deadline
+*				runs out
+* Returns     : unsigned char nrf_recover = 1 if nrf holds its settings ; 2 if it was reset and is
+*				set up again ; 0 if nrf does not answer (or is still in power on reset)
 **************************************************************************************************/
-void re_trans(void);
+unsigned char nrf_recover(void);
 
 /*************************************************************************************************
-* Description : Sets RF channel frequency (from 2.400 GHz to 2.525 GHz)
+* Description : IRQ handler. Reads and clears STATUS in a single SPI transaction and dispatches
+*				TX_DS, MAX_RT and RX_DR events to nrf_wait_status() and to attached callback.
+*				Called from external interrupt when NRF_IRQ_MODE is 1 (or by a simulated radio)
 **************************************************************************************************/
-void rf_ch(void);
+void nrf_irq_handler(void);
 
 /*************************************************************************************************
-* Description : Sets RF speed (250kbps, 1Mbps or 2Mbps) and RF power
+* Description : Attaches a function that is called from nrf_irq_handler() on every event
+* Parameters  : void (*callback)(unsigned char events) = function receiving TX_DS, MAX_RT and
+*				RX_DR flags (0 detaches callback)
 **************************************************************************************************/
-void rf_setup(void);
+void nrf_irq_attach(void (*callback)(unsigned char events));
+
+/*******************NON BLOCKING FUNCTIONS (nrf_poll())**********************/
 
 /*************************************************************************************************
-* Description : Sets RX address of all data pipes from 0 to 5
+* Description : Powers up nrf as standby-I without waiting. nrf_poll() holds CE low till Tpd2stby
+*				(NRF_TPD2STBY_US) has passed on NRF_CLOCK_US()
 **************************************************************************************************/
-void rx_add(void);
+void nrf_power_up(void);
 
 /*************************************************************************************************
-* Description : Sets TX address of module
+* Description : Powers down nrf (CE low). Payloads in software queues are kept
 **************************************************************************************************/
-void tx_add(void);
+void nrf_power_down(void);
 
 /*************************************************************************************************
-* Description : Sets RX Payload size of all data pipes
+* Description : Goes to standby-I from RX (CE low). A payload in flight is left to nrf_poll()
 **************************************************************************************************/
-void rx_payload(void);
+void nrf_standby(void);
 
 /*************************************************************************************************
-* Description : Sets Dynamic Payload size in data pipes
+* Description : Starts transmission of a payload and returns at once. nrf_poll() completes it and
+*				reports result in nrf_cur->nrf_tx_done/nrf_tx_result and to function attached with
+*				nrf_tx_attach(). ACK Payload goes to queue of data pipe 0 (nrf_pipe_read(0,data)).
+*				Powers up nrf if needed. If SPI_Engine is 1 or 2 payload is loaded in background
+*				(nrf_spi_async()) and CE goes high when it is in TX FIFO
+* Parameters  : const unsigned char *data = array of data to be transmitted in TX FIFO
+*				unsigned char Byte_size = size of array of data (max 32 bytes)
+* Returns     : unsigned char nrf_send_async = 1 if started ; 0 if a payload is still in flight
 **************************************************************************************************/
-void dynamic_payload(void);
+unsigned char nrf_send_async(const unsigned char *data, unsigned char Byte_size);
 
 /*************************************************************************************************
-* Description : Enables features like dynamic payload, auto ack with payload etc.
+* Description : Starts listening mode without waiting (as PRX, CE high when nrf is ready).
+*				Payloads are read with nrf_rx_read() or nrf_pipe_read(). Powers up nrf if needed
 **************************************************************************************************/
-void feature(void);
+void nrf_rx_start(void);
 
-/************************FUNCTION DEFINATIONS*********************************/
+/*************************************************************************************************
+* Description : Runs state machine of non blocking mode. Call it regularly from main loop (and
+*				after waking up from IRQ if NRF_IRQ_MODE is 1). Never waits
+* Returns     : unsigned char nrf_poll = NRF_STATE_PD, NRF_STATE_STBY, NRF_STATE_TX or NRF_STATE_RX
+**************************************************************************************************/
+unsigned char nrf_poll(void);
 
-/********MODIFY FIRST THREE FUNCTION TO USE IRQ***********/
+/*************************************************************************************************
+* Description : Attaches a function called from nrf_poll() when payload of nrf_send_async() is done
+* Parameters  : void (*callback)(unsigned char result) = function receiving NRF_TX_FAILED,
+*				NRF_TX_SENT or NRF_TX_ACK_PAYLOAD (0 detaches callback)
+**************************************************************************************************/
+void nrf_tx_attach(void (*callback)(unsigned char result));
 
-void nrf24l01_init(){
-	SPI_init();				//initialize SPI
-	DDR_high;				//CE and CSN as output
-	//DDR_low;				//IRQ as input
-	//IRQ_low;				//pull down IRQ
-	CE_low;
-	CSN_high;
-	_delay_ms(110);			//power on reset
-	autoack();
-	enable_pipe();
-	address_width();
-	re_trans();
-	rf_ch();
-	rf_setup();
-	rx_add();
-	tx_add();
-	rx_payload();
-	dynamic_payload();
-	feature();
-}
-unsigned char *nrf_transmit(unsigned char *data, unsigned char Byte_size){
-	char tries = 0;
-	jump: write_nrf(FLUSH_TX,data,0);
-	write_nrf(FLUSH_RX,data,0);
-	unsigned char temp[Byte_size];
-	for (unsigned char i = 0; i < Byte_size; i++){
-		temp[i] = *data;
-		data++;
-	}
-	write_nrf(W_TX_PAYLOAD,temp,Byte_size);
-	unsigned char temp1[1];
-	
-	if(ENAA_Px == 0){
-		CE_high;
-		_delay_us(20);								//minimum 10us pulse
-		//use this :
-		temp1[0] = *read_nrf(STATUS,0);
-		while(!(temp1[0] & (1<<5))){				//checking status register for change in nrf
-			temp1[0] = *read_nrf(STATUS,0);
-		}
-		//or this :
-		//while (!(Cont_read & (1<<IRQ)));
-		CE_low;
-		unsigned char data1[1];
-		if(temp1[0] & (1<<4)){
-			data1[0] = 	0x1e;
-			write_nrf(STATUS,data1,1);
-		}
-		if(temp1[0] & (1<<5)){
-			data1[0] = 0x2e;
-			write_nrf(STATUS,data1,1);
-		}
-		if(temp1[0] & (1<<6)){
-			data1[0] = 0x4e;
-			write_nrf(STATUS,data1,1);
-		}
-		return 0;
-	}
-	if(ENAA_Px == 1){
-		CE_high;
-		_delay_us(20);								//minimum 10us pulse
-		//use this :
-		temp1[0] = *read_nrf(STATUS,0);
-		while(!((temp1[0] & (1<<5)) || (temp1[0] & (1<<4)))){	//checking status register for change in nrf
-			temp1[0] = *read_nrf(STATUS,0);
-		}
-		//or this :
-		//while (!(Cont_read & (1<<IRQ)));
-		CE_low;
-		unsigned char data1[1];
-		if(temp1[0] & (1<<4)){
-			if(tries > 5){
-				return 0;
-			}
-			else{
-				tries++;
-				data1[0] = 	0x1e;
-				write_nrf(STATUS,data1,1);
-				goto jump;
-			}
-		}
-		//ACK with payload
-		if(temp1[0] & (1<<6)){
-			if(temp1[0] & (1<<4)){
-				data1[0] = 	0x1e;
-				write_nrf(STATUS,data1,1);
-			}
-			if(temp1[0] & (1<<5)){
-				data1[0] = 0x2e;
-				write_nrf(STATUS,data1,1);
-			}
-			if(temp1[0] & (1<<6)){
-				data1[0] = 0x4e;
-				write_nrf(STATUS,data1,1);
-			}
-			return read_nrf(R_RX_PAYLOAD,1);
-		}
-		//ACK without payload
-		else{
-			if(temp1[0] & (1<<4)){
-				data1[0] = 	0x1e;
-				write_nrf(STATUS,data1,1);
-			}
-			if(temp1[0] & (1<<5)){
-				data1[0] = 0x2e;
-				write_nrf(STATUS,data1,1);
-			}
-			if(temp1[0] & (1<<6)){
-				data1[0] = 0x4e;
-				write_nrf(STATUS,data1,1);
-			}
-			return 0;
-		}
-	}
-}
+/*******************STATISTICS FUNCTIONS (NRF_STATS)**************************/
 
-unsigned char *nrf_receive(unsigned char Rec_Byte_size){
-	unsigned char *data;
-	write_nrf(FLUSH_RX,data,0);
-	write_nrf(FLUSH_TX,data,0);
-	
-	unsigned char temp1[1];
-	CE_high;
-	_delay_us(140);									//minimum 130us delay
-	//use this :
-	temp1[0] = *read_nrf(STATUS,0);
-	while (!(temp1[0] & (1<<6))){					//checking status register for change in nrf
-		temp1[0] = *read_nrf(STATUS,0);
-	}
-	//or this :
-	//while (!(Cont_read & (1<<IRQ)));
-	CE_low;
-	unsigned char data1[1];
-	if(temp1[0] & (1<<4)){
-		data1[0] = 	0x1e;
-		write_nrf(STATUS,data1,1);
-	}
-	if(temp1[0] & (1<<5)){
-		data1[0] = 0x2e;
-		write_nrf(STATUS,data1,1);
-	}
-	if(temp1[0] & (1<<6)){
-		data1[0] = 0x4e;
-		write_nrf(STATUS,data1,1);
-	}
-	return read_nrf(R_RX_PAYLOAD,Rec_Byte_size);
-}
+/*************************************************************************************************
+* Description : Copies counters of link statistics in one go (interrupts are held off while copying
+*				if NRF_IRQ_MODE is 1) and optionally resets them, so no event is lost between two
+*				snapshots. Fields other than rx_count, rx_dropped, spi_count and spi_saved stay 0 if
+*				NRF_STATS is 0
+* Parameters  : struct nrf_stats *stats = receives counters (0 = only reset)
+*				unsigned char reset = 1 resets counters after copying them
+**************************************************************************************************/
+void nrf_stats_snapshot(struct nrf_stats *stats, unsigned char reset);
 
-unsigned char *nrf_receive_ackpayload(unsigned char *data, unsigned char Ack_Byte_size, unsigned char Rec_Byte_size){
-	write_nrf(FLUSH_RX,data,0);
-	write_nrf(FLUSH_TX,data,0);
-	unsigned char temp[Ack_Byte_size];
-	for (unsigned char i = 0; i < Ack_Byte_size; i++){
-		temp[i] = *data;
-		data++;
-	}
-	write_nrf(W_ACK_PAYLOAD,temp,Ack_Byte_size);
-	unsigned char temp1[1];
-	CE_high;
-	_delay_us(140);									//minimum 130us delay
-	//use this :
-	temp1[0] = *read_nrf(STATUS,0);
-	while (!(temp1[0] & (1<<6))){					//checking status register for change in nrf
-		temp1[0] = *read_nrf(STATUS,0);
-	}
-	//or this :
-	//while (!(Cont_read & (1<<IRQ)));
-	CE_low;
-	unsigned char data1[1];
-	if(temp1[0] & (1<<4)){
-		data1[0] = 	0x1e;
-		write_nrf(STATUS,data1,1);
-	}
-	if(temp1[0] & (1<<5)){
-		data1[0] = 0x2e;
-		write_nrf(STATUS,data1,1);
-	}
-	if(temp1[0] & (1<<6)){
-		data1[0] = 0x4e;
-		write_nrf(STATUS,data1,1);
-	}
-	return read_nrf(R_RX_PAYLOAD,Rec_Byte_size);
-}
-void nrf_config(unsigned char PWR_UP, unsigned char PRIM_RX){
-	unsigned char config_reg[1];
-	config_reg[0] = ((MASK_RX_DR<<6)|(MASK_TX_DS<<5)|(MASK_MAX_RT<<4)|(EN_CRC<<3)|(CRCO<<2)|(PWR_UP<<1)|(PRIM_RX));
-	write_nrf(CONFIG,config_reg,1);
-	_delay_ms(5);												//Start up delay
-}
-void autoack(){
-	unsigned char ENAA_P[1];
-	if(ENAA_Px == 0) ENAA_P[0] = 0x00;
-	if(ENAA_Px == 1) ENAA_P[0] = 0x3F;
-	write_nrf(EN_AA,ENAA_P,1);
-}
-void enable_pipe(){
-	unsigned char ERX_Px[1];
-	ERX_Px[0] = ((ERX_P5<<5)|(ERX_P4<<4)|(ERX_P3<<3)|(ERX_P2<<2)|(ERX_P1<<1)|(ERX_P0));
-	write_nrf(EN_RXADDR,ERX_Px,1);
-}
-void address_width(){
-	unsigned char aw[1];
-	aw[0] = AW;
-	write_nrf(SETUP_AW,aw,1);
-}
-void re_trans(){
-	unsigned char RETR_reg[1];
-	RETR_reg[0] = ((ARD<<4)|(ARC));
-	write_nrf(SETUP_RETR,RETR_reg,1);
-}
-void rf_ch(){
-	unsigned char RFCH[1];
-	RFCH[0] = Frequency - 2400;
-	write_nrf(RF_CH,RFCH,1);
-}
-void rf_setup(){
-	unsigned char RF_reg[1];
-	RF_reg[0] = ((CONT_WAVE<<7)|(RF_DR_LOW<<5)|(PLL_LOCK<<4)|(RF_DR_HIGH<<3)|(RF_PWR<<1));
-	write_nrf(RF_SETUP,RF_reg,1);
-}
-void rx_add(){					
-	unsigned char Byte_size;
-	if (AW == 1) Byte_size = 3;
-	if (AW == 2) Byte_size = 4;
-	if (AW == 3) Byte_size = 5;
-	unsigned char Address[5];
-	Address[0] = (unsigned char) (0x00000000FF & Data_Pipe0);
-	Address[1] = (unsigned char) ((0x000000FF00 & Data_Pipe0)>>8);
-	Address[2] = (unsigned char) ((0x0000FF0000 & Data_Pipe0)>>16);
-	Address[3] = (unsigned char) ((0x00FF000000 & Data_Pipe0)>>24);
-	Address[4] = (unsigned char) ((0xFF00000000 & Data_Pipe0)>>32);
-	write_nrf(RX_ADDR_P0,Address,Byte_size);
-	
-	Address[0] = (unsigned char) (0x00000000FF & Data_Pipe1);
-	Address[1] = (unsigned char) ((0x000000FF00 & Data_Pipe1)>>8);
-	Address[2] = (unsigned char) ((0x0000FF0000 & Data_Pipe1)>>16);
-	Address[3] = (unsigned char) ((0x00FF000000 & Data_Pipe1)>>24);
-	Address[4] = (unsigned char) ((0xFF00000000 & Data_Pipe1)>>32);
-	write_nrf(RX_ADDR_P1,Address,Byte_size);
-	
-	Address[0] = Data_Pipe2;
-	write_nrf(RX_ADDR_P2,Address,1);
-	
-	Address[0] = Data_Pipe3;
-	write_nrf(RX_ADDR_P3,Address,1);
-	
-	Address[0] = Data_Pipe4;
-	write_nrf(RX_ADDR_P4,Address,1);
+/*************************************************************************************************
+* Description : Resets all counters of link statistics
+**************************************************************************************************/
+void nrf_stats_reset(void);
+
+
+/*******************CHANNEL FUNCTIONS*****************************************/
+
+/*************************************************************************************************
+* Description : Moves nrf to RF channel (2400 + channel MHz) at run time. Resets PLOS_CNT
+* Parameters  : unsigned char channel = 0 to 125 (channels above are ignored)
+**************************************************************************************************/
+void nrf_set_channel(unsigned char channel);
+
+/*************************************************************************************************
+* Description : Returns RF channel nrf is on (from shadow copy)
+**************************************************************************************************/
+unsigned char nrf_get_channel(void);
+
+/*************************************************************************************************
+* Description : Surveys RF channels first to last. On each channel nrf listens for 170us (RX
+*				settling and AGC delay) samples times and counts how often RPD (signal above
+*				-64dBm) was set. Takes about 0.2ms per sample. Channel, CONFIG and listening mode
+*				are restored afterwards. Not to be used while a payload of nrf_send_async() is in flight
+* Parameters  : unsigned char *map = array of NRF_CHANNELS bytes, map[channel] receives count
+*				unsigned char first, last = channels to survey (0 to 125)
+*				unsigned char samples = samples per channel (max 255)
+**************************************************************************************************/
+void nrf_survey(unsigned char *map, unsigned char first, unsigned char last, unsigned char samples);
+
+/*************************************************************************************************
+* Description : Picks clearest channel of a survey. A channel is scored by its own count (twice)
+*				and counts of neighbouring channels. Current channel is kept on a tie
+* Parameters  : const unsigned char *map = counts from nrf_survey()
+*				unsigned char first, last = channels to choose from
+* Returns     : unsigned char nrf_clear_channel = clearest channel
+**************************************************************************************************/
+unsigned char nrf_clear_channel(const unsigned char *map, unsigned char first, unsigned char last);
+
+/*************************************************************************************************
+* Description : Moves PTX and its PRX to another channel. Channel is sent to PRX in a control
+*				frame, then PTX follows. If the frame is not ACKed it is sent again on new channel
+*				(PRX may have moved with ACK lost) before giving up. PRX needs NRF_CTRL_FRAMES 1
+*				and listening mode
+* Parameters  : unsigned char channel = new channel (0 to 125)
+* Returns     : unsigned char nrf_channel_move = 1 if both moved ; 0 if PRX did not answer (PTX
+*				stays on old channel)
+**************************************************************************************************/
+unsigned char nrf_channel_move(unsigned char channel);
+
+/*************************************************************************************************
+* Description : Sends a control frame to peer with nrf_send()
+* Parameters  : unsigned char type = frame type (eg. NRF_CTRL_CHANNEL)
+*				unsigned char value = value carried by frame
+* Returns     : unsigned char nrf_ctrl_send = NRF_TX_FAILED, NRF_TX_SENT, NRF_TX_ACK_PAYLOAD,
+*				NRF_TIMEOUT or NRF_NO_CHIP
+**************************************************************************************************/
+unsigned char nrf_ctrl_send(unsigned char type, unsigned char value);
+
+/*************************************************************************************************
+* Description : Acts on a control frame received from peer. Called by listening mode for every
+*				payload when NRF_CTRL_FRAMES is 1
+* Parameters  : const unsigned char *data = received payload
+*				unsigned char size = size of payload
+* Returns     : unsigned char nrf_ctrl_handle = 1 if payload was a control frame ; 0 otherwise
+**************************************************************************************************/
+unsigned char nrf_ctrl_handle(const unsigned char *data, unsigned char size);
+
+/*******************DATA RATE FUNCTIONS*****************************************/
+
+/*************************************************************************************************
+* Description : Switches data rate at run time (RF_DR_LOW and RF_DR_HIGH set in rf_setup() are only
+*				the rate set by nrf24l01_init()). ARD is raised to the minimum of the new rate for
+*				NRF_ACK_PAY_MAX byte ACK Payloads (nrf_ard_min()), or set to it if NRF_RETR_ADAPT is 1
+* Parameters  : unsigned char rate = NRF_RATE_250K, NRF_RATE_1M or NRF_RATE_2M
+**************************************************************************************************/
+void nrf_set_rate(unsigned char rate);
+
+/*************************************************************************************************
+* Description : Returns data rate set now (NRF_RATE_250K, NRF_RATE_1M or NRF_RATE_2M)
+**************************************************************************************************/
+unsigned char nrf_get_rate(void);
+
+/*************************************************************************************************
+* Description : Switches PTX and its PRX to another data rate. Rate is sent to PRX in a control
+*				frame, then PTX follows. If the frame is not ACKed it is sent again at new rate (PRX
+*				may have switched with ACK lost) before giving up. PRX needs NRF_CTRL_FRAMES 1
+*				and listening mode
+* Parameters  : unsigned char rate = NRF_RATE_250K, NRF_RATE_1M or NRF_RATE_2M
+* Returns     : unsigned char nrf_rate_move = 1 if both switched ; 0 if PRX did not answer (PTX
+*				stays at old rate)
+**************************************************************************************************/
+unsigned char nrf_rate_move(unsigned char rate);
+
+/*************************************************************************************************
+* Description : Data rate control (NRF_RATE_ADAPT). Collects MAX_RT and ARC_CNT of payloads and
+*				every NRF_RATE_WINDOW payloads picks a rate for nrf_rate_poll() : one step lower if
+*				packets sent per payload ACKed cost more air time than next lower rate would (above
+*				1.2 at 2Mbps, 2 at 1Mbps), one step higher after NRF_RATE_HOLD windows with almost
+*				no retransmits, 250kbps at once if nothing got through
+* Parameters  : unsigned char status = STATUS flags of finished payload (TX_DS or MAX_RT)
+*				unsigned char arc_cnt = retransmits of the payload (ARC_CNT of OBSERVE_TX)
+**************************************************************************************************/
+void nrf_rate_adapt(unsigned char status, unsigned char arc_cnt);
+
+/*************************************************************************************************
+* Description : Runs data rate control (NRF_RATE_ADAPT). Call it from main loop between payloads on
+*				PTX and along with nrf_listen_poll() on PRX. PTX moves itself and PRX to rate picked
+*				by nrf_rate_adapt(). Either end falls back to 250kbps on its own after
+*				NRF_RATE_LOST_MS without an ACK (PTX) or a payload (PRX), so both meet there
+* Returns     : unsigned char nrf_rate_poll = data rate set now
+**************************************************************************************************/
+unsigned char nrf_rate_poll(void);
+
+/*******************FREQUENCY HOPPING FUNCTIONS (NRF_HOP)*********************/
+
+/*************************************************************************************************
+* Description : Starts hopping mode on PTX or PRX. Both build the same sequence of NRF_HOP_LEN
+*				channels from seed. Time is cut in slots of NRF_HOP_SLOT_US, slot n uses channel
+*				n % NRF_HOP_LEN of the sequence (next one if blacklisted). PTX sets the slot clock,
+*				PRX follows slot clock in received payloads and waits on first channel of sequence
+*				till it hears PTX
+* Parameters  : unsigned int seed = shared by PTX and PRX (eg. part of address)
+**************************************************************************************************/
+void nrf_hop_start(unsigned int seed);
+
+/*************************************************************************************************
+* Description : Stops hopping mode. nrf stays on its current channel
+**************************************************************************************************/
+void nrf_hop_stop(void);
+
+/*************************************************************************************************
+* Description : Sends a payload with nrf_send() on channel of current slot behind 3 byte hop
+*				header. A failed payload is sent once more on first channel of sequence (PRX may
+*				have lost slot clock) and counts against its channel (NRF_HOP_FAILS). NRF_TIMEOUT or
+*				NRF_NO_CHIP is returned at once
+* Parameters  : const unsigned char *data = array of data to be transmitted (max 29 bytes)
+*				unsigned char Byte_size = size of array of data
+* Returns     : unsigned char nrf_hop_send = NRF_TX_FAILED, NRF_TX_SENT, NRF_TX_ACK_PAYLOAD,
+*				NRF_TIMEOUT or NRF_NO_CHIP
+**************************************************************************************************/
+unsigned char nrf_hop_send(const unsigned char *data, unsigned char Byte_size);
+
+/*************************************************************************************************
+* Description : Hops PRX to channel of current slot. Call it from main loop at least a few times
+*				per slot along with nrf_listen_poll() (or nrf_poll())
+* Returns     : unsigned char nrf_hop_poll = channel nrf is listening on
+**************************************************************************************************/
+unsigned char nrf_hop_poll(void);
+
+/*************************************************************************************************
+* Description : Takes hop header off a payload received in hopping mode and follows slot clock
+*				and blacklist of PTX. Called by listening mode when NRF_HOP is 1
+* Parameters  : unsigned char *data = received payload (header is removed in place)
+*				unsigned char size = size of payload
+* Returns     : unsigned char nrf_hop_rx = size of payload without header
+**************************************************************************************************/
+unsigned char nrf_hop_rx(unsigned char *data, unsigned char size);
+
+/*******************RADIO FUNCTIONS (NRF_RADIOS)******************************/
+
+/*************************************************************************************************
+* Description : Picks radio driven by following calls. Each radio keeps its own state (nrf_state,
+*				nrf_status, queues, statistics etc.) so their pipelines run side by side, eg. one
+*				nrf_send_async() per radio and nrf_poll() on each in turn. IRQ of a radio is handled
+*				for it whichever radio is picked. Does nothing if NRF_RADIOS is 1
+* Parameters  : unsigned char radio = 0 (CE, CSN), 1 (CE_1, CSN_1) or 2 (CE_2, CSN_2)
+**************************************************************************************************/
+void nrf_select(unsigned char radio);
+
+/*******************FRAGMENTATION FUNCTIONS (NRF_FRAG)****************************/
+
+/*************************************************************************************************
+* Description : Sends a message of any length as frames of NRF_FRAG_SIZE bytes, NRF_FRAG_BATCH
+*				frames at a time with nrf_transmit_stream(). Upto NRF_FRAG_WINDOW frames are sent
+*				ahead of oldest frame not yet ACKed and only frames lost after max retransmits
+*				(MAX_RT) are sent again, in next batch, so a lost frame does not hold up the rest
+* Parameters  : const unsigned char *msg = message
+*				unsigned int size = size of message (upto 65535 bytes)
+* Returns     : unsigned char nrf_frag_send = 1 if every frame was ACKed ; 0 if NRF_FRAG_FAILS
+*				batches in a row got no frame through (peer absent)
+**************************************************************************************************/
+unsigned char nrf_frag_send(const unsigned char *msg, unsigned int size);
+
+/*************************************************************************************************
+* Description : Takes next message received on data pipe into buf. Listening mode passes frames of
+*				pipe to nrf_frag_rx() (nrf_pipe_attach()), which puts them in place whatever order
+*				they come in. Call it again after every message : frames coming in between are left
+*				in RX FIFO (payloads of other pipes wait behind them) and taken by this call, once
+*				RX FIFO is full nrf does not ACK them and peer sends them again, so a message peer
+*				got through is not lost. nrf_send() flushes RX FIFO, frames held are then lost
+* Parameters  : unsigned char pipe = data pipe (0 to 5)
+*				unsigned char *buf = array receiving message
+*				unsigned int size = size of buf
+**************************************************************************************************/
+void nrf_frag_listen(unsigned char pipe, unsigned char *buf, unsigned int size);
+
+/*************************************************************************************************
+* Description : Checks message being received in buffer of nrf_frag_listen()
+* Parameters  : unsigned int *size = receives size of message once it is complete
+* Returns     : unsigned char nrf_frag_recv = NRF_FRAG_WAIT, NRF_FRAG_DONE or NRF_FRAG_OVERFLOW
+**************************************************************************************************/
+unsigned char nrf_frag_recv(unsigned int *size);
+
+/*************************************************************************************************
+* Description : Puts a received frame in place and drops duplicates. Called by listening mode for
+*				payloads of data pipe of nrf_frag_listen()
+* Parameters  : const unsigned char *data = received frame
+*				unsigned char size = size of frame (payloads shorter than NRF_FRAG_SIZE are ignored)
+**************************************************************************************************/
+void nrf_frag_rx(const unsigned char *data, unsigned char size);
+
+/*************************************************************************************************
+* Description : Copies report of last message sent with nrf_frag_send() or received complete
+* Parameters  : struct nrf_frag_stats *report = receives frames, retransmits, time and goodput
+**************************************************************************************************/
+void nrf_frag_report(struct nrf_frag_stats *report);
+
+/*******************STAR NETWORK FUNCTIONS (NRF_HUB)*****************************/
+
+/*************************************************************************************************
+* Description : Starts hub on a listening PRX (after nrf_listen()) with no leaves. Time is cut in
+*				slots of NRF_HUB_SLOT_US, slot n belongs to leaf n % (leaves added) and puts its
+*				address on data pipe 1 + n % 5 a quarter slot ahead, so a leaf is heard for 5 slots
+*				and only in its own slot when in sync. Pipe 0 is left to application but its ACK
+*				Payloads are lost when hub flushes TX FIFO
+**************************************************************************************************/
+void nrf_hub_start(void);
+
+/*************************************************************************************************
+* Description : Gives a leaf the next slot of cycle. Cycle grows by one slot, leaves in sync follow
+*				new cycle within two cycles
+* Parameters  : unsigned char id = LSByte of address of leaf (MSBytes are those of Data_Pipe1)
+* Returns     : unsigned char nrf_hub_add = node number of leaf (0 to NRF_HUB_NODES-1) ; 0xFF if
+*				hub is full
+**************************************************************************************************/
+unsigned char nrf_hub_add(unsigned char id);
+
+/*************************************************************************************************
+* Description : Runs hub. Takes payloads of data pipes 1 to 5 (passed to function of
+*				nrf_hub_attach()) and measures when each leaf was heard against its slot, then opens
+*				next slot : writes RX_ADDR_Px of its pipe and loads a grant in ACK Payload of the
+*				pipe. Grant moves leaf to its slot by error seen at its last payload. Call it from
+*				main loop several times per slot (it drains RX FIFO itself if NRF_IRQ_MODE is 0)
+* Returns     : unsigned char nrf_hub_poll = payloads of leaves taken
+**************************************************************************************************/
+unsigned char nrf_hub_poll(void);
+
+/*************************************************************************************************
+* Description : Attaches function called by nrf_hub_poll() for every payload of a leaf
+* Parameters  : callback = function taking node number, payload and its size (0 = none)
+**************************************************************************************************/
+void nrf_hub_attach(void (*callback)(unsigned char node, const unsigned char *data, unsigned char size));
+
+/*************************************************************************************************
+* Description : Sets request byte sent to a leaf in its grants till one of them is taken
+* Parameters  : unsigned char node = node number of leaf (nrf_hub_add())
+*				unsigned char request = any value but 0 (0 = no request)
+**************************************************************************************************/
+void nrf_hub_request(unsigned char node, unsigned char request);
+
+/*************************************************************************************************
+* Description : Makes PTX a leaf of hub : sets TX_ADDR and RX_ADDR_P0 to Data_Pipe1 with LSByte
+*				id and turns off software retries of nrf_send() (a payload missing its slot waits
+*				for next cycle). Leaf starts out of sync
+* Parameters  : unsigned char id = LSByte of address of leaf, as given to nrf_hub_add()
+**************************************************************************************************/
+void nrf_leaf_start(unsigned char id);
+
+/*************************************************************************************************
+* Description : Tells if leaf may send : its slot has come (in sync) or its random retry time has
+*				passed (out of sync)
+* Returns     : unsigned char nrf_leaf_due = 1 if nrf_leaf_send() should be called now
+**************************************************************************************************/
+unsigned char nrf_leaf_due(void);
+
+/*************************************************************************************************
+* Description : Sends a payload with nrf_send() and takes grant of hub from ACK Payload : time of
+*				next payload is set from start of this one. A payload without grant keeps slot of
+*				last grant, NRF_HUB_LOST of them one after another put leaf out of sync
+* Parameters  : const unsigned char *data = array of data to be transmitted (max 32 bytes)
+*				unsigned char Byte_size = size of array of data
+*				unsigned char *request = receives request byte of hub (0 = none or no grant)
+* Returns     : unsigned char nrf_leaf_send = NRF_TX_FAILED, NRF_TX_SENT, NRF_TX_ACK_PAYLOAD,
+*				NRF_TIMEOUT or NRF_NO_CHIP
+**************************************************************************************************/
+unsigned char nrf_leaf_send(const unsigned char *data, unsigned char Byte_size, unsigned char *request);
+
+/*******************ROUTING FUNCTIONS (NRF_ROUTE)*********************************/
+
+/*************************************************************************************************
+* Description : Makes nrf a node of a multi-hop network : sets RX_ADDR_P1 to Data_Pipe1 with LSByte
+*				addr and takes payloads of data pipe 1 from listening mode. Routing table, list of
+*				payloads seen and forwarding queue are emptied. Call nrf_config(1,1) and nrf_listen()
+*				after it, node goes back to listening after every payload it sends. Data pipe 0 is
+*				only on while the node sends (ACK of next hop), so it does not take payloads meant
+*				for that node
+* Parameters  : unsigned char addr = address of node (1 to NRF_ROUTE_NODES-1)
+**************************************************************************************************/
+void nrf_route_start(unsigned char addr);
+
+/*************************************************************************************************
+* Description : Sets a static route. Routes are otherwise learned from payloads received : source
+*				and last hop of a payload are reached through its last hop. A learned route is
+*				replaced by one of as many hops or less and removed when its next hop does not ACK.
+*				A destination without route is sent to next hop of default route, or straight to
+*				it if there is none
+* Parameters  : unsigned char dst = destination (NRF_ROUTE_DEFAULT for default route)
+*				unsigned char next = address of next hop (NRF_ROUTE_NONE removes route)
+**************************************************************************************************/
+void nrf_route_set(unsigned char dst, unsigned char next);
+
+/*************************************************************************************************
+* Description : Sends a payload to a node through its next hop with nrf_send() (ACK of next hop
+*				only, not of destination)
+* Parameters  : unsigned char dst = address of destination
+*				const unsigned char *data = array of data to be transmitted
+*				unsigned char Byte_size = size of array of data (max 27 bytes, 32 less header)
+* Returns     : unsigned char nrf_route_send = NRF_TX_FAILED, NRF_TX_SENT, NRF_TX_ACK_PAYLOAD,
+*				NRF_TIMEOUT or NRF_NO_CHIP
+**************************************************************************************************/
+unsigned char nrf_route_send(unsigned char dst, const unsigned char *data, unsigned char Byte_size);
+
+/*************************************************************************************************
+* Description : Runs relay : sends payloads of forwarding queue on to their next hop. Call it from
+*				main loop (it drains RX FIFO itself if NRF_IRQ_MODE is 0)
+* Returns     : unsigned char nrf_route_poll = payloads taken from forwarding queue
+**************************************************************************************************/
+unsigned char nrf_route_poll(void);
+
+/*************************************************************************************************
+* Description : Attaches function called by listening mode for every payload for this node
+* Parameters  : callback = function taking source, payload, its size and hops it took (0 = none)
+**************************************************************************************************/
+void nrf_route_attach(void (*callback)(unsigned char src, const unsigned char *data, unsigned char size, unsigned char hops));
+
+/*************************************************************************************************
+* Description : Copies counters of routing layer
+* Parameters  : struct nrf_route_stats *report = receives counters (0 = only reset)
+*				unsigned char reset = 1 clears counters after copying
+**************************************************************************************************/
+void nrf_route_report(struct nrf_route_stats *report, unsigned char reset);
+
+/*******************STREAMING FUNCTIONS (NRF_STREAM)*******************************/
+
+/*************************************************************************************************
+* Description : Starts a stream on PTX (after nrf_config(1,0)) : empties TX FIFO and holds CE high,
+*				so nrf sends payloads back to back as they are written
+**************************************************************************************************/
+void nrf_stream_begin(void);
+
+/*************************************************************************************************
+* Description : Puts a payload in TX FIFO with W_TX_PAYLOAD_NOACK and its sequence number in front.
+*				Payload goes on air once, without ACK or retransmit. Call it as long as it returns 1
+*				to keep TX FIFO full
+* Parameters  : const unsigned char *data = array of data to be transmitted
+*				unsigned char Byte_size = size of array of data (max 30 bytes, 32 less sequence number)
+* Returns     : unsigned char nrf_stream_write = 1 if payload was queued ; 0 if TX FIFO is full
+**************************************************************************************************/
+unsigned char nrf_stream_write(const unsigned char *data, unsigned char Byte_size);
+
+/*************************************************************************************************
+* Description : Ends stream : waits till TX FIFO is empty (upto nrf_deadline_tx, nrf is then checked
+*				with nrf_recover() and result left in nrf_result), then CE goes low and TX_DS is cleared
+**************************************************************************************************/
+void nrf_stream_end(void);
+
+/*************************************************************************************************
+* Description : Receives a stream on a data pipe of listening mode, passing its payloads to
+*				nrf_stream_rx() (nrf_pipe_attach()). Report starts over
+* Parameters  : unsigned char pipe = data pipe stream comes in on (0 to 5)
+**************************************************************************************************/
+void nrf_stream_listen(unsigned char pipe);
+
+/*************************************************************************************************
+* Description : Takes a payload of stream : counts payloads missing before it and measures time
+*				since last one, then passes it to function of nrf_stream_attach(). Called by
+*				listening mode for payloads of data pipe of nrf_stream_listen()
+* Parameters  : const unsigned char *data = received payload
+*				unsigned char size = size of payload (sequence number included)
+**************************************************************************************************/
+void nrf_stream_rx(const unsigned char *data, unsigned char size);
+
+/*************************************************************************************************
+* Description : Attaches function called by nrf_stream_rx() for every payload in sequence
+* Parameters  : callback = function taking sequence number, payload and its size (0 = none)
+**************************************************************************************************/
+void nrf_stream_attach(void (*callback)(unsigned int seq, const unsigned char *data, unsigned char size));
+
+/*************************************************************************************************
+* Description : Copies report of stream received
+* Parameters  : struct nrf_stream_stats *report = receives counters, loss rate, interval and jitter
+*				(0 = only reset)
+*				unsigned char reset = 1 starts report over after copying
+**************************************************************************************************/
+void nrf_stream_report(struct nrf_stream_stats *report, unsigned char reset);
+
+
+/******************OTHER FUNCTIONS****************************/
+
+/*************************************************************************************************
+* Description : Writes CONFIG as nrf_config() but does not wait for Tpd2stby
+* Parameters  : PWR_UP = power up module (1 = ON) (0 = OFF)
+*				PRIM_RX = Primary RX or mode (1 = PRX) (0 = PTX)
+* Returns     : unsigned char nrf_config_write = 1 if module was powered up from power down
+**************************************************************************************************/
+unsigned char nrf_config_write(unsigned char PWR_UP, unsigned char PRIM_RX);
+
+/*************************************************************************************************
+* Description : Reads OBSERVE_TX after TX_DS or MAX_RT and passes ARC_CNT of the payload to
+*				statistics (NRF_STATS), retransmit tuning (NRF_RETR_ADAPT) and data rate control
+*				(NRF_RATE_ADAPT). Called by library
+* Parameters  : unsigned char status = STATUS flags of finished payload
+**************************************************************************************************/
+void nrf_tx_observe(unsigned char status);
+
+/*************************************************************************************************
+* Description : Returns minimum ARD for current data rate (RF_SETUP as set now) so that an ACK
+*				Payload of ack_size bytes is not missed
+* Parameters  : unsigned char ack_size = largest ACK Payload expected (ignored if EN_ACK_PAY is off)
+* Returns     : unsigned char nrf_ard_min = ARD (0 to 15, delay is (ARD+1)*250us)
+**************************************************************************************************/
+unsigned char nrf_ard_min(unsigned char ack_size);
+
+/*************************************************************************************************
+* Description : Retransmit tuning (NRF_RETR_ADAPT). Collects ARC_CNT of payloads and every
+*				NRF_RETR_WINDOW payloads sets ARD to nrf_ard_min() and : raises ARC if payloads were
+*				lost (ARD and ARC are never set below nrf_cur->nrf_retr_floor then), lowers ARC while
+*				ARC_CNT stays well below it, drops ARC and software retries of nrf_send() if nothing
+*				got through at full retries for NRF_RETR_ABSENT windows (peer absent) till a payload does
+* Parameters  : unsigned char status = STATUS flags of finished payload (TX_DS or MAX_RT)
+*				unsigned char arc_cnt = retransmits of the payload (ARC_CNT of OBSERVE_TX)
+**************************************************************************************************/
+void nrf_retr_adapt(unsigned char status, unsigned char arc_cnt);
+
+/*************************************************************************************************
+* Description : enables auto ack ON or OFF on all data pipes
+**************************************************************************************************/
+void autoack(void);
+
+/*************************************************************************************************
+* Description : enables or disables data pipe/s (from 0 to 5)
+**************************************************************************************************/
+void enable_pipe(void);
+
+/*************************************************************************************************
+* Description : Sets TX and RX address width of the module
+**************************************************************************************************/
+void address_width(void);
+
+/*************************************************************************************************
+* Description : Sets the Re-Transmission register of module
+**************************************************************************************************/
+void re_trans(void);
+
+/*************************************************************************************************
+* Description : Sets RF channel frequency (from 2.400 GHz to 2.525 GHz)
+**************************************************************************************************/
+void rf_ch(void);
+
+/*************************************************************************************************
+* Description : Sets RF speed (250kbps, 1Mbps or 2Mbps) and RF power
+**************************************************************************************************/
+void rf_setup(void);
+
+/*************************************************************************************************
+* Description : Sets RX address of all data pipes from 0 to 5
+**************************************************************************************************/
+void rx_add(void);
+
+/*************************************************************************************************
+* Description : Sets TX address of module
+**************************************************************************************************/
+void tx_add(void);
+
+/*************************************************************************************************
+* Description : Sets RX Payload size of all data pipes
+**************************************************************************************************/
+void rx_payload(void);
+
+/*************************************************************************************************
+* Description : Sets Dynamic Payload size in data pipes
+**************************************************************************************************/
+void dynamic_payload(void);
+
+/*************************************************************************************************
+* Description : Enables features like dynamic payload, auto ack with payload etc.
+**************************************************************************************************/
+void feature(void);
+
+/************************FUNCTION DEFINATIONS*********************************/
+
+/*SPI transactions of main program must not be split by nrf_irq_handler()*/
+#if NRF_IRQ_MODE == 1
+#define NRF_LOCK		unsigned char nrf_sreg = SREG; cli()
+#define NRF_UNLOCK		SREG = nrf_sreg
+#else
+#define NRF_LOCK
+#define NRF_UNLOCK
+#endif
+/*Forgets events collected by nrf_irq_handler() while listening or during an earlier operation*/
+#if NRF_IRQ_MODE == 1
+#define NRF_IRQ_FORGET()	do{ NRF_LOCK; nrf_cur->nrf_irq_events = 0; NRF_UNLOCK; }while(0)
+#else
+#define NRF_IRQ_FORGET()
+#endif
+/*Compiler barrier : a queue slot is written (read) before head (tail) hands it to the other side*/
+#define NRF_BARRIER()	__asm__ __volatile__("" ::: "memory")
+
+/*Shadow copy of single byte registers written or read (not STATUS, OBSERVE_TX, RPD, FIFO_STATUS or addresses)*/
+#define NRF_SHADOW_REGS		0x307EF07Ful		//bit n set = register n is cached
+#define NRF_SHADOWED(reg)	((reg) < 0x1E && (NRF_SHADOW_REGS & (1ul<<(reg))))
+//entry of nrf_addr of an address register (0xFF = not kept)
+#define NRF_ADDR_SLOT(reg)	((reg) == RX_ADDR_P0 ? 0 : (reg) == RX_ADDR_P1 ? 1 : (reg) == TX_ADDR ? 2 : 0xFF)
+
+/*Link statistics, NRF_STAT(x) compiles x only if NRF_STATS is 1*/
+#if NRF_STATS == 1
+#define NRF_STAT(x)		x
+#else
+#define NRF_STAT(x)
+#endif
+#if NRF_CTRL_FRAMES == 1
+#define NRF_CTRL_FRAME(data, size)	nrf_ctrl_handle(data,size)
+#else
+#define NRF_CTRL_FRAME(data, size)	0
+#endif
+#define NRF_HOP_HEAD		3									//bytes of hop header
+#define NRF_FRAG_HEAD		2									//bytes of fragment header
+#define NRF_FRAG_DATA		(NRF_FRAG_SIZE - NRF_FRAG_HEAD)		//bytes of message per frame
+#define NRF_FRAG_LAST		0x80								//message number bit marking last frame
+#define NRF_HUB_GRANT		5									//bytes of grant : delay, cycle (8us, LSByte first), request
+#define NRF_HUB_TICK_US		8									//unit of delay and cycle in grant
+#define NRF_HUB_AT			(3 * NRF_HUB_SLOT_US / 4)			//point of slot hub takes payload of its leaf at
+#define NRF_ROUTE_HEAD		5									//bytes of routing header : destination, source, last hop, sequence, hops
+#define NRF_ROUTE_DATA		(32 - NRF_ROUTE_HEAD)				//bytes of data per payload
+#define NRF_ROUTE_STATIC	0									//hops of route set with nrf_route_set()
+#define NRF_STREAM_HEAD		2									//bytes of stream header : sequence number (LSByte first)
+#define NRF_STREAM_DATA		(32 - NRF_STREAM_HEAD)				//bytes of data per payload
+#if NRF_HOP == 1
+#define NRF_HOP_RX(data, size)		nrf_hop_rx(data,size)
+#define NRF_HOP_PERIOD		(256ul * NRF_HOP_SLOT_US)		//slot counter wraps (header carries 8 bits of it)
+#else
+#define NRF_HOP_RX(data, size)		(size)
+#endif
+#if NRF_FRAG == 1
+/*Frames of pipe of nrf_frag_rx() stay in RX FIFO while no message is awaited : nrf ACKs no more once it is full*/
+#define NRF_FRAG_HELD(pipe)		(nrf_cur->nrf_pipe_callback[pipe] == nrf_frag_rx && nrf_cur->nrf_frag_state != NRF_FRAG_WAIT)
+#else
+#define NRF_FRAG_HELD(pipe)		0
+#endif
+#if NRF_STATS == 1 || NRF_RETR_ADAPT == 1 || NRF_RATE_ADAPT == 1
+#define NRF_OBSERVE(status)		nrf_tx_observe(status)
+#else
+#define NRF_OBSERVE(status)
+#endif
+#define NRF_RX_PIPES	(ERX_P5 ? 6 : ERX_P4 ? 5 : ERX_P3 ? 4 : ERX_P2 ? 3 : ERX_P1 ? 2 : 1)	//queues upto highest enabled pipe
+
+/*State of one radio (nrf_cur->nrf_status, nrf_cur->nrf_state, ...)*/
+struct nrf_radio {
+	unsigned char id;									//0 to NRF_RADIOS-1, picks CE, CSN and IRQ lines
+	unsigned char nrf_shadow[0x1E];
+	unsigned long nrf_shadow_valid;						//bit n set = nrf_shadow[n] holds value of register n
+	unsigned char nrf_addr[3][5];						//last RX_ADDR_P0, RX_ADDR_P1 and TX_ADDR written (restored by nrf_recover())
+	unsigned char nrf_addr_valid;						//bit n set = nrf_addr[n] was written
+	volatile unsigned char nrf_status;					//last STATUS clocked out of nrf (flags cleared by library removed)
+	unsigned long nrf_spi_count;						//SPI transactions done
+	unsigned long nrf_spi_saved;						//SPI transactions avoided by shadow copy and merged STATUS clears
+	unsigned char nrf_result;							//result of last blocking function (NRF_TX_SENT, NRF_RX_DONE, NRF_TIMEOUT, ...)
+	unsigned long nrf_deadline_tx, nrf_deadline_rx;		//deadlines of blocking functions in us (NRF_TX_DEADLINE_US, NRF_RX_DEADLINE_US)
+	unsigned char nrf_ack[32];							//ACK Payload returned by nrf_transmit()
+	unsigned char nrf_rec[32];							//payload returned by nrf_receive() and nrf_receive_ackpayload()
+	unsigned char nrf_ret[32];							//register returned by read_nrf()
+	unsigned char nrf_spi_buf[33];						//command and data of nrf_spi_async(), received in place
+	unsigned char *nrf_spi_rx;							//where nrf_spi_done() copies data received
+	unsigned char nrf_spi_size;
+	void (*nrf_spi_callback)(unsigned char status);
+#if NRF_STATS == 1
+	struct nrf_stats stats;								//link statistics (nrf_stats_snapshot())
+#endif
+
+	/*Retransmit tuning*/
+	unsigned char nrf_retr_soft;						//software retries of nrf_send() after MAX_RT
+#if NRF_RETR_ADAPT == 1
+	unsigned char nrf_retr_auto;						//0 pauses tuning (settings are kept)
+	unsigned char nrf_retr_n, nrf_retr_fail, nrf_retr_max;	//payloads, MAX_RT and highest ARC_CNT of ACKed payloads in window
+	unsigned char nrf_retr_down;						//windows with nothing through at full retries, NRF_RETR_ABSENT = peer taken as absent
+	unsigned char nrf_retr_floor;						//SETUP_RETR, ARD and ARC are not set below it while payloads are lost
+#endif
+#if NRF_RATE_ADAPT == 1
+	/*Data rate control*/
+	unsigned char nrf_rate_auto;						//0 pauses data rate control (rate is kept)
+	unsigned char nrf_rate_n, nrf_rate_fail;			//payloads and MAX_RT in window
+	unsigned int nrf_rate_arc;							//ARC_CNT summed over window
+	unsigned int nrf_rate_tries, nrf_rate_ok;			//packets put on air and payloads ACKed, 4 times their average over last windows (0 = new rate)
+	unsigned char nrf_rate_next;						//rate picked by nrf_rate_adapt() for nrf_rate_poll() (0xFF = none)
+	unsigned char nrf_rate_tried;						//windows a raised rate has to hold before backoff is reset (0 = not raised)
+	unsigned char nrf_rate_hold;						//clean windows left before a higher rate is tried
+	unsigned char nrf_rate_backoff;
+	volatile unsigned long nrf_rate_heard;				//NRF_CLOCK_US() at last ACK (PTX) or payload (PRX)
+#endif
+#if NRF_HOP == 1
+	/*Frequency hopping*/
+	unsigned char nrf_hop_on;
+	unsigned char nrf_hop_seq[NRF_HOP_LEN];
+	volatile unsigned long nrf_hop_epoch;				//NRF_CLOCK_US() at start of slot 0
+	volatile unsigned long nrf_hop_black;				//bit n set = channel n of sequence is blacklisted
+	unsigned char nrf_hop_fails[NRF_HOP_LEN];			//payloads failed one after another per channel (PTX)
+	unsigned char nrf_hop_tell;							//blacklist entry sent in next header (PTX)
+	volatile unsigned char nrf_hop_parked;				//1 = PRX waits on first channel of sequence for PTX
+	volatile unsigned long nrf_hop_heard;				//NRF_CLOCK_US() at last payload (PRX)
+#endif
+#if NRF_FRAG == 1
+	/*Fragmentation*/
+	unsigned char nrf_frag_tx_msg;						//number of last message sent (7 bits)
+	unsigned char *nrf_frag_buf;						//buffer of nrf_frag_listen()
+	unsigned int nrf_frag_max;
+	volatile unsigned char nrf_frag_state;				//NRF_FRAG_WAIT, NRF_FRAG_DONE or NRF_FRAG_OVERFLOW
+	unsigned char nrf_frag_rx_msg;						//number of message being received (0xFF = none yet)
+	unsigned char nrf_frag_started;						//1 = message nrf_frag_rx_msg was started after nrf_frag_listen()
+	unsigned int nrf_frag_base;							//oldest frame not received
+	unsigned long nrf_frag_got;							//bit n set = frame nrf_frag_base + n received
+	unsigned int nrf_frag_last;							//last frame of message (0xFFFF = not received yet)
+	unsigned int nrf_frag_size;							//size of message (known from its last frame)
+	unsigned long nrf_frag_start;						//NRF_CLOCK_US() at first frame
+	struct nrf_frag_stats frag;							//report (nrf_frag_report())
+#endif
+#if NRF_HUB & 1
+	/*Star network hub*/
+	unsigned char nrf_hub_count;						//leaves added
+	unsigned char nrf_hub_id[NRF_HUB_NODES];			//LSByte of address per node
+	int nrf_hub_pred[NRF_HUB_NODES];					//error expected at next payload of node (8us, + = late)
+	int nrf_hub_corr[NRF_HUB_NODES];					//correction in last grant loaded for node (8us)
+	unsigned char nrf_hub_late[NRF_HUB_NODES];			//1 = last payload of node came over a quarter slot later than expected
+	unsigned char nrf_hub_req[NRF_HUB_NODES];			//request byte per node (0 = none)
+	unsigned char nrf_hub_pipe[6];						//node on data pipes 1 to 5 (0xFF = none)
+	unsigned char nrf_hub_granted;						//bit n set = grant of pipe n is in TX FIFO
+	unsigned long nrf_hub_epoch;						//NRF_CLOCK_US() at start of slot 0
+	unsigned long nrf_hub_slot;							//last slot opened
+	void (*nrf_hub_callback)(unsigned char node, const unsigned char *data, unsigned char size);
+#endif
+#if NRF_HUB & 2
+	/*Star network leaf*/
+	unsigned char nrf_leaf_synced;						//1 = sending in slot of last grant
+	unsigned char nrf_leaf_misses;						//payloads without grant one after another
+	unsigned int nrf_leaf_seed;							//random retry time out of sync (xorshift16)
+	unsigned long nrf_leaf_next;						//NRF_CLOCK_US() at which next payload is due
+	unsigned long nrf_leaf_cycle;						//cycle of hub (us)
+#endif
+#if NRF_ROUTE == 1
+	/*Routing*/
+	unsigned char nrf_route_addr;						//address of this node
+	unsigned char nrf_route_seq;						//sequence number of last payload sent
+	unsigned char nrf_route_to;							//next hop TX_ADDR and RX_ADDR_P0 point at (0 = none yet)
+	unsigned char nrf_route_next[NRF_ROUTE_NODES];		//next hop per destination (entry 0 : default route)
+	unsigned char nrf_route_hops[NRF_ROUTE_NODES];		//hops to destination (NRF_ROUTE_STATIC, NRF_ROUTE_NONE = no route)
+	unsigned int nrf_route_seen[NRF_ROUTE_SEEN];		//source and sequence number of last payloads (0 = none)
+	unsigned char nrf_route_seen_at;					//entry replaced next
+	unsigned char nrf_route_queue[NRF_ROUTE_QUEUE][32];	//forwarding queue (written by listening mode, sent by nrf_route_poll())
+	unsigned char nrf_route_size[NRF_ROUTE_QUEUE];
+	volatile unsigned char nrf_route_head, nrf_route_tail;
+	void (*nrf_route_callback)(unsigned char src, const unsigned char *data, unsigned char size, unsigned char hops);
+	struct nrf_route_stats route;						//counters (nrf_route_report())
+#endif
+#if NRF_STREAM == 1
+	/*Unacknowledged streaming*/
+	unsigned int nrf_stream_tx_seq;						//sequence number of next payload sent
+	unsigned int nrf_stream_rx_seq;						//sequence number expected next
+	unsigned long nrf_stream_rx_time;					//NRF_CLOCK_US() at last payload received
+	unsigned long nrf_stream_avg;						//average time between payloads (1/16 us)
+	unsigned long nrf_stream_jit;						//average deviation from it (1/16 us)
+	void (*nrf_stream_callback)(unsigned int seq, const unsigned char *data, unsigned char size);
+	struct nrf_stream_stats stream;						//report (nrf_stream_report())
+#endif
+
+	/*Non blocking mode*/
+	unsigned char nrf_state;
+	unsigned char nrf_state_wait;						//1 = waiting for Tpd2stby before CE can go high
+	unsigned long nrf_state_since;						//NRF_CLOCK_US() at power up
+	volatile unsigned char nrf_tx_done;					//1 = payload of nrf_send_async() is done (cleared by caller or next nrf_send_async())
+	volatile unsigned char nrf_tx_result;				//result of last payload of nrf_send_async()
+	void (*nrf_tx_callback)(unsigned char result);
+
+	volatile unsigned char nrf_irq_events;				//TX_DS, MAX_RT and RX_DR flags collected by nrf_irq_handler()
+	void (*nrf_irq_callback)(unsigned char events);
+
+	/*Software RX queues of listening mode (written by nrf_listen_poll(), read by nrf_pipe_read())*/
+	struct nrf_rx_slot nrf_rx_queue[NRF_RX_PIPES][NRF_RX_QUEUE];
+	volatile unsigned char nrf_rx_head[NRF_RX_PIPES];
+	volatile unsigned char nrf_rx_tail[NRF_RX_PIPES];
+	unsigned char nrf_rx_temp[32];						//payloads for callbacks or finding their queue full
+	void (*nrf_pipe_callback[6])(const unsigned char *data, unsigned char size);
+	volatile unsigned char nrf_listening;				//1 = listening mode is on
+	unsigned long nrf_rx_count[6];						//payloads read from RX FIFO per data pipe in listening mode
+	unsigned long nrf_rx_dropped[6];					//payloads dropped per data pipe because its queue was full
+
+#if EN_ACK_PAY == 1
+	/*Software ACK Payload queues (written by nrf_ack_write(), moved to TX FIFO by nrf_ack_refill())*/
+	unsigned char nrf_ack_queue[NRF_RX_PIPES][NRF_ACK_QUEUE][32];
+	unsigned char nrf_ack_size[NRF_RX_PIPES][NRF_ACK_QUEUE];
+	volatile unsigned char nrf_ack_head[NRF_RX_PIPES];
+	volatile unsigned char nrf_ack_tail[NRF_RX_PIPES];
+	volatile unsigned char nrf_ack_loaded[NRF_RX_PIPES];	//ACK Payloads of each pipe believed to be in TX FIFO
+#endif
+};
+
+/*Power on values of fields*/
+#if NRF_RETR_ADAPT == 1
+#define NRF_RADIO_RETR		.nrf_retr_auto = 1, .nrf_retr_floor = NRF_SETUP_RETR,
+#else
+#define NRF_RADIO_RETR
+#endif
+#if NRF_RATE_ADAPT == 1
+#define NRF_RADIO_RATE		.nrf_rate_auto = 1, .nrf_rate_next = 0xFF, .nrf_rate_hold = NRF_RATE_HOLD, .nrf_rate_backoff = NRF_RATE_HOLD,
+#else
+#define NRF_RADIO_RATE
+#endif
+#if NRF_HOP == 1
+#define NRF_RADIO_HOP		.nrf_hop_parked = 1,
+#else
+#define NRF_RADIO_HOP
+#endif
+#if NRF_FRAG == 1
+#define NRF_RADIO_FRAG		.nrf_frag_rx_msg = 0xFF,
+#else
+#define NRF_RADIO_FRAG
+#endif
+#define NRF_RADIO(n)		{.id = n, .nrf_status = 0x0E, .nrf_deadline_tx = NRF_TX_DEADLINE_US, .nrf_deadline_rx = NRF_RX_DEADLINE_US, \
+							 .nrf_retr_soft = NRF_SOFT_RETRIES, NRF_RADIO_RETR NRF_RADIO_RATE NRF_RADIO_HOP NRF_RADIO_FRAG \
+							 .nrf_state = NRF_STATE_PD, .nrf_tx_result = NRF_TX_FAILED}
+
+struct nrf_radio nrf_radios[NRF_RADIOS] = {
+	NRF_RADIO(0),
+#if NRF_RADIOS > 1
+	NRF_RADIO(1),
+#endif
+#if NRF_RADIOS > 2
+	NRF_RADIO(2),
+#endif
+};
+
+/*Radio driven by library, its fields are reached as nrf_cur->field. With one radio nrf_cur is a constant and fields
+  compile to fixed addresses*/
+#if NRF_RADIOS == 1
+struct nrf_radio *const nrf_cur = &nrf_radios[0];
+#define NRF_ID			0
+#define NRF_ON(radio)
+#define NRF_OFF
+#else
+struct nrf_radio *nrf_cur = &nrf_radios[0];
+#define NRF_ID			(nrf_cur->id)
+//interrupt handlers act on their own radio and give the main program its radio back
+#define NRF_ON(radio)	struct nrf_radio *nrf_was = nrf_cur; nrf_cur = (radio)
+#define NRF_OFF			nrf_cur = nrf_was
+#endif
+
+/*Non blocking mode*/
+volatile unsigned long nrf_clock_us = 0;				//default clock of NRF_CLOCK_US()
+/*Reads nrf_clock_us with interrupts off, its 4 bytes are read one at a time and the timer interrupt may change it in between*/
+static inline unsigned long nrf_clock_get(void){
+	unsigned long now;
+	unsigned char sreg = SREG;
+	cli();
+	now = nrf_clock_us;
+	SREG = sreg;
+	return now;
+}
+
+/*Register image of each radio written by nrf24l01_init() : register, size, reset value (every byte), value*/
+#define NRF_ADDR(a)		(unsigned char)(a), (unsigned char)((a)>>8), (unsigned char)((a)>>16), (unsigned char)((a)>>24), (unsigned char)((a)>>32)
+#define NRF_REG_IMAGE_SIZE	(21 * 8)		//21 registers below
+#define NRF_REG_IMAGE(n)	{ \
+	EN_AA,		1,				0x3F,	NRF_EN_AA, 0, 0, 0, 0, \
+	EN_RXADDR,	1,				0x03,	NRF_EN_RXADDR, 0, 0, 0, 0, \
+	SETUP_AW,	1,				0x03,	AW, 0, 0, 0, 0, \
+	SETUP_RETR,	1,				0x03,	NRF_SETUP_RETR, 0, 0, 0, 0, \
+	RF_CH,		1,				0x02,	NRF_RF_CH_OF(n), 0, 0, 0, 0, \
+	RF_SETUP,	1,				0x0E,	NRF_RF_SETUP_OF(n), 0, 0, 0, 0, \
+	RX_ADDR_P0,	NRF_AW_BYTES,	0xE7,	NRF_ADDR(NRF_PIPE0_OF(n)), \
+	RX_ADDR_P1,	NRF_AW_BYTES,	0xC2,	NRF_ADDR(NRF_PIPE1_OF(n)), \
+	RX_ADDR_P2,	1,				0xC3,	Data_Pipe2, 0, 0, 0, 0, \
+	RX_ADDR_P3,	1,				0xC4,	Data_Pipe3, 0, 0, 0, 0, \
+	RX_ADDR_P4,	1,				0xC5,	Data_Pipe4, 0, 0, 0, 0, \
+	RX_ADDR_P5,	1,				0xC6,	Data_Pipe5, 0, 0, 0, 0, \
+	TX_ADDR,	NRF_AW_BYTES,	0xE7,	NRF_ADDR(NRF_TX_ADDR_OF(n)), \
+	RX_PW_P0,	1,				0x00,	RX_Payload_P0, 0, 0, 0, 0, \
+	RX_PW_P1,	1,				0x00,	RX_Payload_P1, 0, 0, 0, 0, \
+	RX_PW_P2,	1,				0x00,	RX_Payload_P2, 0, 0, 0, 0, \
+	RX_PW_P3,	1,				0x00,	RX_Payload_P3, 0, 0, 0, 0, \
+	RX_PW_P4,	1,				0x00,	RX_Payload_P4, 0, 0, 0, 0, \
+	RX_PW_P5,	1,				0x00,	RX_Payload_P5, 0, 0, 0, 0, \
+	FEATURE,	1,				0x00,	NRF_FEATURE, 0, 0, 0, 0,		/*before DYNPD*/ \
+	DYNPD,		1,				0x00,	NRF_DYNPD, 0, 0, 0, 0}
+const unsigned char nrf_reg_image[NRF_RADIOS][NRF_REG_IMAGE_SIZE] PROGMEM = {
+	NRF_REG_IMAGE(0),
+#if NRF_RADIOS > 1
+	NRF_REG_IMAGE(1),
+#endif
+#if NRF_RADIOS > 2
+	NRF_REG_IMAGE(2),
+#endif
+};
+
+#if NRF_IRQ_MODE == 1
+ISR(Irq_vect){
+	NRF_ON(&nrf_radios[0]);
+	nrf_irq_handler();
+	NRF_OFF;
+}
+#if NRF_RADIOS > 1
+ISR(Irq_vect_1){
+	NRF_ON(&nrf_radios[1]);
+	nrf_irq_handler();
+	NRF_OFF;
+}
+#endif
+#endif
+
+unsigned char nrf24l01_init(){
+	unsigned char i, j, reg, size, pass, write, value[5], read[5];
+	SPI_init();				//initialize SPI
+	DDR_high;				//CE and CSN as output
+#if NRF_IRQ_MODE == 1
+	DDR_low;				//IRQ as input
+	IRQ_low;				//no pull up (IRQ is driven by nrf)
+	if(NRF_ID == 0){
+		Irq_sense;
+		Irq_enable;
+	}
+	else{
+		Irq_sense_1;
+		Irq_enable_1;
+	}
+#endif
+	CE_low;
+	CSN_high;
+	nrf_shadow_reset();
+	nrf_cur->nrf_addr_valid = 0;					//addresses of image till written again
+	//power on reset : nrf ignores SPI till it is over, so probe it instead of waiting for worst case
+	for(i = 0; ; i++){
+		value[0] = 0x5A;
+		write_nrf(RX_ADDR_P5,value,1);
+		nrf_shadow_reset();							//read nrf, not shadow copy
+		read_nrf_buf(RX_ADDR_P5,read,1);
+		if(read[0] == 0x5A) break;
+		if(i >= NRF_POR_TIMEOUT_MS) return 0;		//no nrf on SPI
+		_delay_ms(1);
+	}
+	value[0] = 0xC6;
+	write_nrf(RX_ADDR_P5,value,1);					//back to reset value
+	//pass 0 writes registers differing from reset value, pass 1 reads all of them back (and rewrites
+	//registers left over from before a MCU reset that did not reset nrf)
+	for(pass = 0; pass < 2; pass++){
+		nrf_shadow_reset();								//pass 1 reads nrf, not shadow copy
+		for(i = 0; i < sizeof(nrf_reg_image[0]); i += 8){
+			reg = pgm_read_byte(&nrf_reg_image[NRF_ID][i]);
+			size = pgm_read_byte(&nrf_reg_image[NRF_ID][i + 1]);
+			write = 0;
+			if(pass == 1){
+				read_nrf_buf(reg,read,size);
+			}
+			for(j = 0; j < size; j++){
+				value[j] = pgm_read_byte(&nrf_reg_image[NRF_ID][i + 3 + j]);
+				if(pass == 0 && value[j] != pgm_read_byte(&nrf_reg_image[NRF_ID][i + 2])) write = 1;
+				if(pass == 1 && value[j] != read[j]) write = 1;
+			}
+			if(write){
+				write_nrf(reg,value,size);
+				if(pass == 1){
+					read_nrf_buf(reg,read,size);
+					for(j = 0; j < size; j++){
+						if(value[j] != read[j]) return 0;
+					}
+				}
+			}
+		}
+	}
+#if NRF_RATE_ADAPT == 1
+	nrf_cur->nrf_rate_heard = NRF_CLOCK_US();				//rate set by rf_setup() holds till link is lost
+#endif
+	return 1;
+}
+/*A wait ended without event of nrf : checks nrf, returns NRF_TIMEOUT or NRF_NO_CHIP*/
+static unsigned char nrf_lost(void){
+	unsigned char data1[1] = {NOP};
+	CE_low;
+	if(!nrf_recover()) return NRF_NO_CHIP;
+	write_nrf(FLUSH_TX,data1,0);					//payload (or ACK Payload) that did not go
+	return NRF_TIMEOUT;
+}
+unsigned char *nrf_transmit(unsigned char *data, unsigned char Byte_size){
+	unsigned char ack_size;
+	nrf_cur->nrf_result = nrf_send(data,Byte_size,nrf_cur->nrf_ack,&ack_size);
+	if(nrf_cur->nrf_result == NRF_TX_ACK_PAYLOAD){
+		return nrf_cur->nrf_ack;
+	}
+	return 0;
+}
+
+unsigned char nrf_send(const unsigned char *data, unsigned char Byte_size, unsigned char *ack, unsigned char *ack_size){
+	unsigned char tries = 0;
+	*ack_size = 0;
+	NRF_IRQ_FORGET();
+	write_nrf(FLUSH_TX,data,0);
+	write_nrf(FLUSH_RX,data,0);
+	write_nrf(W_TX_PAYLOAD,data,Byte_size);
+	unsigned char temp1[1];
+	
+	if(ENAA_Px == 0){
+		CE_high;
+		_delay_us(20);								//minimum 10us pulse
+		temp1[0] = nrf_wait_status(1<<TX_DS,nrf_cur->nrf_deadline_tx);	//checking status register for change in nrf
+		CE_low;
+		if(!temp1[0]){
+			return nrf_lost();
+		}
+		nrf_clear_status(temp1[0]);
+		NRF_STAT(nrf_cur->stats.tx_sent++);
+		return NRF_TX_SENT;
+	}
+	if(ENAA_Px == 1){
+		jump: CE_high;
+		_delay_us(20);								//minimum 10us pulse
+		temp1[0] = nrf_wait_status((1<<TX_DS)|(1<<MAX_RT),nrf_cur->nrf_deadline_tx);	//checking status register for change in nrf
+		CE_low;
+		if(!temp1[0]){
+			return nrf_lost();
+		}
+		unsigned char data1[1];
+		NRF_OBSERVE(temp1[0]);
+		if(temp1[0] & (1<<4)){
+			nrf_clear_status(1<<MAX_RT);
+			if(tries >= nrf_cur->nrf_retr_soft){
+				write_nrf(FLUSH_TX,data,0);
+				NRF_STAT(nrf_cur->stats.tx_sent++);
+				return NRF_TX_FAILED;
+			}
+			else{
+				tries++;
+				NRF_STAT(nrf_cur->stats.tx_retries++);
+				goto jump;								//failed payload stays at head of TX FIFO and is sent again
+			}
+		}
+		NRF_STAT(nrf_cur->stats.tx_sent++);
+		//ACK with payload
+		if(temp1[0] & (1<<6)){
+			nrf_clear_status(temp1[0]);
+			if(ack){
+				*ack_size = nrf_rx_width(data1);
+				if(*ack_size){
+					read_nrf_buf(R_RX_PAYLOAD,ack,*ack_size);
+				}
+			}
+			return NRF_TX_ACK_PAYLOAD;
+		}
+		//ACK without payload
+		else{
+			nrf_clear_status(temp1[0]);
+			return NRF_TX_SENT;
+		}
+	}
+	return NRF_TX_FAILED;
+}
+
+/*Drops TX_DS raised before TX FIFO was seen full or empty, payload that raised it is already out of count of TX FIFO*/
+static void nrf_tx_ds_forget(void){
+	NRF_LOCK;
+	if(nrf_cur->nrf_status & (1<<TX_DS)) nrf_clear_status(1<<TX_DS);		//still in STATUS read last
+#if NRF_IRQ_MODE == 1
+	nrf_cur->nrf_irq_events &= ~(1<<TX_DS);						//taken by nrf_irq_handler() already
+#endif
+	NRF_UNLOCK;
+}
+unsigned char nrf_transmit_stream(const unsigned char *data, unsigned char Byte_size, unsigned char count, unsigned char *result){
+	unsigned char next = 0;							//next payload to be written in TX FIFO
+	unsigned char done = 0;							//payloads whose result is known
+	unsigned char queued = 0;						//payloads in TX FIFO (exact when it is seen full or empty)
+	unsigned char sent = 0;
+	unsigned char tries = 0;
+	unsigned char status, fifo[1];
+	NRF_IRQ_FORGET();
+	write_nrf(FLUSH_TX,data,0);
+	nrf_clear_status((1<<TX_DS)|(1<<MAX_RT));
+	while(done < count){
+		//refill TX FIFO
+		while(next < count){
+			if(write_nrf(NOP,data,0) & (1<<TX_FULL)){
+				queued = 3;
+				nrf_tx_ds_forget();
+				break;
+			}
+			write_nrf(W_TX_PAYLOAD,data + next * Byte_size,Byte_size);
+			next++;
+			queued++;									//above 3 till TX_DS of payloads sent meanwhile is seen
+		}
+		CE_high;
+		status = nrf_wait_status((1<<TX_DS)|(1<<MAX_RT),nrf_cur->nrf_deadline_tx);
+		if(!status){
+			nrf_cur->nrf_result = nrf_lost();
+			for(; done < count; done++){
+				if(result) result[done] = 0;
+			}
+			return sent;
+		}
+		NRF_OBSERVE(status);					//ARC_CNT of payload raising this event
+		if(status & (1<<RX_DR)){
+			nrf_rx_drain();								//ACK Payloads go to queue of data pipe 0
+		}
+		if(status & (1<<TX_DS)){
+			//TX_DS of payloads sent back to back may merge, TX_EMPTY sets count right
+			nrf_clear_status(1<<TX_DS);
+			if(queued) queued--;
+			read_nrf_buf(FIFO_STATUS,fifo,1);
+			if(fifo[0] & (1<<TX_EMPTY)){
+				queued = 0;
+				nrf_tx_ds_forget();
+			}
+			tries = 0;
+		}
+		if(queued > 3) queued = 3;
+		for(; done < next - queued; done++){
+			if(result) result[done] = 1;
+			sent++;
+			NRF_STAT(nrf_cur->stats.tx_sent++);
+		}
+		if(status & (1<<MAX_RT)){
+			//TX FIFO is halted with failed payload (done) at its head, it is sent again in place as by nrf_send()
+			CE_low;
+			nrf_clear_status(1<<MAX_RT);
+			if(tries < nrf_cur->nrf_retr_soft){
+				tries++;
+				NRF_STAT(nrf_cur->stats.tx_retries++);
+				continue;
+			}
+			NRF_STAT(nrf_cur->stats.tx_sent++);
+			//payloads behind failed one are written again
+			if(result) result[done] = 0;
+			done++;
+			next = done;
+			queued = 0;
+			tries = 0;
+			write_nrf(FLUSH_TX,data,0);
+		}
+	}
+	CE_low;
+	return sent;
+}
+
+unsigned char *nrf_receive(unsigned char Rec_Byte_size){
+	nrf_recv(nrf_cur->nrf_rec,Rec_Byte_size);
+	if(nrf_cur->nrf_result != NRF_RX_DONE){
+		return 0;
+	}
+	return nrf_cur->nrf_rec;
+}
+
+unsigned char nrf_recv(unsigned char *data, unsigned char Rec_Byte_size){
+	NRF_IRQ_FORGET();
+	write_nrf(FLUSH_RX,data,0);
+	write_nrf(FLUSH_TX,data,0);
+	
+	unsigned char temp1[1];
+	CE_high;
+	_delay_us(140);									//minimum 130us delay
+	temp1[0] = nrf_wait_status(1<<RX_DR,nrf_cur->nrf_deadline_rx);	//checking status register for change in nrf
+	CE_low;
+	if(!temp1[0]){
+		nrf_cur->nrf_result = nrf_lost();
+		return 0;
+	}
+	nrf_cur->nrf_result = NRF_RX_DONE;
+	nrf_clear_status(temp1[0]);
+	unsigned char data1[1];
+	unsigned char width = nrf_rx_width(data1);
+	if(width > Rec_Byte_size){
+		width = Rec_Byte_size;
+	}
+	if(width){
+		read_nrf_buf(R_RX_PAYLOAD,data,width);
+	}
+	return width;
+}
+
+unsigned char *nrf_receive_ackpayload(unsigned char *data, unsigned char Ack_Byte_size, unsigned char Rec_Byte_size){
+	nrf_recv_ackpayload(data,Ack_Byte_size,nrf_cur->nrf_rec,Rec_Byte_size);
+	if(nrf_cur->nrf_result != NRF_RX_DONE){
+		return 0;
+	}
+	return nrf_cur->nrf_rec;
+}
+
+unsigned char nrf_recv_ackpayload(const unsigned char *ack, unsigned char Ack_Byte_size, unsigned char *data, unsigned char Rec_Byte_size){
+	NRF_IRQ_FORGET();
+	write_nrf(FLUSH_RX,ack,0);
+	write_nrf(FLUSH_TX,ack,0);
+	write_nrf(W_ACK_PAYLOAD,ack,Ack_Byte_size);
+	unsigned char temp1[1];
+	CE_high;
+	_delay_us(140);									//minimum 130us delay
+	temp1[0] = nrf_wait_status(1<<RX_DR,nrf_cur->nrf_deadline_rx);	//checking status register for change in nrf
+	CE_low;
+	if(!temp1[0]){
+		nrf_cur->nrf_result = nrf_lost();
+		return 0;
+	}
+	nrf_cur->nrf_result = NRF_RX_DONE;
+	nrf_clear_status(temp1[0]);
+	unsigned char data1[1];
+	unsigned char width = nrf_rx_width(data1);
+	if(width > Rec_Byte_size){
+		width = Rec_Byte_size;
+	}
+	if(width){
+		read_nrf_buf(R_RX_PAYLOAD,data,width);
+	}
+	return width;
+}
+void nrf_listen(){
+	unsigned char data1[1];
+	data1[0] = (1<<RX_DR);
+	write_nrf(FLUSH_RX,data1,0);
+	nrf_clear_status(data1[0]);
+	nrf_cur->nrf_listening = 1;
+	CE_high;
+	_delay_us(140);									//minimum 130us delay
+}
+void nrf_listen_stop(){
+	CE_low;
+	nrf_cur->nrf_listening = 0;
+	NRF_IRQ_FORGET();
+}
+unsigned char nrf_listen_poll(){
+	unsigned char count;
+	if(!nrf_cur->nrf_listening) return 0;
+	count = nrf_rx_drain();
+#if EN_ACK_PAY == 1
+	nrf_ack_refill();
+#endif
+	return count;
+}
+unsigned char nrf_rx_drain(){
+	unsigned char width, pipe, queued, count = 0;
+	unsigned char *buf;
+	struct nrf_rx_slot *slot = 0;
+#if NRF_STATS == 1
+	unsigned char fifo[1];
+	read_nrf_buf(FIFO_STATUS,fifo,1);
+	nrf_cur->stats.rx_fifo_full += (fifo[0] >> RX_FULL) & 1;
+#endif
+	while((width = nrf_rx_width(&pipe)) != 0){			//0 when RX FIFO is empty
+		if(NRF_FRAG_HELD(pipe)){
+			nrf_clear_status(1<<RX_DR);					//taken after nrf_frag_listen()
+			break;
+		}
+		queued = !nrf_cur->nrf_pipe_callback[pipe] && pipe < NRF_RX_PIPES && (unsigned char)(nrf_cur->nrf_rx_head[pipe] - nrf_cur->nrf_rx_tail[pipe]) < NRF_RX_QUEUE;
+		buf = nrf_cur->nrf_rx_temp;
+		if(queued){
+			slot = &nrf_cur->nrf_rx_queue[pipe][nrf_cur->nrf_rx_head[pipe] & (NRF_RX_QUEUE - 1)];
+			buf = slot->data;							//read straight into queue
+		}
+		read_nrf_buf(R_RX_PAYLOAD,buf,width);
+		if(NRF_CTRL_FRAME(buf,width)){
+			//control frame of peer is acted on and not passed on
+		}
+		else if((width = NRF_HOP_RX(buf,width)) == 0){
+			//hop header alone, only keeps PRX on slot clock
+		}
+		else if(nrf_cur->nrf_pipe_callback[pipe]){
+			nrf_cur->nrf_pipe_callback[pipe](nrf_cur->nrf_rx_temp,width);
+		}
+		else if(queued){
+			slot->size = width;
+			slot->pipe = pipe;
+			slot->time = NRF_CLOCK_US();
+			NRF_BARRIER();
+			nrf_cur->nrf_rx_head[pipe]++;						//publish slot to reader
+		}
+		else{
+			nrf_cur->nrf_rx_dropped[pipe]++;
+		}
+		nrf_cur->nrf_rx_count[pipe]++;
+#if NRF_RATE_ADAPT == 1
+		nrf_cur->nrf_rate_heard = NRF_CLOCK_US();
+#endif
+#if EN_ACK_PAY == 1
+		if(pipe < NRF_RX_PIPES && nrf_cur->nrf_ack_loaded[pipe]){
+			nrf_cur->nrf_ack_loaded[pipe]--;						//payload was answered with ACK Payload of its pipe
+		}
+#endif
+		count++;
+		nrf_clear_status(1<<RX_DR);						//clear RX_DR and check RX FIFO again
+	}
+	return count;
+}
+unsigned char nrf_rx_available(){
+	unsigned char count = 0;
+	for(unsigned char pipe = 0; pipe < NRF_RX_PIPES; pipe++){
+		count += nrf_pipe_available(pipe);
+	}
+	return count;
+}
+unsigned char nrf_rx_read(unsigned char *data){
+	for(unsigned char pipe = 0; pipe < NRF_RX_PIPES; pipe++){
+		if(nrf_cur->nrf_rx_head[pipe] != nrf_cur->nrf_rx_tail[pipe]){
+			return nrf_pipe_read(pipe,data);
+		}
+	}
+	return 0;
+}
+unsigned char nrf_pipe_available(unsigned char pipe){
+	if(pipe >= NRF_RX_PIPES) return 0;
+	return nrf_cur->nrf_rx_head[pipe] - nrf_cur->nrf_rx_tail[pipe];
+}
+unsigned char nrf_pipe_read(unsigned char pipe, unsigned char *data){
+	const struct nrf_rx_slot *slot = nrf_pipe_peek(pipe);
+	unsigned char size;
+	if(!slot) return 0;
+	size = slot->size;
+	for(unsigned char i = 0; i < size; i++){
+		data[i] = slot->data[i];
+	}
+	nrf_rx_release(slot);
+	return size;
+}
+const struct nrf_rx_slot *nrf_rx_peek(){
+	for(unsigned char pipe = 0; pipe < NRF_RX_PIPES; pipe++){
+		if(nrf_cur->nrf_rx_head[pipe] != nrf_cur->nrf_rx_tail[pipe]){
+			return nrf_pipe_peek(pipe);
+		}
+	}
+	return 0;
+}
+const struct nrf_rx_slot *nrf_pipe_peek(unsigned char pipe){
+	if(pipe >= NRF_RX_PIPES || nrf_cur->nrf_rx_head[pipe] == nrf_cur->nrf_rx_tail[pipe]) return 0;
+	NRF_BARRIER();										//slot is read after head showed it filled
+	return &nrf_cur->nrf_rx_queue[pipe][nrf_cur->nrf_rx_tail[pipe] & (NRF_RX_QUEUE - 1)];
+}
+void nrf_rx_release(const struct nrf_rx_slot *slot){
+	NRF_BARRIER();										//slot is read before writer may fill it again
+	nrf_cur->nrf_rx_tail[slot->pipe]++;
+}
+void nrf_pipe_attach(unsigned char pipe, void (*callback)(const unsigned char *data, unsigned char size)){
+	nrf_cur->nrf_pipe_callback[pipe] = callback;
+}
+#if EN_ACK_PAY == 1
+unsigned char nrf_ack_write(unsigned char pipe, const unsigned char *data, unsigned char Byte_size){
+	unsigned char slot;
+	if(pipe >= NRF_RX_PIPES || (unsigned char)(nrf_cur->nrf_ack_head[pipe] - nrf_cur->nrf_ack_tail[pipe]) >= NRF_ACK_QUEUE) return 0;
+	slot = nrf_cur->nrf_ack_head[pipe] & (NRF_ACK_QUEUE - 1);
+	for(unsigned char i = 0; i < Byte_size; i++){
+		nrf_cur->nrf_ack_queue[pipe][slot][i] = data[i];
+	}
+	nrf_cur->nrf_ack_size[pipe][slot] = Byte_size;
+	nrf_cur->nrf_ack_head[pipe]++;
+	nrf_ack_refill();
+	return 1;
+}
+unsigned char nrf_ack_pending(unsigned char pipe){
+	if(pipe >= NRF_RX_PIPES) return 0;
+	return nrf_cur->nrf_ack_head[pipe] - nrf_cur->nrf_ack_tail[pipe];
+}
+void nrf_ack_refill(){
+	unsigned char status, fifo, slot, pipe, loaded;
+	NRF_LOCK;												//called from main program and nrf_irq_handler()
+	status = read_nrf_buf(FIFO_STATUS,&fifo,1);
+	if((fifo & (1<<TX_EMPTY)) && (fifo & (1<<RX_EMPTY))){
+		for(pipe = 0; pipe < NRF_RX_PIPES; pipe++){
+			nrf_cur->nrf_ack_loaded[pipe] = 0;						//resync after FLUSH_TX (no received payload left to account for)
+		}
+	}
+	do{
+		loaded = 0;
+		for(pipe = 0; pipe < NRF_RX_PIPES; pipe++){
+			if(nrf_cur->nrf_ack_head[pipe] == nrf_cur->nrf_ack_tail[pipe] || nrf_cur->nrf_ack_loaded[pipe] >= NRF_ACK_DEPTH) continue;
+			if(status & (1<<TX_FULL)) break;
+			slot = nrf_cur->nrf_ack_tail[pipe] & (NRF_ACK_QUEUE - 1);
+			write_nrf(W_ACK_PAYLOAD | pipe,nrf_cur->nrf_ack_queue[pipe][slot],nrf_cur->nrf_ack_size[pipe][slot]);
+			nrf_cur->nrf_ack_tail[pipe]++;
+			nrf_cur->nrf_ack_loaded[pipe]++;
+			loaded++;
+			status = write_nrf(NOP,&fifo,0);
+		}
+	}while(loaded && !(status & (1<<TX_FULL)));
+	NRF_UNLOCK;
+}
+#endif
+void nrf_config(unsigned char PWR_UP, unsigned char PRIM_RX){
+	if(nrf_config_write(PWR_UP,PRIM_RX)){
+		_delay_us(NRF_TPD2STBY_US);								//power down to standby (crystal start up)
+	}
+}
+unsigned char nrf_config_write(unsigned char PWR_UP, unsigned char PRIM_RX){
+	unsigned char config_reg[1], old[1];
+	read_nrf_buf(CONFIG,old,1);
+	config_reg[0] = ((MASK_RX_DR<<6)|(MASK_TX_DS<<5)|(MASK_MAX_RT<<4)|(EN_CRC<<3)|(CRCO<<2)|(PWR_UP<<1)|(PRIM_RX));
+	write_nrf(CONFIG,config_reg,1);
+	nrf_cur->nrf_state = PWR_UP ? NRF_STATE_STBY : NRF_STATE_PD;
+	return (PWR_UP && !(old[0] & (1<<1)));
+}
+void autoack(){
+	unsigned char ENAA_P[1];
+	ENAA_P[0] = NRF_EN_AA;
+	write_nrf(EN_AA,ENAA_P,1);
+}
+void enable_pipe(){
+	unsigned char ERX_Px[1];
+	ERX_Px[0] = NRF_EN_RXADDR;
+	write_nrf(EN_RXADDR,ERX_Px,1);
+}
+void address_width(){
+	unsigned char aw[1];
+	aw[0] = AW;
+	write_nrf(SETUP_AW,aw,1);
+}
+void re_trans(){
+	unsigned char RETR_reg[1];
+	RETR_reg[0] = NRF_SETUP_RETR;
+	write_nrf(SETUP_RETR,RETR_reg,1);
+}
+void rf_ch(){
+	unsigned char RFCH[1];
+	RFCH[0] = NRF_RF_CH_OF(NRF_ID);
+	write_nrf(RF_CH,RFCH,1);
+}
+void rf_setup(){
+	unsigned char RF_reg[1];
+	RF_reg[0] = NRF_RF_SETUP_OF(NRF_ID);
+	write_nrf(RF_SETUP,RF_reg,1);
+}
+void rx_add(){
+	unsigned char Address[5] = {NRF_ADDR(NRF_PIPE0_OF(NRF_ID))};
+	write_nrf(RX_ADDR_P0,Address,NRF_AW_BYTES);
+	
+	unsigned char Address1[5] = {NRF_ADDR(NRF_PIPE1_OF(NRF_ID))};
+	write_nrf(RX_ADDR_P1,Address1,NRF_AW_BYTES);
+	
+	Address[0] = Data_Pipe2;
+	write_nrf(RX_ADDR_P2,Address,1);
+	
+	Address[0] = Data_Pipe3;
+	write_nrf(RX_ADDR_P3,Address,1);
+	
+	Address[0] = Data_Pipe4;
+	write_nrf(RX_ADDR_P4,Address,1);
 	
 	Address[0] = Data_Pipe5;
 	write_nrf(RX_ADDR_P5,Address,1);
 }
-void tx_add(){
-	unsigned char Byte_size;
-	if (AW == 1) Byte_size = 3;
-	if (AW == 2) Byte_size = 4;
-	if (AW == 3) Byte_size = 5;
-	unsigned char Address[5];
-	Address[0] = (unsigned char) (0x00000000FF & tx_address);
-	Address[1] = (unsigned char) ((0x000000FF00 & tx_address)>>8);
-	Address[2] = (unsigned char) ((0x0000FF0000 & tx_address)>>16);
-	Address[3] = (unsigned char) ((0x00FF000000 & tx_address)>>24);
-	Address[4] = (unsigned char) ((0xFF00000000 & tx_address)>>32);
-	write_nrf(TX_ADDR,Address,Byte_size);
+void tx_add(){
+	unsigned char Address[5] = {NRF_ADDR(NRF_TX_ADDR_OF(NRF_ID))};
+	write_nrf(TX_ADDR,Address,NRF_AW_BYTES);
+}
+void rx_payload(){
+	unsigned char rx_payload_p[1];
+	rx_payload_p[0] = RX_Payload_P0;
+	write_nrf(RX_PW_P0,rx_payload_p,1);
+	
+	rx_payload_p[0] = RX_Payload_P1;
+	write_nrf(RX_PW_P1,rx_payload_p,1);
+	
+	rx_payload_p[0] = RX_Payload_P2;
+	write_nrf(RX_PW_P2,rx_payload_p,1);
+	
+	rx_payload_p[0] = RX_Payload_P3;
+	write_nrf(RX_PW_P3,rx_payload_p,1);
+	
+	rx_payload_p[0] = RX_Payload_P4;
+	write_nrf(RX_PW_P4,rx_payload_p,1);
+	
+	rx_payload_p[0] = RX_Payload_P5;
+	write_nrf(RX_PW_P5,rx_payload_p,1);
+}
+void dynamic_payload(){
+	unsigned char dpl_px[1];
+	dpl_px[0] = NRF_DYNPD;
+	write_nrf(DYNPD,dpl_px,1);
+}
+void feature(){
+	unsigned char feat[1];
+	feat[0] = NRF_FEATURE;
+	write_nrf(FEATURE,feat,1);
+}
+unsigned char nrf_rx_width(unsigned char *pipe){
+	unsigned char dpl = 0;
+	unsigned char status, width = 0;
+	if(nrf_shadow_get(FEATURE) & (1<<2)){				//registers as set now (settings may be changed at run time)
+		dpl = nrf_shadow_get(DYNPD);
+		status = read_nrf_buf(R_RX_PL_WID,&width,1);
+	}
+	else{
+		status = write_nrf(NOP,&width,0);
+	}
+	*pipe = (status >> RX_P_NO) & 7;
+	if(*pipe > 5){
+		return 0;
+	}
+	if(!(dpl & (1<<*pipe))){
+		return nrf_shadow_get(RX_PW_P0 + *pipe) & 0x3F;
+	}
+	if(width > 32){
+		write_nrf(FLUSH_RX,&width,0);					//corrupt payload width, datasheet asks to flush RX FIFO
+		*pipe = 7;
+		return 0;
+	}
+	return width;
+}
+unsigned char *read_nrf(unsigned char Register, unsigned char Byte_size){
+	unsigned char status;
+	status = read_nrf_buf(Register,nrf_cur->nrf_ret,Byte_size);
+	if(Register == STATUS){
+		nrf_cur->nrf_ret[0] = status;
+	}
+	return nrf_cur->nrf_ret;
+}
+unsigned char read_nrf_buf(unsigned char Register, unsigned char *data, unsigned char Byte_size){
+	//_delay_us(1);
+	unsigned char status;
+	unsigned char cached = (Byte_size == 1 && NRF_SHADOWED(Register));
+	NRF_LOCK;
+	if(cached && (nrf_cur->nrf_shadow_valid & (1ul<<Register))){
+		data[0] = nrf_cur->nrf_shadow[Register];
+		nrf_cur->nrf_spi_saved++;
+		status = nrf_cur->nrf_status;
+		NRF_UNLOCK;
+		return status;
+	}
+	SPI_Wait();
+	CSN_low;
+	status = SPI_Read_Write(Register);
+	if(Register != STATUS){
+		SPI_Transfer(0,data,Byte_size);
+	}
+	CSN_high;
+	nrf_cur->nrf_status = status;
+	nrf_cur->nrf_spi_count++;
+	NRF_STAT(nrf_cur->stats.spi_bytes += (Register == STATUS) ? 1 : 1 + Byte_size);
+	if(cached){
+		nrf_cur->nrf_shadow[Register] = data[0];
+		nrf_cur->nrf_shadow_valid |= (1ul<<Register);
+	}
+	NRF_UNLOCK;
+	return status;
+}
+unsigned char write_nrf(unsigned char Register,const unsigned char *data, unsigned char Byte_size){
+	//_delay_us(1);
+	unsigned char status;
+	unsigned char cached = (Byte_size == 1 && NRF_SHADOWED(Register));
+	NRF_LOCK;
+	if(cached){
+		if((nrf_cur->nrf_shadow_valid & (1ul<<Register)) && nrf_cur->nrf_shadow[Register] == data[0]){
+			nrf_cur->nrf_spi_saved++;							//nrf already holds this value
+			status = nrf_cur->nrf_status;
+			NRF_UNLOCK;
+			return status;
+		}
+		nrf_cur->nrf_shadow[Register] = data[0];
+		nrf_cur->nrf_shadow_valid |= (1ul<<Register);
+	}
+	else if(Byte_size == NRF_AW_BYTES && NRF_ADDR_SLOT(Register) != 0xFF){
+		unsigned char slot = NRF_ADDR_SLOT(Register);
+		for(unsigned char i = 0; i < Byte_size; i++){
+			nrf_cur->nrf_addr[slot][i] = data[i];
+		}
+		nrf_cur->nrf_addr_valid |= (1<<slot);
+	}
+	if(Register <= 0x1D){
+		Register = Register + W_REGISTER;
+	}
+	SPI_Wait();
+	CSN_low;
+	status = SPI_Read_Write(Register);
+	SPI_Transfer(data,0,Byte_size);
+	CSN_high;
+	nrf_cur->nrf_status = status;
+	nrf_cur->nrf_spi_count++;
+	NRF_STAT(nrf_cur->stats.spi_bytes += 1 + Byte_size);
+	NRF_UNLOCK;
+	return status;
+}
+static struct nrf_radio *nrf_spi_radio;					//radio of transfer (its CSN is low), SPI is shared by radios
+static void nrf_spi_done(void){
+	NRF_ON(nrf_spi_radio);
+	CSN_high;
+	nrf_cur->nrf_status = nrf_cur->nrf_spi_buf[0];
+	nrf_cur->nrf_spi_count++;
+	NRF_STAT(nrf_cur->stats.spi_bytes += 1 + nrf_cur->nrf_spi_size);
+	if(nrf_cur->nrf_spi_rx){
+		for(unsigned char i=0; i<nrf_cur->nrf_spi_size; i++){
+			nrf_cur->nrf_spi_rx[i] = nrf_cur->nrf_spi_buf[1 + i];
+		}
+	}
+	if(nrf_cur->nrf_spi_callback) nrf_cur->nrf_spi_callback(nrf_cur->nrf_spi_buf[0]);
+	NRF_OFF;
+}
+void nrf_spi_async(unsigned char Command, const unsigned char *data, unsigned char *rx, unsigned char Byte_size, void (*callback)(unsigned char status)){
+	if(Byte_size > 32) Byte_size = 32;
+	NRF_LOCK;
+	SPI_Wait();
+	if((Command & 0xE0) == W_REGISTER && (Command & 0x1F) < 0x1E){
+		nrf_cur->nrf_shadow_valid &= ~(1ul<<(Command & 0x1F));	//shadow copy is not tracked
+	}
+	nrf_cur->nrf_spi_buf[0] = Command;
+	for(unsigned char i=0; i<Byte_size; i++){
+		nrf_cur->nrf_spi_buf[1 + i] = data ? data[i] : NOP;
+	}
+	nrf_cur->nrf_spi_rx = rx;
+	nrf_cur->nrf_spi_size = Byte_size;
+	nrf_cur->nrf_spi_callback = callback;
+	nrf_spi_radio = nrf_cur;
+	CSN_low;
+	SPI_Transfer_Async(nrf_cur->nrf_spi_buf,nrf_cur->nrf_spi_buf,1 + Byte_size,nrf_spi_done);
+	NRF_UNLOCK;
+}
+void nrf_clear_status(unsigned char flags){
+	unsigned char data1[1];
+	flags &= ((1<<RX_DR)|(1<<TX_DS)|(1<<MAX_RT));
+	//one write instead of one per flag
+	nrf_cur->nrf_spi_saved += ((flags>>RX_DR) & 1) + ((flags>>TX_DS) & 1) + ((flags>>MAX_RT) & 1);
+	data1[0] = flags & nrf_cur->nrf_status;
+	if(data1[0]){
+		write_nrf(STATUS,data1,1);
+		nrf_cur->nrf_spi_saved--;
+		nrf_cur->nrf_status &= ~data1[0];
+	}
 }
-void rx_payload(){
-	unsigned char rx_payload_p[1];
-	rx_payload_p[0] = RX_Payload_P0;
-	write_nrf(RX_PW_P0,rx_payload_p,1);
-	
-	rx_payload_p[0] = RX_Payload_P1;
-	write_nrf(RX_PW_P1,rx_payload_p,1);
-	
-	rx_payload_p[0] = RX_Payload_P2;
-	write_nrf(RX_PW_P2,rx_payload_p,1);
-	
-	rx_payload_p[0] = RX_Payload_P3;
-	write_nrf(RX_PW_P3,rx_payload_p,1);
-	
-	rx_payload_p[0] = RX_Payload_P4;
-	write_nrf(RX_PW_P4,rx_payload_p,1);
-	
-	rx_payload_p[0] = RX_Payload_P5;
-	write_nrf(RX_PW_P5,rx_payload_p,1);
+void nrf_shadow_reset(){
+	nrf_cur->nrf_shadow_valid = 0;
 }
-void dynamic_payload(){
-	unsigned char dpl_px[1];
-	dpl_px[0] = ((DPL_P5<<5)|(DPL_P4<<4)|(DPL_P3<<3)|(DPL_P2<<2)|(DPL_P1<<1)|(DPL_P0));
-	write_nrf(DYNPD,dpl_px,1);
+unsigned char nrf_shadow_get(unsigned char Register){
+	unsigned char value[1];
+	if(nrf_cur->nrf_shadow_valid & (1ul<<Register)){
+		return nrf_cur->nrf_shadow[Register];
+	}
+	read_nrf_buf(Register,value,1);
+	return value[0];
 }
-void feature(){
-	unsigned char feat[1];
-	feat[0] = ((EN_DPL<<2)|(EN_ACK_PAY<<1)|(EN_DYN_ACK));
-	write_nrf(FEATURE,feat,1);
+unsigned char nrf_recover(){
+	unsigned char i, j, reg, size, reset, value[5], read[5];
+	unsigned long valid = nrf_cur->nrf_shadow_valid;
+	reset = (read_nrf_buf(STATUS,0,0) & 0x80) != 0;		//bit 7 of STATUS reads 0 on nrf
+	//registers of shadow copy are read from nrf : power on reset value in any of them means nrf was reset
+	for(reg = 0; reg < 0x1E && !reset; reg++){
+		if(!(valid & (1ul<<reg))) continue;
+		value[0] = nrf_cur->nrf_shadow[reg];
+		nrf_cur->nrf_shadow_valid &= ~(1ul<<reg);
+		read_nrf_buf(reg,read,1);
+		nrf_cur->nrf_shadow[reg] = value[0];						//value library wrote
+		if(read[0] != value[0]) reset = 1;
+	}
+	nrf_cur->nrf_shadow_valid = valid;
+	if(!reset) return 1;
+	//nrf ignores SPI during power on reset : probe it once instead of waiting for it (nrf24l01_init())
+	j = nrf_cur->nrf_shadow[RX_ADDR_P5];
+	value[0] = 0x5A;
+	nrf_cur->nrf_shadow_valid &= ~(1ul<<RX_ADDR_P5);
+	write_nrf(RX_ADDR_P5,value,1);
+	nrf_cur->nrf_shadow_valid &= ~(1ul<<RX_ADDR_P5);
+	read_nrf_buf(RX_ADDR_P5,read,1);
+	nrf_cur->nrf_shadow[RX_ADDR_P5] = j;
+	nrf_cur->nrf_shadow_valid = valid;
+	if(read[0] != 0x5A) return 0;						//shadow copy is kept for next try
+	//register image with values of shadow copy and addresses last written (changed at run time, eg. RF_CH, TX_ADDR), each read back
+	for(i = 0; i < sizeof(nrf_reg_image[0]); i += 8){
+		reg = pgm_read_byte(&nrf_reg_image[NRF_ID][i]);
+		size = pgm_read_byte(&nrf_reg_image[NRF_ID][i + 1]);
+		for(j = 0; j < size; j++){
+			value[j] = pgm_read_byte(&nrf_reg_image[NRF_ID][i + 3 + j]);
+		}
+		if(size == 1 && (valid & (1ul<<reg))) value[0] = nrf_cur->nrf_shadow[reg];
+		if(size > 1 && (nrf_cur->nrf_addr_valid & (1<<NRF_ADDR_SLOT(reg)))){
+			for(j = 0; j < size; j++){
+				value[j] = nrf_cur->nrf_addr[NRF_ADDR_SLOT(reg)][j];
+			}
+		}
+		nrf_cur->nrf_shadow_valid &= ~(1ul<<reg);
+		write_nrf(reg,value,size);
+		nrf_cur->nrf_shadow_valid &= ~(1ul<<reg);
+		read_nrf_buf(reg,read,size);
+		for(j = 0; j < size; j++){
+			if(value[j] != read[j]) return 0;
+		}
+	}
+#if NRF_HUB & 1
+	nrf_cur->nrf_hub_granted = 0;								//grants in TX FIFO are gone
+#endif
+	//CONFIG last : powers nrf up in mode it was in
+	if(valid & (1ul<<CONFIG)){
+		value[0] = nrf_cur->nrf_shadow[CONFIG];
+		nrf_cur->nrf_shadow_valid &= ~(1ul<<CONFIG);
+		write_nrf(CONFIG,value,1);
+		if(value[0] & (1<<1)) _delay_us(NRF_TPD2STBY_US);
+	}
+	read_nrf_buf(STATUS,0,0);
+	NRF_STAT(nrf_cur->stats.resets++);
+	return 2;
 }
-static unsigned char *read_nrf(unsigned char Register, unsigned char Byte_size){
-	//_delay_us(1);
-	static unsigned char ret[32];
-	
-	if(Register == STATUS){
-		CSN_low;
-		ret[0] = SPI_Read_Write(Register);
+unsigned char nrf_wait_status(unsigned char mask, unsigned long deadline_us){
+	unsigned long start = NRF_CLOCK_US();
+#if NRF_IRQ_MODE == 1
+	unsigned char events, sreg = SREG;					//interrupts are given back as caller had them
+	for(;;){
+		cli();
+		events = nrf_cur->nrf_irq_events;
+		if(events & 0x80){
+			nrf_cur->nrf_irq_events = events & ~0x80;
+			SREG = sreg;
+			NRF_STAT(nrf_cur->stats.wait_us += NRF_CLOCK_US() - start);
+			return 0;									//bit 7 of STATUS read by nrf_irq_handler() : MISO is stuck high, no nrf
+		}
+		if(events & mask){
+			nrf_cur->nrf_irq_events = events & ~mask;			//other events are left to their own waits
+			SREG = sreg;
+			NRF_STAT(nrf_cur->stats.wait_us += NRF_CLOCK_US() - start);
+			return events;
+		}
+		if(deadline_us && NRF_CLOCK_US() - start >= deadline_us){
+			SREG = sreg;
+			NRF_STAT(nrf_cur->stats.timeouts++);
+			NRF_STAT(nrf_cur->stats.wait_us += NRF_CLOCK_US() - start);
+			return 0;
+		}
+		if(!(sreg & (1<<SREG_I))){
+			nrf_irq_handler();							//called with interrupts off : STATUS is polled instead of waiting for IRQ
+			continue;
+		}
+	#if NRF_IRQ_SLEEP == 1
+		sleep_enable();
+		sei();										//sleep_cpu() is executed before any pending interrupt
+		sleep_cpu();
+		sleep_disable();
+	#else
+		sei();
+	#endif
+	}
+#else
+	unsigned char status = read_nrf_buf(STATUS,0,0);
+	while(!(status & mask)){
+		if(deadline_us && NRF_CLOCK_US() - start >= deadline_us){
+			NRF_STAT(nrf_cur->stats.timeouts++);
+			NRF_STAT(nrf_cur->stats.wait_us += NRF_CLOCK_US() - start);
+			return 0;
+		}
+		status = read_nrf_buf(STATUS,0,0);
+	}
+	NRF_STAT(nrf_cur->stats.wait_us += NRF_CLOCK_US() - start);
+	if(status & 0x80) return 0;							//bit 7 of STATUS reads 0 : MISO is stuck high, no nrf
+	return status;
+#endif
+}
+void nrf_irq_handler(){
+	unsigned char status;
+	SPI_Wait();											//lets a bulk transfer of main program finish
+	CSN_low;
+	status = SPI_Read_Write(W_REGISTER + STATUS);		//STATUS is clocked out with the command byte
+	if(status & 0x80){
+		SPI_Read_Write(0);
 		CSN_high;
+		nrf_cur->nrf_spi_count++;
+		NRF_STAT(nrf_cur->stats.spi_bytes += 2);
+		nrf_cur->nrf_irq_events |= 0x80;				//bit 7 of STATUS reads 0 on nrf : no nrf, its wait gives up
+		return;
+	}
+	status &= ((1<<RX_DR)|(1<<TX_DS)|(1<<MAX_RT));
+	if(status & (1<<MAX_RT)) CE_low;					//clearing MAX_RT with CE high sends failed payload again, its sender decides
+	SPI_Read_Write(status);							//clears only the flags that were read
+	CSN_high;
+	nrf_cur->nrf_status &= ~status;
+	nrf_cur->nrf_spi_count++;
+	NRF_STAT(nrf_cur->stats.spi_bytes += 2);
+	if(status){
+		nrf_cur->nrf_irq_events |= status;
+		if(status & (1<<RX_DR)) nrf_listen_poll();
+		if(nrf_cur->nrf_irq_callback) nrf_cur->nrf_irq_callback(status);
+	}
+}
+void nrf_irq_attach(void (*callback)(unsigned char events)){
+	nrf_cur->nrf_irq_callback = callback;
+}
+void nrf_power_up(){
+	CE_low;
+	if(nrf_config_write(1,0)){
+		nrf_cur->nrf_state_wait = 1;
+		nrf_cur->nrf_state_since = NRF_CLOCK_US();
+	}
+}
+void nrf_power_down(){
+	CE_low;
+	nrf_cur->nrf_listening = 0;
+	nrf_cur->nrf_state_wait = 0;
+	nrf_config_write(0,0);
+}
+void nrf_standby(){
+	if(nrf_cur->nrf_state == NRF_STATE_RX){
+		CE_low;
+		nrf_cur->nrf_listening = 0;
+		nrf_cur->nrf_state = NRF_STATE_STBY;
+	}
+}
+#if SPI_Engine != 0
+static void nrf_send_loaded(unsigned char status){
+	(void)status;										//flags in STATUS of W_TX_PAYLOAD are left to nrf_poll()
+	if(nrf_cur->nrf_state == NRF_STATE_TX && !nrf_cur->nrf_state_wait){
+		CE_high;										//kept high till nrf_poll() sees TX_DS or MAX_RT
+	}
+}
+#endif
+unsigned char nrf_send_async(const unsigned char *data, unsigned char Byte_size){
+	if(nrf_cur->nrf_state == NRF_STATE_TX) return 0;
+	if(nrf_cur->nrf_state == NRF_STATE_PD) nrf_power_up();
+	CE_low;
+	nrf_cur->nrf_listening = 0;
+	nrf_config_write(1,0);
+	nrf_clear_status((1<<TX_DS)|(1<<MAX_RT));
+	NRF_IRQ_FORGET();
+	nrf_cur->nrf_tx_done = 0;
+	nrf_cur->nrf_state = NRF_STATE_TX;
+#if SPI_Engine != 0
+	nrf_spi_async(W_TX_PAYLOAD,data,0,Byte_size,nrf_send_loaded);
+#else
+	write_nrf(W_TX_PAYLOAD,data,Byte_size);
+	if(!nrf_cur->nrf_state_wait){
+		CE_high;										//kept high till nrf_poll() sees TX_DS or MAX_RT
+	}
+#endif
+	return 1;
+}
+void nrf_rx_start(){
+	unsigned char data1[1];
+	if(nrf_cur->nrf_state == NRF_STATE_PD) nrf_power_up();
+	CE_low;
+	nrf_config_write(1,1);
+	data1[0] = (1<<RX_DR);
+	write_nrf(FLUSH_RX,data1,0);
+	nrf_clear_status(data1[0]);
+	nrf_cur->nrf_listening = 1;
+	nrf_cur->nrf_state = NRF_STATE_RX;
+	if(!nrf_cur->nrf_state_wait){
+		CE_high;										//nrf settles in 130us on its own
+	}
+}
+unsigned char nrf_poll(){
+	unsigned char status, result;
+	if(nrf_cur->nrf_state == NRF_STATE_PD) return nrf_cur->nrf_state;
+#if SPI_Engine != 0
+	if(SPI_Busy){
+		if(SREG & 0x80) return nrf_cur->nrf_state;				//payload still being loaded by SPI interrupt
+		SPI_Wait();										//no interrupts, completed here
+	}
+#endif
+	if(nrf_cur->nrf_state_wait){
+		if((unsigned long)(NRF_CLOCK_US() - nrf_cur->nrf_state_since) < NRF_TPD2STBY_US) return nrf_cur->nrf_state;
+		nrf_cur->nrf_state_wait = 0;
+		if(nrf_cur->nrf_state != NRF_STATE_STBY) CE_high;
+	}
+	if(nrf_cur->nrf_state == NRF_STATE_TX){
+	#if NRF_IRQ_MODE == 1
+		NRF_LOCK;
+		status = nrf_cur->nrf_irq_events & ((1<<RX_DR)|(1<<TX_DS)|(1<<MAX_RT));
+		nrf_cur->nrf_irq_events &= ~status;
+		NRF_UNLOCK;
+	#else
+		status = read_nrf_buf(STATUS,0,0);
+	#endif
+		if(status & ((1<<TX_DS)|(1<<MAX_RT))){
+			CE_low;
+			NRF_STAT(nrf_cur->stats.tx_sent++);
+			NRF_OBSERVE(status);
+			if(status & (1<<MAX_RT)){
+				write_nrf(FLUSH_TX,&status,0);
+				result = NRF_TX_FAILED;
+			}
+			else if(status & (1<<RX_DR)){
+				nrf_rx_drain();							//ACK Payload goes to queue of data pipe 0
+				result = NRF_TX_ACK_PAYLOAD;
+			}
+			else{
+				result = NRF_TX_SENT;
+			}
+			nrf_clear_status(status);
+			nrf_cur->nrf_state = NRF_STATE_STBY;
+			nrf_cur->nrf_tx_result = result;
+			nrf_cur->nrf_tx_done = 1;
+			if(nrf_cur->nrf_tx_callback) nrf_cur->nrf_tx_callback(result);
+		}
+	}
+	#if NRF_IRQ_MODE == 0
+	else if(nrf_cur->nrf_state == NRF_STATE_RX){
+		nrf_listen_poll();
+	}
+	#endif
+	return nrf_cur->nrf_state;
+}
+void nrf_tx_attach(void (*callback)(unsigned char result)){
+	nrf_cur->nrf_tx_callback = callback;
+}
+void nrf_stats_snapshot(struct nrf_stats *stats, unsigned char reset){
+	unsigned char pipe;
+	NRF_LOCK;
+	if(stats){
+	#if NRF_STATS == 1
+		*stats = nrf_cur->stats;
+	#else
+		*stats = (struct nrf_stats){0};
+	#endif
+		for(pipe = 0; pipe < 6; pipe++){
+			stats->rx_count[pipe] = nrf_cur->nrf_rx_count[pipe];
+			stats->rx_dropped[pipe] = nrf_cur->nrf_rx_dropped[pipe];
+		}
+		stats->spi_count = nrf_cur->nrf_spi_count;
+		stats->spi_saved = nrf_cur->nrf_spi_saved;
+	}
+	if(reset){
+	#if NRF_STATS == 1
+		nrf_cur->stats = (struct nrf_stats){0};
+	#endif
+		for(pipe = 0; pipe < 6; pipe++){
+			nrf_cur->nrf_rx_count[pipe] = 0;
+			nrf_cur->nrf_rx_dropped[pipe] = 0;
+		}
+		nrf_cur->nrf_spi_count = 0;
+		nrf_cur->nrf_spi_saved = 0;
+	}
+	NRF_UNLOCK;
+}
+void nrf_stats_reset(){
+	nrf_stats_snapshot(0,1);
+}
+#if NRF_STATS == 1 || NRF_RETR_ADAPT == 1 || NRF_RATE_ADAPT == 1
+void nrf_tx_observe(unsigned char status){
+	unsigned char observe[1], arc;
+	if(!nrf_shadow_get(EN_AA)) return;					//no retransmits without auto ack
+	read_nrf_buf(OBSERVE_TX,observe,1);
+	arc = observe[0] & 0x0F;
+#if NRF_STATS == 1
+	nrf_cur->stats.tx_plos = observe[0] >> 4;
+	nrf_cur->stats.tx_retrans += arc;
+	if(status & (1<<MAX_RT)){
+		nrf_cur->stats.tx_lost++;
+	}
+	else if(status & (1<<TX_DS)){
+		nrf_cur->stats.tx_acked++;
+		nrf_cur->stats.tx_arc[arc]++;
+	}
+#endif
+#if NRF_RETR_ADAPT == 1
+	nrf_retr_adapt(status,arc);
+#endif
+#if NRF_RATE_ADAPT == 1
+	nrf_rate_adapt(status,arc);
+#endif
+}
+#endif
+void nrf_set_channel(unsigned char channel){
+	unsigned char ch[1];
+	if(channel >= NRF_CHANNELS) return;
+	ch[0] = channel;
+	write_nrf(RF_CH,ch,1);
+}
+unsigned char nrf_get_channel(){
+	return nrf_shadow_get(RF_CH);
+}
+void nrf_survey(unsigned char *map, unsigned char first, unsigned char last, unsigned char samples){
+	unsigned char config = nrf_shadow_get(CONFIG);
+	unsigned char channel = nrf_shadow_get(RF_CH);
+	unsigned char state = nrf_cur->nrf_state;
+	unsigned char rpd[1], ch, i;
+	CE_low;
+	if(nrf_config_write(1,1)) _delay_us(NRF_TPD2STBY_US);
+	for(ch = first; ch <= last && ch < NRF_CHANNELS; ch++){
+		nrf_set_channel(ch);
+		map[ch] = 0;
+		for(i = 0; i < samples; i++){
+			CE_high;
+			_delay_us(170);								//Tstby2a + Tdelay_AGC before RPD is valid
+			CE_low;										//latches RPD
+			read_nrf_buf(RPD,rpd,1);
+			map[ch] += rpd[0] & 1;
+		}
+	}
+	nrf_set_channel(channel);
+	nrf_config_write((config >> 1) & 1,config & 1);
+	nrf_cur->nrf_state = state;
+	if(nrf_cur->nrf_listening && (config & 1)){
+		CE_high;
+	}
+}
+unsigned char nrf_clear_channel(const unsigned char *map, unsigned char first, unsigned char last){
+	unsigned char ch, best = nrf_shadow_get(RF_CH);
+	unsigned int score, best_score = 0xFFFF;
+	if(last >= NRF_CHANNELS) last = NRF_CHANNELS - 1;
+	for(ch = first; ch <= last; ch++){
+		score = 2 * map[ch];
+		score += (ch > first) ? map[ch - 1] : map[ch];		//edge of survey counts as its last channel
+		score += (ch < last) ? map[ch + 1] : map[ch];
+		if(score < best_score || (score == best_score && ch == nrf_shadow_get(RF_CH))){
+			best_score = score;
+			best = ch;
+		}
+	}
+	return best;
+}
+unsigned char nrf_channel_move(unsigned char channel){
+	unsigned char old = nrf_shadow_get(RF_CH);
+	if(channel >= NRF_CHANNELS) return 0;
+	if(NRF_TX_OK(nrf_ctrl_send(NRF_CTRL_CHANNEL,channel))){
+		nrf_set_channel(channel);
+		return 1;
+	}
+	nrf_set_channel(channel);
+	if(NRF_TX_OK(nrf_ctrl_send(NRF_CTRL_CHANNEL,channel))){
+		return 1;
+	}
+	nrf_set_channel(old);
+	return 0;
+}
+unsigned char nrf_ctrl_send(unsigned char type, unsigned char value){
+	unsigned char frame[4], ack_size;
+	frame[0] = NRF_CTRL_MAGIC;
+	frame[1] = type;
+	frame[2] = value;
+	frame[3] = NRF_CTRL_MAGIC ^ type ^ value;
+	return nrf_send(frame,4,0,&ack_size);
+}
+unsigned char nrf_ctrl_handle(const unsigned char *data, unsigned char size){
+	if(size != 4 || data[0] != NRF_CTRL_MAGIC || data[3] != (NRF_CTRL_MAGIC ^ data[1] ^ data[2])) return 0;
+	switch(data[1]){
+		case NRF_CTRL_CHANNEL:
+			CE_low;										//RF_CH is written in Standby-I, not while receiving
+			nrf_set_channel(data[2]);
+			if(nrf_cur->nrf_listening) CE_high;
+			break;
+		case NRF_CTRL_RATE:
+			CE_low;										//as RF_CH, RF_SETUP is not written while receiving
+			nrf_set_rate(data[2]);
+			if(nrf_cur->nrf_listening) CE_high;
+			break;
+	}
+	return 1;
+}
+void nrf_set_rate(unsigned char rate){
+	unsigned char rf[1], retr[1], ard;
+	if(rate > NRF_RATE_2M) return;
+	rf[0] = nrf_shadow_get(RF_SETUP) & ~((1<<5)|(1<<3));
+	if(rate == NRF_RATE_250K) rf[0] |= (1<<5);			//RF_DR_LOW
+	if(rate == NRF_RATE_2M) rf[0] |= (1<<3);			//RF_DR_HIGH
+	write_nrf(RF_SETUP,rf,1);
+	ard = nrf_ard_min(NRF_ACK_PAY_MAX);					//floor of new rate
+#if NRF_RETR_ADAPT == 0
+	if(ard < ARD) ard = ARD;
+#endif
+	retr[0] = (ard << 4) | (nrf_shadow_get(SETUP_RETR) & 0x0F);
+	write_nrf(SETUP_RETR,retr,1);
+#if NRF_RATE_ADAPT == 1
+	nrf_cur->nrf_rate_n = nrf_cur->nrf_rate_fail = 0;						//window starts over at new rate
+	nrf_cur->nrf_rate_arc = nrf_cur->nrf_rate_tries = nrf_cur->nrf_rate_ok = 0;
+	nrf_cur->nrf_rate_heard = NRF_CLOCK_US();
+#endif
+}
+unsigned char nrf_get_rate(){
+	unsigned char rf = nrf_shadow_get(RF_SETUP);
+	if(rf & (1<<5)) return NRF_RATE_250K;
+	if(rf & (1<<3)) return NRF_RATE_2M;
+	return NRF_RATE_1M;
+}
+unsigned char nrf_rate_move(unsigned char rate){
+	unsigned char old = nrf_get_rate();
+	if(rate > NRF_RATE_2M) return 0;
+	if(NRF_TX_OK(nrf_ctrl_send(NRF_CTRL_RATE,rate))){
+		nrf_set_rate(rate);
+		return 1;
+	}
+	nrf_set_rate(rate);
+	if(NRF_TX_OK(nrf_ctrl_send(NRF_CTRL_RATE,rate))){
+		return 1;
+	}
+	nrf_set_rate(old);
+	return 0;
+}
+#if NRF_RATE_ADAPT == 1
+void nrf_rate_adapt(unsigned char status, unsigned char arc_cnt){
+	unsigned char rate, ok;
+	unsigned int tries;
+	if(status & (1<<MAX_RT)) nrf_cur->nrf_rate_fail++;
+	else nrf_cur->nrf_rate_heard = NRF_CLOCK_US();
+	nrf_cur->nrf_rate_n++;
+	nrf_cur->nrf_rate_arc += arc_cnt;
+	if(nrf_cur->nrf_rate_n < NRF_RATE_WINDOW) return;
+	rate = nrf_get_rate();
+	tries = nrf_cur->nrf_rate_n + nrf_cur->nrf_rate_arc;					//packets put on air
+	ok = nrf_cur->nrf_rate_n - nrf_cur->nrf_rate_fail;					//payloads ACKed
+	if(!nrf_cur->nrf_rate_tries){
+		nrf_cur->nrf_rate_tries = 4 * tries;						//first window at this rate
+		nrf_cur->nrf_rate_ok = 4 * ok;
+	}
+	else{
+		nrf_cur->nrf_rate_tries += tries - nrf_cur->nrf_rate_tries / 4;
+		nrf_cur->nrf_rate_ok += ok - nrf_cur->nrf_rate_ok / 4;
+	}
+	if(!nrf_cur->nrf_rate_auto){
+		//paused : window is only counted
+	}
+	else if(!ok){
+		if(rate != NRF_RATE_250K) nrf_set_rate(NRF_RATE_250K);	//link lost : PRX falls back on its own too
+		nrf_cur->nrf_rate_tried = 0;
+		nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff = NRF_RATE_HOLD;
+	}
+	else if(rate == NRF_RATE_2M ? 5ul * nrf_cur->nrf_rate_tries > 6ul * nrf_cur->nrf_rate_ok : nrf_cur->nrf_rate_tries > 2ul * nrf_cur->nrf_rate_ok){
+		//retransmits cost more air time than next lower rate would (1M takes about 1.2 times as long as 2M
+		//for a payload, 250k about twice as long as 1M) : step down
+		if(rate != NRF_RATE_250K) nrf_cur->nrf_rate_next = rate - 1;
+		if(nrf_cur->nrf_rate_tried && nrf_cur->nrf_rate_backoff < 64) nrf_cur->nrf_rate_backoff *= 2;
+		nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff;
+		nrf_cur->nrf_rate_tried = 0;
 	}
 	else{
-		CSN_low;
-		SPI_Read_Write(Register);
-		for(unsigned char i=0; i<Byte_size; i++){
-			ret[i] = SPI_Read_Write(NOP);
+		if(nrf_cur->nrf_rate_tried && --nrf_cur->nrf_rate_tried == 0){
+			nrf_cur->nrf_rate_backoff = NRF_RATE_HOLD;				//higher rate held up
+		}
+		if(16ul * tries > 17ul * ok){
+			nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff;				//not clean enough to try higher rate
+		}
+		else if(rate != NRF_RATE_2M && (nrf_cur->nrf_rate_hold == 0 || --nrf_cur->nrf_rate_hold == 0)){
+			nrf_cur->nrf_rate_next = rate + 1;
+			nrf_cur->nrf_rate_tried = NRF_RATE_HOLD;
+			nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff;
 		}
-		CSN_high;
 	}
-	return ret;
+	nrf_cur->nrf_rate_n = nrf_cur->nrf_rate_fail = 0;
+	nrf_cur->nrf_rate_arc = 0;
 }
-void write_nrf(unsigned char Register,unsigned char *data, unsigned char Byte_size){
-	//_delay_us(1);
-	if(Register <= 0x1D){
-		Register = Register + W_REGISTER;
+unsigned char nrf_rate_poll(){
+	unsigned char rate = nrf_get_rate(), next;
+	unsigned long heard;
+	NRF_LOCK;
+	heard = nrf_cur->nrf_rate_heard;
+	next = nrf_cur->nrf_rate_next;
+	nrf_cur->nrf_rate_next = 0xFF;
+	NRF_UNLOCK;
+	if((unsigned long)(NRF_CLOCK_US() - heard) > NRF_RATE_LOST_MS * 1000ul){
+		if(rate != NRF_RATE_250K && nrf_cur->nrf_rate_auto){
+			CE_low;
+			nrf_set_rate(NRF_RATE_250K);				//link lost : safest rate, peer does the same
+			if(nrf_cur->nrf_listening) CE_high;
+			nrf_cur->nrf_rate_tried = 0;
+			nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff = NRF_RATE_HOLD;
+			rate = NRF_RATE_250K;
+		}
 	}
-	CSN_low;
-	SPI_Read_Write(Register);
-	
-	for (unsigned char i=0; i< Byte_size; i++){
-		SPI_Read_Write(*data);
-		data++;
+	else if(next != 0xFF && next != rate && !(nrf_shadow_get(CONFIG) & 1)){
+		if(nrf_rate_move(next)){
+			rate = next;
+		}
+		else{
+			nrf_cur->nrf_rate_tried = 0;							//PRX did not answer, stay
+			nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff;
+		}
 	}
-	CSN_high;
+	return rate;
+}
+#endif
+#if NRF_HOP == 1
+/*Time of NRF_CLOCK_US() since start of slot 0 (slot = time / NRF_HOP_SLOT_US). Slot clock is moved on by 256 slots when it wraps,
+PTX then gives blacklisted channels another chance*/
+static unsigned long nrf_hop_time(long offset){
+	unsigned long t;
+	NRF_LOCK;
+	t = NRF_CLOCK_US() + offset - nrf_cur->nrf_hop_epoch;
+	if(t >= NRF_HOP_PERIOD && t < 0x80000000ul){
+		nrf_cur->nrf_hop_epoch += (t / NRF_HOP_PERIOD) * NRF_HOP_PERIOD;
+		t %= NRF_HOP_PERIOD;
+		if(!(nrf_shadow_get(CONFIG) & 1)) nrf_cur->nrf_hop_black = 0;
+	}
+	NRF_UNLOCK;
+	return t;
+}
+/*Channel of slot, skipping blacklisted ones*/
+static unsigned char nrf_hop_index(unsigned char slot){
+	unsigned char i = slot & (NRF_HOP_LEN - 1), n = NRF_HOP_LEN;
+	while((nrf_cur->nrf_hop_black & (1ul<<i)) && --n){
+		i = (i + 1) & (NRF_HOP_LEN - 1);
+	}
+	return i;
+}
+void nrf_hop_start(unsigned int seed){
+	unsigned char i, j, ch;
+	if(!seed) seed = 0xACE1;
+	for(i = 0; i < NRF_HOP_LEN; i++){
+		do{
+			seed ^= seed << 7;							//xorshift16
+			seed ^= seed >> 9;
+			seed ^= seed << 8;
+			ch = NRF_HOP_FIRST + seed % (NRF_HOP_LAST - NRF_HOP_FIRST + 1);
+			for(j = 0; j < i && nrf_cur->nrf_hop_seq[j] != ch; j++);
+		}while(j < i);									//every channel once
+		nrf_cur->nrf_hop_seq[i] = ch;
+		nrf_cur->nrf_hop_fails[i] = 0;
+	}
+	nrf_cur->nrf_hop_black = 0;
+	nrf_cur->nrf_hop_tell = 0;
+	nrf_cur->nrf_hop_parked = 1;
+	nrf_cur->nrf_hop_epoch = NRF_CLOCK_US();
+	nrf_cur->nrf_hop_heard = nrf_cur->nrf_hop_epoch;
+	nrf_set_channel(nrf_cur->nrf_hop_seq[0]);
+	nrf_cur->nrf_hop_on = 1;
+}
+void nrf_hop_stop(){
+	nrf_cur->nrf_hop_on = 0;
+}
+unsigned char nrf_hop_send(const unsigned char *data, unsigned char Byte_size){
+	unsigned char frame[32], ack_size, result, slot, i;
+	unsigned long t;
+	if(Byte_size > 32 - NRF_HOP_HEAD) Byte_size = 32 - NRF_HOP_HEAD;
+	while((t = nrf_hop_time(0)) % NRF_HOP_SLOT_US > NRF_HOP_SLOT_US - NRF_HOP_GUARD_US){
+		_delay_us(100);									//too close to end of slot, wait for next one
+	}
+	slot = t / NRF_HOP_SLOT_US;
+	i = nrf_hop_index(slot);
+	nrf_set_channel(nrf_cur->nrf_hop_seq[i]);
+	frame[0] = slot;
+	frame[1] = nrf_cur->nrf_hop_tell | ((nrf_cur->nrf_hop_black & (1ul<<nrf_cur->nrf_hop_tell)) ? 0x80 : 0);
+	frame[2] = (t % NRF_HOP_SLOT_US) * 256 / NRF_HOP_SLOT_US;
+	nrf_cur->nrf_hop_tell = (nrf_cur->nrf_hop_tell + 1) & (NRF_HOP_LEN - 1);
+	for(unsigned char k = 0; k < Byte_size; k++){
+		frame[k + NRF_HOP_HEAD] = data[k];
+	}
+	result = nrf_send(frame,Byte_size + NRF_HOP_HEAD,0,&ack_size);
+	if(NRF_TX_OK(result)){
+		nrf_cur->nrf_hop_fails[i] = 0;
+		return result;
+	}
+	if(result != NRF_TX_FAILED) return result;					//nrf timed out or is gone, not a fault of the channel
+	if(i && ++nrf_cur->nrf_hop_fails[i] >= NRF_HOP_FAILS){
+		nrf_cur->nrf_hop_black |= (1ul<<i);						//first channel is never blacklisted (PRX waits there)
+		nrf_cur->nrf_hop_fails[i] = 0;
+		nrf_cur->nrf_hop_tell = i;								//tell PRX first
+	}
+	nrf_set_channel(nrf_cur->nrf_hop_seq[0]);
+	return nrf_send(frame,Byte_size + NRF_HOP_HEAD,0,&ack_size);
+}
+unsigned char nrf_hop_poll(){
+	unsigned char ch, channel;
+	unsigned long heard;
+	if(!nrf_cur->nrf_hop_on) return nrf_get_channel();
+	NRF_LOCK;
+	heard = nrf_cur->nrf_hop_heard;
+	NRF_UNLOCK;
+	if((unsigned long)(NRF_CLOCK_US() - heard) > NRF_HOP_LOST * NRF_HOP_SLOT_US){
+		nrf_cur->nrf_hop_parked = 1;
+	}
+	ch = nrf_cur->nrf_hop_parked ? nrf_cur->nrf_hop_seq[0] : nrf_cur->nrf_hop_seq[nrf_hop_index(nrf_hop_time(NRF_HOP_GUARD_US / 2) / NRF_HOP_SLOT_US)];
+	channel = nrf_get_channel();
+	if(ch != channel){
+		CE_low;
+		nrf_set_channel(ch);
+		if(nrf_cur->nrf_listening) CE_high;
+	}
+	return ch;
+}
+unsigned char nrf_hop_rx(unsigned char *data, unsigned char size){
+	unsigned long now = NRF_CLOCK_US(), epoch;
+	long diff;
+	unsigned char i, entry;
+	if(!nrf_cur->nrf_hop_on || size < NRF_HOP_HEAD) return size;
+	//payload went out data[2]/256 into slot data[0] (later if it was retransmitted)
+	epoch = now - (unsigned long)data[0] * NRF_HOP_SLOT_US - data[2] * NRF_HOP_SLOT_US / 256;
+	diff = (long)(epoch - nrf_cur->nrf_hop_epoch) % (long)NRF_HOP_PERIOD;
+	if(diff > (long)(NRF_HOP_PERIOD / 2)) diff -= NRF_HOP_PERIOD;
+	if(diff < -(long)(NRF_HOP_PERIOD / 2)) diff += NRF_HOP_PERIOD;
+	if(nrf_cur->nrf_hop_parked || diff < 0 || diff > (long)NRF_HOP_SLOT_US){
+		nrf_cur->nrf_hop_epoch += diff;							//earliest payload of a slot marks its start
+	}
+	else{
+		nrf_cur->nrf_hop_epoch += diff >> 6;						//follow clock drift of PTX slowly
+	}
+	nrf_cur->nrf_hop_parked = 0;
+	nrf_cur->nrf_hop_heard = now;
+	entry = data[1];
+	i = entry & (NRF_HOP_LEN - 1);
+	if(entry & 0x80) nrf_cur->nrf_hop_black |= (1ul<<i);
+	else nrf_cur->nrf_hop_black &= ~(1ul<<i);
+	for(i = NRF_HOP_HEAD; i < size; i++){
+		data[i - NRF_HOP_HEAD] = data[i];
+	}
+	return size - NRF_HOP_HEAD;
+}
+#endif
+void nrf_select(unsigned char radio){
+#if NRF_RADIOS > 1
+	if(radio < NRF_RADIOS) nrf_cur = &nrf_radios[radio];
+#else
+	(void)radio;
+#endif
+}
+#if NRF_FRAG == 1
+/*Time and goodput of report, bytes * 1000000 / time_us kept within 32 bits*/
+static void nrf_frag_time(unsigned long time_us){
+	unsigned long t = time_us >> 6;
+	nrf_cur->frag.time_us = time_us;
+	nrf_cur->frag.goodput = (unsigned long)nrf_cur->frag.bytes * 15625 / (t ? t : 1);
+}
+unsigned char nrf_frag_send(const unsigned char *msg, unsigned int size){
+	static unsigned char frame[NRF_FRAG_BATCH][NRF_FRAG_SIZE];
+	unsigned int index[NRF_FRAG_BATCH];
+	unsigned char result[NRF_FRAG_BATCH];
+	unsigned int last = size / NRF_FRAG_DATA;			//last frame carries size % NRF_FRAG_DATA bytes and their count in its last byte
+	unsigned int base = 0, next = 0, k;				//oldest frame not ACKed, next frame never sent
+	unsigned long acked = 0;						//bit n set = frame base + n ACKed
+	unsigned long start = NRF_CLOCK_US();
+	unsigned char n, i, j, count, fails = 0;
+	nrf_cur->nrf_frag_tx_msg = (nrf_cur->nrf_frag_tx_msg + 1) & ~NRF_FRAG_LAST;
+	nrf_cur->frag.bytes = size;
+	nrf_cur->frag.frames = last + 1;
+	nrf_cur->frag.sent = nrf_cur->frag.resent = 0;
+	while(base <= last){
+		//frames below next not ACKed were lost after max retransmits and go first, then new frames as window allows
+		n = 0;
+		for(k = base; k < next && n < NRF_FRAG_BATCH; k++){
+			if(!(acked & (1ul<<(k - base)))) index[n++] = k;
+		}
+		nrf_cur->frag.resent += n;
+		for(; n < NRF_FRAG_BATCH && next <= last && next - base < NRF_FRAG_WINDOW; next++){
+			index[n++] = next;
+		}
+		for(i = 0; i < n; i++){
+			k = index[i];
+			count = (k == last) ? size % NRF_FRAG_DATA : NRF_FRAG_DATA;
+			frame[i][0] = nrf_cur->nrf_frag_tx_msg | ((k == last) ? NRF_FRAG_LAST : 0);
+			frame[i][1] = (unsigned char)k;
+			for(j = 0; j < count; j++){
+				frame[i][j + NRF_FRAG_HEAD] = msg[k * NRF_FRAG_DATA + j];
+			}
+			if(k == last) frame[i][NRF_FRAG_SIZE - 1] = count;
+		}
+		nrf_cur->frag.sent += n;
+		if(nrf_transmit_stream(frame[0],NRF_FRAG_SIZE,n,result)) fails = 0;
+		else if(++fails >= NRF_FRAG_FAILS) break;
+		for(i = 0; i < n; i++){
+			if(result[i]) acked |= (1ul<<(index[i] - base));
+		}
+		while(acked & 1){
+			acked >>= 1;
+			base++;
+		}
+	}
+	nrf_frag_time(NRF_CLOCK_US() - start);
+	return base > last;
+}
+void nrf_frag_listen(unsigned char pipe, unsigned char *buf, unsigned int size){
+	NRF_LOCK;
+	nrf_cur->nrf_frag_buf = buf;
+	nrf_cur->nrf_frag_max = size;
+	nrf_cur->nrf_frag_started = 0;								//late frames of last message are not taken for a new one
+	nrf_cur->nrf_frag_state = NRF_FRAG_WAIT;
+	nrf_pipe_attach(pipe,nrf_frag_rx);
+	if(nrf_cur->nrf_listening) nrf_rx_drain();					//frames held in RX FIFO since last message
+	NRF_UNLOCK;
+}
+unsigned char nrf_frag_recv(unsigned int *size){
+	unsigned char state = nrf_cur->nrf_frag_state;
+	if(state == NRF_FRAG_DONE) *size = nrf_cur->nrf_frag_size;
+	return state;
+}
+void nrf_frag_rx(const unsigned char *data, unsigned char size){
+	unsigned char msg = data[0] & ~NRF_FRAG_LAST, diff, count = NRF_FRAG_DATA;
+	unsigned int at;
+	if(size < NRF_FRAG_SIZE) return;
+	if(nrf_cur->nrf_frag_state == NRF_FRAG_WAIT && msg != nrf_cur->nrf_frag_rx_msg){
+		//first frame of a new message (or peer gave up on the one being received)
+		nrf_cur->nrf_frag_rx_msg = msg;
+		nrf_cur->nrf_frag_started = 1;
+		nrf_cur->nrf_frag_base = 0;
+		nrf_cur->nrf_frag_got = 0;
+		nrf_cur->nrf_frag_last = 0xFFFF;
+		nrf_cur->nrf_frag_start = NRF_CLOCK_US();
+		nrf_cur->frag.dups = 0;
+	}
+	if(nrf_cur->nrf_frag_state != NRF_FRAG_WAIT || !nrf_cur->nrf_frag_started){
+		if(msg == nrf_cur->nrf_frag_rx_msg && nrf_cur->nrf_frag_state != NRF_FRAG_OVERFLOW) nrf_cur->frag.dups++;
+		else nrf_cur->frag.dropped++;
+		return;
+	}
+	diff = data[1] - (unsigned char)nrf_cur->nrf_frag_base;		//frame number relative to oldest frame missing
+	if(diff >= NRF_FRAG_WINDOW || (nrf_cur->nrf_frag_got & (1ul<<diff))){
+		nrf_cur->frag.dups++;							//received already
+		return;
+	}
+	at = (nrf_cur->nrf_frag_base + diff) * NRF_FRAG_DATA;
+	if(data[0] & NRF_FRAG_LAST){
+		count = data[NRF_FRAG_SIZE - 1];
+		if(count >= NRF_FRAG_DATA) count = NRF_FRAG_DATA - 1;
+		nrf_cur->nrf_frag_last = nrf_cur->nrf_frag_base + diff;
+		nrf_cur->nrf_frag_size = at + count;
+	}
+	if(at + count > nrf_cur->nrf_frag_max){
+		nrf_cur->nrf_frag_state = NRF_FRAG_OVERFLOW;
+		nrf_cur->frag.dropped++;
+		return;
+	}
+	for(unsigned char i = 0; i < count; i++){
+		nrf_cur->nrf_frag_buf[at + i] = data[i + NRF_FRAG_HEAD];
+	}
+	nrf_cur->nrf_frag_got |= (1ul<<diff);
+	while(nrf_cur->nrf_frag_got & 1){
+		nrf_cur->nrf_frag_got >>= 1;
+		nrf_cur->nrf_frag_base++;
+	}
+	if(nrf_cur->nrf_frag_last != 0xFFFF && nrf_cur->nrf_frag_base > nrf_cur->nrf_frag_last){
+		nrf_cur->frag.bytes = nrf_cur->nrf_frag_size;
+		nrf_cur->frag.frames = nrf_cur->nrf_frag_last + 1;
+		nrf_frag_time(NRF_CLOCK_US() - nrf_cur->nrf_frag_start);
+		nrf_cur->nrf_frag_state = NRF_FRAG_DONE;
+	}
+}
+void nrf_frag_report(struct nrf_frag_stats *report){
+	NRF_LOCK;
+	*report = nrf_cur->frag;
+	NRF_UNLOCK;
+}
+#endif
+#if NRF_HUB & 1
+/*Time of NRF_CLOCK_US() since start of slot 0. Start is moved on by 5 cycles when it wraps, keeping pipe and leaf of every slot*/
+static unsigned long nrf_hub_time(unsigned long now){
+	unsigned long t = now - nrf_cur->nrf_hub_epoch, period = 5ul * nrf_cur->nrf_hub_count * NRF_HUB_SLOT_US;
+	if(t >= period && t < 0x80000000ul){
+		nrf_cur->nrf_hub_epoch += (t / period) * period;
+		t %= period;
+	}
+	return t;
+}
+/*Time (8us) payload of node was taken after its point in slot (before if negative), within half a cycle*/
+static int nrf_hub_error(unsigned char node, unsigned long time){
+	long slot = NRF_HUB_SLOT_US, cycle = nrf_cur->nrf_hub_count * slot;
+	long e = ((long)(time - nrf_cur->nrf_hub_epoch) - node * slot - (long)NRF_HUB_AT) % cycle;
+	if(e < 0) e += cycle;
+	if(e >= cycle / 2) e -= cycle;
+	return e / NRF_HUB_TICK_US;
+}
+/*Loads grant of leaf on data pipe : delay from its payload to next one, cycle and request*/
+static void nrf_hub_grant(unsigned char pipe){
+	unsigned char node = nrf_cur->nrf_hub_pipe[pipe], grant[NRF_HUB_GRANT];
+	long cycle = (long)nrf_cur->nrf_hub_count * (NRF_HUB_SLOT_US / NRF_HUB_TICK_US), corr = -nrf_cur->nrf_hub_pred[node];
+	if(corr > cycle / 2) corr = cycle / 2;
+	if(corr < -cycle / 2) corr = -cycle / 2;
+	nrf_cur->nrf_hub_corr[node] = corr;
+	grant[0] = cycle + corr;
+	grant[1] = (cycle + corr) >> 8;
+	grant[2] = cycle;
+	grant[3] = cycle >> 8;
+	grant[4] = nrf_cur->nrf_hub_req[node];
+	write_nrf(W_ACK_PAYLOAD | pipe,grant,NRF_HUB_GRANT);
+	nrf_cur->nrf_hub_granted |= (1<<pipe);
+}
+/*Puts leaf of slot n on its data pipe and loads its grant*/
+static void nrf_hub_open(unsigned long n){
+	unsigned char pipe = 1 + n % 5, prev = 1 + (n + 4) % 5, node = n % nrf_cur->nrf_hub_count, loaded = 0;
+	unsigned char addr[5] = {NRF_ADDR(NRF_PIPE1_OF(NRF_ID))};
+	if(nrf_cur->nrf_hub_pipe[pipe] != node){
+		nrf_cur->nrf_hub_pipe[pipe] = node;
+		addr[0] = nrf_cur->nrf_hub_id[node];
+		write_nrf(RX_ADDR_P0 + pipe,addr,pipe == 1 ? NRF_AW_BYTES : 1);	//pipes 2 to 5 take MSBytes of pipe 1
+	}
+	for(unsigned char p = 1; p < 6; p++){
+		loaded += (nrf_cur->nrf_hub_granted >> p) & 1;
+	}
+	if((nrf_cur->nrf_hub_granted & (1<<pipe)) || loaded >= 3){
+		//grants of leaves that did not show up fill TX FIFO : flush it, keeping grant of previous slot
+		write_nrf(FLUSH_TX,addr,0);
+		loaded = nrf_cur->nrf_hub_granted & (1<<prev);
+		nrf_cur->nrf_hub_granted = 0;
+		if(loaded && nrf_cur->nrf_hub_pipe[prev] < nrf_cur->nrf_hub_count) nrf_hub_grant(prev);
+	}
+	nrf_hub_grant(pipe);
+}
+void nrf_hub_start(){
+	for(unsigned char p = 0; p < 6; p++){
+		nrf_cur->nrf_hub_pipe[p] = 0xFF;
+	}
+	write_nrf(FLUSH_TX,nrf_cur->nrf_hub_pipe,0);
+	nrf_cur->nrf_hub_granted = 0;
+	nrf_cur->nrf_hub_count = 0;
+	nrf_cur->nrf_hub_epoch = NRF_CLOCK_US();
+	nrf_cur->nrf_hub_slot = 0xFFFFFFFFul;
+}
+unsigned char nrf_hub_add(unsigned char id){
+	unsigned char node = nrf_cur->nrf_hub_count;
+	if(node >= NRF_HUB_NODES) return 0xFF;
+	nrf_cur->nrf_hub_id[node] = id;
+	nrf_cur->nrf_hub_pred[node] = 0;
+	nrf_cur->nrf_hub_corr[node] = 0;
+	nrf_cur->nrf_hub_late[node] = 0;
+	nrf_cur->nrf_hub_req[node] = 0;
+	nrf_cur->nrf_hub_count++;
+	return node;
+}
+unsigned char nrf_hub_poll(){
+	const struct nrf_rx_slot *slot;
+	unsigned char pipe, node, count = 0;
+	unsigned long n;
+	int error;
+	if(!nrf_cur->nrf_hub_count) return 0;
+#if NRF_IRQ_MODE == 0
+	nrf_listen_poll();
+#endif
+	for(pipe = 1; pipe < 6; pipe++){						//before pipes are given to other leaves
+		while((slot = nrf_pipe_peek(pipe)) != 0){
+			node = nrf_cur->nrf_hub_pipe[pipe];
+			if(node < nrf_cur->nrf_hub_count){
+				error = nrf_hub_error(node,slot->time);
+				//payload late by a quarter slot or more was retransmitted, leaf is moved only if next one is late too
+				nrf_cur->nrf_hub_late[node] = !nrf_cur->nrf_hub_late[node] && error - nrf_cur->nrf_hub_pred[node] > (int)(NRF_HUB_SLOT_US / 4 / NRF_HUB_TICK_US);
+				if(!nrf_cur->nrf_hub_late[node]) nrf_cur->nrf_hub_pred[node] = error;
+				if(nrf_cur->nrf_hub_granted & (1<<pipe)){
+					nrf_cur->nrf_hub_granted &= ~(1<<pipe);		//payload took grant, leaf moves by its correction
+					nrf_cur->nrf_hub_pred[node] += nrf_cur->nrf_hub_corr[node];
+					nrf_cur->nrf_hub_req[node] = 0;
+				}
+				if(nrf_cur->nrf_hub_callback) nrf_cur->nrf_hub_callback(node,slot->data,slot->size);
+				count++;
+			}
+			nrf_rx_release(slot);
+		}
+	}
+	n = nrf_hub_time(NRF_CLOCK_US() + NRF_HUB_SLOT_US / 4) / NRF_HUB_SLOT_US;
+	if(n != nrf_cur->nrf_hub_slot){
+		nrf_cur->nrf_hub_slot = n;
+		nrf_hub_open(n);
+	}
+	return count;
+}
+void nrf_hub_attach(void (*callback)(unsigned char node, const unsigned char *data, unsigned char size)){
+	nrf_cur->nrf_hub_callback = callback;
+}
+void nrf_hub_request(unsigned char node, unsigned char request){
+	if(node < nrf_cur->nrf_hub_count) nrf_cur->nrf_hub_req[node] = request;
+}
+#endif
+#if NRF_HUB & 2
+void nrf_leaf_start(unsigned char id){
+	unsigned char addr[5] = {NRF_ADDR(NRF_PIPE1_OF(NRF_ID))};
+	addr[0] = id;
+	write_nrf(TX_ADDR,addr,NRF_AW_BYTES);
+	write_nrf(RX_ADDR_P0,addr,NRF_AW_BYTES);				//ACK comes back on pipe 0
+	nrf_cur->nrf_retr_soft = 0;
+	nrf_cur->nrf_leaf_synced = 0;
+	nrf_cur->nrf_leaf_misses = 0;
+	nrf_cur->nrf_leaf_seed = 0x100 | id;
+	nrf_cur->nrf_leaf_next = NRF_CLOCK_US();
+}
+unsigned char nrf_leaf_due(){
+	return (long)(NRF_CLOCK_US() - nrf_cur->nrf_leaf_next) >= 0;
+}
+unsigned char nrf_leaf_send(const unsigned char *data, unsigned char Byte_size, unsigned char *request){
+	unsigned char ack[32], ack_size, result;
+	unsigned long start = NRF_CLOCK_US();
+	*request = 0;
+	result = nrf_send(data,Byte_size,ack,&ack_size);
+	if(result == NRF_TX_ACK_PAYLOAD && ack_size == NRF_HUB_GRANT){
+		nrf_cur->nrf_leaf_next = start + (unsigned long)(ack[0] | (ack[1]<<8)) * NRF_HUB_TICK_US;
+		nrf_cur->nrf_leaf_cycle = (unsigned long)(ack[2] | (ack[3]<<8)) * NRF_HUB_TICK_US;
+		*request = ack[4];
+		nrf_cur->nrf_leaf_synced = 1;
+		nrf_cur->nrf_leaf_misses = 0;
+	}
+	else if(nrf_cur->nrf_leaf_synced && ++nrf_cur->nrf_leaf_misses < NRF_HUB_LOST){
+		nrf_cur->nrf_leaf_next = start + nrf_cur->nrf_leaf_cycle;				//same slot next cycle
+	}
+	else{
+		nrf_cur->nrf_leaf_synced = 0;
+		nrf_cur->nrf_leaf_seed ^= nrf_cur->nrf_leaf_seed << 7;				//xorshift16
+		nrf_cur->nrf_leaf_seed ^= nrf_cur->nrf_leaf_seed >> 9;
+		nrf_cur->nrf_leaf_seed ^= nrf_cur->nrf_leaf_seed << 8;
+		nrf_cur->nrf_leaf_next = start + nrf_cur->nrf_leaf_seed % NRF_HUB_RETRY_US;
+	}
+	return result;
+}
+#endif
+#if NRF_ROUTE == 1
+/*Writes address of node addr (Data_Pipe1 with LSByte addr) to an address register*/
+static void nrf_route_address(unsigned char Register, unsigned char addr){
+	unsigned char value[5] = {NRF_ADDR(NRF_PIPE1_OF(NRF_ID))};
+	value[0] = addr;
+	write_nrf(Register,value,NRF_AW_BYTES);
+}
+/*Turns data pipe 0 on for ACK of next hop while sending, off while listening (it holds address of another node)*/
+static void nrf_route_pipe0(unsigned char on){
+	unsigned char erx[1];
+	erx[0] = (nrf_shadow_get(EN_RXADDR) & ~(1<<0)) | on;
+	write_nrf(EN_RXADDR,erx,1);
+}
+/*Takes dst as reached through next in hops, unless a route of fewer hops through another node is known*/
+static void nrf_route_learn(unsigned char dst, unsigned char next, unsigned char hops){
+	if(dst == 0 || dst >= NRF_ROUTE_NODES || dst == nrf_cur->nrf_route_addr || nrf_cur->nrf_route_hops[dst] == NRF_ROUTE_STATIC) return;
+	if(hops <= nrf_cur->nrf_route_hops[dst] || nrf_cur->nrf_route_next[dst] == next){
+		nrf_cur->nrf_route_next[dst] = next;
+		nrf_cur->nrf_route_hops[dst] = hops;
+	}
+}
+/*Sends payload to next hop of its destination and goes back to listening. Returns result of nrf_send()*/
+static unsigned char nrf_route_tx(unsigned char *packet, unsigned char size){
+	unsigned char dst = packet[0], route = NRF_ROUTE_DEFAULT, next, result, ack_size, listening = nrf_cur->nrf_listening;
+	if(dst < NRF_ROUTE_NODES && nrf_cur->nrf_route_hops[dst] != NRF_ROUTE_NONE) route = dst;
+	next = nrf_cur->nrf_route_next[route];
+	if(nrf_cur->nrf_route_hops[route] == NRF_ROUTE_NONE) next = dst;		//no route : try destination itself
+	packet[2] = nrf_cur->nrf_route_addr;
+	if(listening){
+		nrf_listen_stop();
+		NRF_LOCK;
+		nrf_rx_drain();									//nrf_send() flushes RX FIFO
+		NRF_UNLOCK;
+		nrf_config(1,0);
+	}
+	if(next != nrf_cur->nrf_route_to){
+		nrf_route_address(TX_ADDR,next);
+		nrf_route_address(RX_ADDR_P0,next);				//ACK comes back on pipe 0
+		nrf_cur->nrf_route_to = next;
+	}
+	nrf_route_pipe0(1);
+	result = nrf_send(packet,size,0,&ack_size);
+	nrf_route_pipe0(0);
+	if(!NRF_TX_OK(result) && nrf_cur->nrf_route_hops[route] != NRF_ROUTE_NONE && nrf_cur->nrf_route_hops[route] != NRF_ROUTE_STATIC){
+		nrf_cur->nrf_route_hops[route] = NRF_ROUTE_NONE;			//learned next hop (or nrf itself) is gone
+	}
+	if(listening){
+		nrf_config(1,1);
+		nrf_listen();
+	}
+	return result;
+}
+/*Payload of data pipe 1 (listening mode) : delivered, queued for next hop or dropped*/
+static void nrf_route_rx(const unsigned char *data, unsigned char size){
+	unsigned int id = ((unsigned int)data[1] << 8) | data[3];
+	unsigned char slot;
+	if(size < NRF_ROUTE_HEAD || data[1] == 0 || data[1] == nrf_cur->nrf_route_addr) return;
+	for(unsigned char i = 0; i < NRF_ROUTE_SEEN; i++){
+		if(nrf_cur->nrf_route_seen[i] == id){
+			nrf_cur->route.dups++;
+			return;
+		}
+	}
+	nrf_cur->nrf_route_seen[nrf_cur->nrf_route_seen_at] = id;
+	nrf_cur->nrf_route_seen_at = (nrf_cur->nrf_route_seen_at + 1) % NRF_ROUTE_SEEN;
+	nrf_route_learn(data[2],data[2],1);
+	nrf_route_learn(data[1],data[2],data[4]);
+	if(data[0] == nrf_cur->nrf_route_addr){
+		nrf_cur->route.delivered++;
+		if(nrf_cur->nrf_route_callback) nrf_cur->nrf_route_callback(data[1],data + NRF_ROUTE_HEAD,size - NRF_ROUTE_HEAD,data[4]);
+		return;
+	}
+	if(data[4] >= NRF_ROUTE_HOPS){
+		nrf_cur->route.expired++;
+		return;
+	}
+	if((unsigned char)(nrf_cur->nrf_route_head - nrf_cur->nrf_route_tail) >= NRF_ROUTE_QUEUE){
+		nrf_cur->route.full++;
+		return;
+	}
+	slot = nrf_cur->nrf_route_head & (NRF_ROUTE_QUEUE - 1);
+	for(unsigned char i = 0; i < size; i++){
+		nrf_cur->nrf_route_queue[slot][i] = data[i];
+	}
+	nrf_cur->nrf_route_queue[slot][4]++;							//one hop more
+	nrf_cur->nrf_route_size[slot] = size;
+	NRF_BARRIER();
+	nrf_cur->nrf_route_head++;									//publish payload to nrf_route_poll()
+}
+void nrf_route_start(unsigned char addr){
+	for(unsigned char i = 0; i < NRF_ROUTE_NODES; i++){
+		nrf_cur->nrf_route_hops[i] = NRF_ROUTE_NONE;
+	}
+	for(unsigned char i = 0; i < NRF_ROUTE_SEEN; i++){
+		nrf_cur->nrf_route_seen[i] = 0;
+	}
+	nrf_cur->nrf_route_seen_at = 0;
+	nrf_cur->nrf_route_tail = nrf_cur->nrf_route_head;
+	nrf_cur->nrf_route_addr = addr;
+	nrf_cur->nrf_route_to = 0;
+	nrf_route_address(RX_ADDR_P1,addr);
+	nrf_route_pipe0(0);
+	nrf_pipe_attach(1,nrf_route_rx);
+}
+void nrf_route_set(unsigned char dst, unsigned char next){
+	if(dst >= NRF_ROUTE_NODES) return;
+	nrf_cur->nrf_route_next[dst] = next;
+	nrf_cur->nrf_route_hops[dst] = (next == NRF_ROUTE_NONE) ? NRF_ROUTE_NONE : NRF_ROUTE_STATIC;
+}
+unsigned char nrf_route_send(unsigned char dst, const unsigned char *data, unsigned char Byte_size){
+	unsigned char packet[32], result;
+	if(Byte_size > NRF_ROUTE_DATA) Byte_size = NRF_ROUTE_DATA;
+	packet[0] = dst;
+	packet[1] = nrf_cur->nrf_route_addr;
+	packet[3] = ++nrf_cur->nrf_route_seq;
+	packet[4] = 1;
+	for(unsigned char i = 0; i < Byte_size; i++){
+		packet[i + NRF_ROUTE_HEAD] = data[i];
+	}
+	result = nrf_route_tx(packet,Byte_size + NRF_ROUTE_HEAD);
+	if(!NRF_TX_OK(result)) nrf_cur->route.failed++;
+	else nrf_cur->route.sent++;
+	return result;
+}
+unsigned char nrf_route_poll(){
+	unsigned char slot, count = 0;
+#if NRF_IRQ_MODE == 0
+	nrf_listen_poll();
+#endif
+	while(nrf_cur->nrf_route_tail != nrf_cur->nrf_route_head){
+		NRF_BARRIER();									//payload is read after head showed it queued
+		slot = nrf_cur->nrf_route_tail & (NRF_ROUTE_QUEUE - 1);
+		if(!NRF_TX_OK(nrf_route_tx(nrf_cur->nrf_route_queue[slot],nrf_cur->nrf_route_size[slot]))) nrf_cur->route.lost++;
+		else nrf_cur->route.forwarded++;
+		NRF_BARRIER();
+		nrf_cur->nrf_route_tail++;
+		count++;
+	}
+	return count;
+}
+void nrf_route_attach(void (*callback)(unsigned char src, const unsigned char *data, unsigned char size, unsigned char hops)){
+	nrf_cur->nrf_route_callback = callback;
+}
+void nrf_route_report(struct nrf_route_stats *report, unsigned char reset){
+	NRF_LOCK;
+	if(report) *report = nrf_cur->route;
+	if(reset) nrf_cur->route = (struct nrf_route_stats){0};
+	NRF_UNLOCK;
+}
+#endif
+#if NRF_STREAM == 1
+void nrf_stream_begin(){
+	unsigned char data1[1];
+	data1[0] = (1<<TX_DS)|(1<<MAX_RT);
+	write_nrf(FLUSH_TX,data1,0);
+	nrf_clear_status(data1[0]);
+	CE_high;
+}
+unsigned char nrf_stream_write(const unsigned char *data, unsigned char Byte_size){
+	unsigned char payload[32];
+	if(write_nrf(NOP,data,0) & (1<<TX_FULL)) return 0;
+	if(Byte_size > NRF_STREAM_DATA) Byte_size = NRF_STREAM_DATA;
+	payload[0] = nrf_cur->nrf_stream_tx_seq;
+	payload[1] = nrf_cur->nrf_stream_tx_seq >> 8;
+	for(unsigned char i = 0; i < Byte_size; i++){
+		payload[i + NRF_STREAM_HEAD] = data[i];
+	}
+	//TX_DS of every payload is left set till nrf_stream_end() (or cleared by nrf_irq_handler()), it does not hold TX FIFO
+	write_nrf(W_TX_PAYLOAD_NOACK,payload,Byte_size + NRF_STREAM_HEAD);
+	nrf_cur->nrf_stream_tx_seq++;
+	NRF_STAT(nrf_cur->stats.tx_sent++);
+	return 1;
+}
+void nrf_stream_end(){
+	unsigned char status[1];
+	unsigned long start = NRF_CLOCK_US();
+	do{
+		read_nrf_buf(FIFO_STATUS,status,1);
+		if(nrf_cur->nrf_deadline_tx && NRF_CLOCK_US() - start >= nrf_cur->nrf_deadline_tx){
+			nrf_cur->nrf_result = nrf_lost();
+			break;
+		}
+	}while(!(status[0] & (1<<TX_EMPTY)));
+	CE_low;
+	nrf_clear_status(1<<TX_DS);
+}
+void nrf_stream_listen(unsigned char pipe){
+	nrf_stream_report(0,1);
+	nrf_pipe_attach(pipe,nrf_stream_rx);
+}
+void nrf_stream_rx(const unsigned char *data, unsigned char size){
+	unsigned int seq, gap;
+	unsigned long now = NRF_CLOCK_US(), delta, dev;
+	struct nrf_stream_stats *report = &nrf_cur->stream;
+	if(size < NRF_STREAM_HEAD) return;
+	seq = data[0] | (data[1]<<8);
+	gap = (seq - nrf_cur->nrf_stream_rx_seq) & 0xFFFF;			//payloads missing before this one (16 bits on air, unsigned int may be wider)
+	if(report->received){
+		if(gap >= 0x8000){
+			report->late++;
+			return;
+		}
+		if(gap){
+			report->lost += gap;
+			report->gaps++;
+			if(gap > report->max_gap) report->max_gap = gap;
+		}
+		delta = (now - nrf_cur->nrf_stream_rx_time) / (gap + 1ul);
+		if(report->received == 1){
+			nrf_cur->nrf_stream_avg = delta << 4;
+			nrf_cur->nrf_stream_jit = 0;
+		}
+		else{
+			nrf_cur->nrf_stream_avg += delta - (nrf_cur->nrf_stream_avg >> 4);	//averages over 16 payloads
+			dev = (delta > (nrf_cur->nrf_stream_avg >> 4)) ? delta - (nrf_cur->nrf_stream_avg >> 4) : (nrf_cur->nrf_stream_avg >> 4) - delta;
+			nrf_cur->nrf_stream_jit += dev - (nrf_cur->nrf_stream_jit >> 4);
+		}
+	}
+	report->received++;
+	nrf_cur->nrf_stream_rx_seq = (seq + 1) & 0xFFFF;
+	nrf_cur->nrf_stream_rx_time = now;
+	if(nrf_cur->nrf_stream_callback) nrf_cur->nrf_stream_callback(seq,data + NRF_STREAM_HEAD,size - NRF_STREAM_HEAD);
+}
+void nrf_stream_attach(void (*callback)(unsigned int seq, const unsigned char *data, unsigned char size)){
+	nrf_cur->nrf_stream_callback = callback;
+}
+void nrf_stream_report(struct nrf_stream_stats *report, unsigned char reset){
+	unsigned long total;
+	NRF_LOCK;
+	if(report){
+		*report = nrf_cur->stream;
+		total = report->received + report->lost;
+		report->loss_ppm = total ? (unsigned long)(report->lost * 1000000ull / total) : 0;
+		report->interval_us = nrf_cur->nrf_stream_avg >> 4;
+		report->jitter_us = nrf_cur->nrf_stream_jit >> 4;
+	}
+	if(reset){
+		nrf_cur->stream = (struct nrf_stream_stats){0};
+		nrf_cur->nrf_stream_avg = nrf_cur->nrf_stream_jit = 0;
+	}
+	NRF_UNLOCK;
+}
+#endif
+unsigned char nrf_ard_min(unsigned char ack_size){
+	unsigned char rf = nrf_shadow_get(RF_SETUP);
+	if(!(nrf_shadow_get(FEATURE) & (1<<1))) ack_size = 0;	//EN_ACK_PAY off
+	if(rf & (1<<5)) return (ack_size + 7) / 8 + 1;		//250kbps
+	if(rf & (1<<3)) return ack_size > 15;				//2Mbps
+	return ack_size > 5;								//1Mbps
+}
+#if NRF_RETR_ADAPT == 1
+void nrf_retr_adapt(unsigned char status, unsigned char arc_cnt){
+	unsigned char retr[1], arc, ard;
+	if(!nrf_cur->nrf_retr_auto) return;
+	nrf_cur->nrf_retr_n++;
+	if(status & (1<<MAX_RT)) nrf_cur->nrf_retr_fail++;
+	else if(arc_cnt > nrf_cur->nrf_retr_max) nrf_cur->nrf_retr_max = arc_cnt;
+	if(nrf_cur->nrf_retr_n < NRF_RETR_WINDOW) return;
+	arc = nrf_shadow_get(SETUP_RETR) & 0x0F;
+	ard = nrf_ard_min(NRF_ACK_PAY_MAX);
+	if(nrf_cur->nrf_retr_fail == nrf_cur->nrf_retr_n && (nrf_cur->nrf_retr_down >= NRF_RETR_ABSENT
+		|| (arc == 15 && nrf_cur->nrf_retr_soft == NRF_SOFT_RETRIES && ++nrf_cur->nrf_retr_down >= NRF_RETR_ABSENT))){
+		arc = 1;										//nothing got through at full retries, peer is absent : stop wasting air
+		nrf_cur->nrf_retr_soft = 0;
+	}
+	else{
+		if(nrf_cur->nrf_retr_fail < nrf_cur->nrf_retr_n){
+			if(nrf_cur->nrf_retr_down >= NRF_RETR_ABSENT){
+				nrf_cur->nrf_retr_soft = NRF_SOFT_RETRIES;		//peer is back
+			}
+			nrf_cur->nrf_retr_down = 0;
+		}
+		if(nrf_cur->nrf_retr_fail){
+			arc = (arc < 13) ? arc + 3 : 15;			//lossy link : retransmit more, never less than configured
+			if(arc < (nrf_cur->nrf_retr_floor & 0x0F)) arc = nrf_cur->nrf_retr_floor & 0x0F;
+			if(ard < (nrf_cur->nrf_retr_floor >> 4)) ard = nrf_cur->nrf_retr_floor >> 4;
+		}
+		else if(nrf_cur->nrf_retr_max + 2 < arc){
+			arc--;										//ARC_CNT stays well below ARC
+		}
+	}
+	retr[0] = (ard << 4) | arc;
+	write_nrf(SETUP_RETR,retr,1);						//skipped if unchanged (shadow copy)
+	nrf_cur->nrf_retr_n = nrf_cur->nrf_retr_fail = nrf_cur->nrf_retr_max = 0;
 }
+#endif
 
 #endif /* NRF24L01_H_ */
\ No newline at end of file
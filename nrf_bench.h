@@ -0,0 +1,1308 @@
+/*
+ * nrf_bench.h
+ *
+ * Throughput and latency benchmark of nrf24l01.h against simulated radios (nrf_sim.h).
+ * Sweeps data rate, payload size, ARD/ARC and link loss for one way (no ACK), ACK and
+ * ACK Payload modes and for nrf_send() against nrf_transmit_stream(). Settings are
+ * written to the radios at run time, so one build covers all of them. Retransmit tuning
+ * (nrf_retr_adapt()) is compared against fixed ARD/ARC over a range of loss rates if
+ * NRF_RETR_ADAPT is 1. Frequency hopping (nrf_hop_send()) is compared against one
+ * channel under WiFi like interference if NRF_HOP is 1 (PRX is an ideal peer following PTX).
+ * Data rate control (nrf_rate_poll()) is compared against each fixed data rate over received
+ * power (nrf_sim_rssi) if NRF_RATE_ADAPT is 1. A second table times one 32 byte W_TX_PAYLOAD
+ * through SPI_Read_Write() loop, SPI_Transfer() and SPI_Transfer_Async() (SPI_Engine 1) at
+ * 8MHz, using estimated CPU cycles of SPI.h. If NRF_RADIOS is above 1 a third table gives the
+ * aggregate throughput of 1 to NRF_RADIOS radios, each streaming to its own sink on its own
+ * channel with nrf_send_async() and nrf_poll() in turn. If NRF_FRAG is 1 a fourth table sends a
+ * 4096 byte message over loss rates with nrf_frag_send() and with nrf_send() one frame at a
+ * time (stop and wait), checking the message put together from frames taken by the sink, then
+ * counts payloads of a second data pipe taken while frames wait for nrf_frag_listen() and after.
+ * If NRF_HUB is 3 a fifth table runs a star network of 8 to 32 leaves, each with its own radio,
+ * driver state and simulated CPU (nrf_leaf_send()), around the driver as hub (nrf_hub_poll()), against as many
+ * simulated radios sending once per cycle at random times to fixed addresses of data pipes 1 to 5
+ * (uncoordinated, ALOHA like), and checks that every leaf holds the cycle and slot of the hub.
+ * If NRF_ROUTE is 1 a sixth table runs NRF_BENCH_HOPS + 1 nodes in a line (nrf_sim_link()), each
+ * with its own radio and driver state and taking turns on one simulated CPU, sending to gateway
+ * at one end over a static default route and back over learned routes (nrf_route_send()), once
+ * with each node heard by the next nodes only and once also by nodes 2 hops away.
+ * If NRF_STREAM is 1 a seventh table streams payloads without ACK (nrf_stream_write()) against
+ * nrf_transmit_stream() with auto ack at each data rate, with SPI at fosc/2 so air sets the pace,
+ * and gives loss and jitter seen by nrf_stream_rx() fed by the sink.
+ * A fault table times blocking calls against a missing peer, a brown out of the driver's radio
+ * (nrf_sim_brownout()) with and without power on reset time, an unplugged module and a receive
+ * with nothing on air, and how long nrf_recover() takes to get payloads through again. With NRF_HOP
+ * or NRF_ROUTE nrf_hop_send() and nrf_route_send() are run against an unplugged module too.
+ * Last table stresses software RX queues : a source sends numbered payloads at a fixed interval
+ * and the main loop takes them in place (nrf_rx_peek()) spending a fixed time on each, while
+ * nrf_irq_handler() (NRF_IRQ_MODE 1) or nrf_listen_poll() in the same loop fills the queue.
+ *
+ * Build : gcc -DNRF_SIM -DNRF_BENCH_MAIN -x c nrf_bench.h -o nrf_bench
+ *         Tables of features are built with one of -DNRF_RETR_ADAPT=1, -DNRF_HOP=1, -DNRF_RATE_ADAPT=1,
+ *         -DNRF_FRAG=1, -DNRF_HUB=3, -DNRF_ROUTE=1, -DNRF_STREAM=1 or -DNRF_RADIOS=3 (settings a table
+ *         needs, eg. data pipes of hub, are set below before nrf24l01.h is included)
+ * Run   : ./nrf_bench  (exit status is 1 if a lossless run did not deliver every payload or
+ *         retransmit tuning delivered less than fixed ARD/ARC it started from, or if pipe 1 of
+ *         fragmentation table got nothing after nrf_frag_listen() or a payload was left in RX FIFO, or
+ *         if leaves of star network did not join, left their slot or delivered no more than aloha, or if a
+ *         lossless routing run delivered less than 90% or a node took a payload meant for another
+ *         node, or if a lossless stream lost payloads, or
+ *         if a fault gave another result than expected, took longer than its deadlines or was
+ *         not recovered from, or if a run of RX queues received nothing or lost count of payloads)
+ *
+ * Columns :
+ *	pkt/s		payloads delivered per second
+ *	goodput		payload bytes delivered per second
+ *	p50/p99/max	time spent in one nrf_send() (us) ("-" for nrf_transmit_stream())
+ *	spi/pl		SPI bytes clocked per delivered payload
+ *	busy/pl		MCU time spent in SPI and delays per delivered payload (us)
+ *	air/pl		packets put on air (first transmissions and retransmits) per payload sent
+ *	jam			WiFi channels (22MHz wide, 1, 6 and 11) jammed with nrf_sim_noise
+ *	rssi		received power (dBm) of the link ("-" = strong)
+ *	dlv			payloads delivered / payloads sent
+ *
+ * Columns of SPI table :
+ *	sck			SPI clock (fosc/n)
+ *	path		byte (SPI_Read_Write() loop), bulk (SPI_Transfer()), async (SPI_Transfer_Async())
+ *	bus			CSN low to transfer done (CPU cycles)
+ *	cpu			CPU cycles taken from main program
+ *	Both are estimates : simulator charges SPI_CYCLES_* of SPI.h per byte and interrupt, so the
+ *	table shows how the engines add them up at each SPI clock, not timings measured on an AVR
+ *
+ * Columns of radios table :
+ *	radios		radios sending side by side (nrf_select())
+ *	pkt/s		payloads delivered per second by all radios
+ *
+ * Columns of fragmentation table :
+ *	api			frag (nrf_frag_send()) or send (nrf_send() per frame, NRF_SOFT_RETRIES retries)
+ *	ms			time to send message
+ *	goodput		message bytes per second
+ *	air/fr		packets put on air per frame of message
+ *	resent		frames sent again after MAX_RT
+ *	dups		frames received more than once (ACK lost)
+ *	ok			message received complete and intact
+ * and of its second part (driver as PRX, frames on data pipe 0 and payloads of another source on pipe 1) :
+ *	frag		held (no message awaited, frames stay in RX FIFO) or listen (nrf_frag_listen() after every message)
+ *	frames		frames taken by nrf_frag_rx() in 200ms
+ *	pipe1/sent1	payloads of pipe 1 taken and sent by its source in 200ms (pipe 1 waits behind held frames)
+ *
+ * Columns of star network table :
+ *	nodes		leaves, each sending one 32 byte payload per cycle (nodes * NRF_HUB_SLOT_US)
+ *	mode		hub (slots and grants of nrf_hub_poll()) or aloha (random times)
+ *	join		time till every leaf was in sync (ms, "-" for aloha)
+ *	pkt/s		payloads delivered to hub per second, after join
+ *	coll/s		packets lost in collisions per second
+ *	air/pl		packets put on air per payload delivered
+ *	dlv			payloads delivered / payloads sent by leaves, a payload of hub mode counted once and only if sent after join
+ *	slot		leaves on cycle of hub and expected by it within a quarter slot of their point at end ("-" for aloha)
+ *
+ * Columns of routing table :
+ *	reach		hops a node is heard over (1 = next nodes only, 2 = also overhears nodes 2 hops away)
+ *	hops		hops between node and gateway
+ *	dir			up (node to gateway, static default route) or down (gateway to node, learned route)
+ *	sent/got	payloads sent by source and taken by destination
+ *	avg/max ms	send to delivery time (ms, includes time other nodes hold the CPU)
+ *	dups/full/lost	over all nodes : duplicates dropped, payloads dropped with forwarding queue full,
+ *				payloads not ACKed by next hop of a relay
+ *	stray		over all nodes : frames taken on data pipe 0 (addressed to another node, must be 0)
+ *
+ * Columns of streaming table :
+ *	api			ack (nrf_transmit_stream(), auto ack) or noack (nrf_stream_write())
+ *	lost/gaps	payloads missing from sequence and runs of them (nrf_stream_report()), sequence
+ *				numbers go past 65535 and start over half way through each run
+ *	loss%		lost / (received + lost)
+ *	int/jit		average time between payloads and its average deviation (us)
+ *
+ * Columns of fault table :
+ *	case		peer (sink), no peer (out of range), brownout (reset, no power on reset time),
+ *				por (reset, 100ms of power on reset), unplugged, recv (nrf_recv(), 50ms deadline),
+ *				hop (nrf_hop_send(), unplugged, no channel blacklisted), route (nrf_route_send() on a
+ *				learned route, unplugged, route dropped)
+ *	result		result of call (nrf_send(), nrf_hop_send(), nrf_route_send() or nrf_result of nrf_recv())
+ *	ms			time of call
+ *	tries		nrf_recover() and nrf_send() every 10ms till a payload gets through ("-" = not tried)
+ *	back ms		time till a payload got through again
+ *
+ * Columns of RX queue table :
+ *	every		interval of source (us)
+ *	work		time main loop spends on each payload (us)
+ *	recv		payloads of source taken from queue (first NRF_BENCH_PACKETS it sent)
+ *	full		payloads dropped because queue was full (nrf_rx_dropped)
+ *	lost		payloads of source never taken (queue full, RX FIFO full till source gave up)
+ *	p50/p99/max	payload read from RX FIFO to taken by main loop (us)
+ */
+
+#ifndef NRF_BENCH_H_
+#define NRF_BENCH_H_
+
+#ifndef NRF_SIM
+#error "nrf_bench.h runs against simulated radios, build with -DNRF_SIM"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#ifndef NRF_SIM_RADIOS
+#define NRF_SIM_RADIOS		33			//hub and upto 32 leaves (NRF_HUB_NODES)
+#endif
+//settings feature tables need, so a table is built by turning its feature on alone (eg. -DNRF_HUB=3). Hub or leaf alone
+//(-DNRF_HUB=1 or 2) builds without a star network table
+#if NRF_HUB != 0
+#define EN_ACK_PAY			1
+#define EN_DPL				1
+#define DPL_P0				1
+#define DPL_P1				1
+#define DPL_P2				1
+#define DPL_P3				1
+#define DPL_P4				1
+#define DPL_P5				1
+#define ERX_P1				1
+#define ERX_P2				1
+#define ERX_P3				1
+#define ERX_P4				1
+#define ERX_P5				1
+#endif
+#if NRF_ROUTE == 1
+#define EN_DPL				1
+#define DPL_P0				1
+#define DPL_P1				1
+#define ERX_P1				1
+#endif
+#if NRF_STREAM == 1
+#define EN_DYN_ACK			1
+#endif
+#include "nrf24l01.h"
+
+/*************************BENCHMARK SETTINGS**********************************/
+
+#define NRF_BENCH_PACKETS	2000		//Payloads sent in every run
+#define NRF_BENCH_HUB_MS	2000		//Time star network is measured for, after leaves joined
+#define NRF_BENCH_JOIN_MS	30000		//Max time given to leaves to get in sync
+#define NRF_BENCH_HOPS		5			//Hops of longest route in routing table (nodes in a line, one more than hops)
+#define NRF_BENCH_ROUTE_MS	100			//Interval of payloads from every node to gateway and from gateway to every node
+#define NRF_BENCH_ROUTE_S	10			//Time routing network is measured for (s), after 1s to learn routes
+#define NRF_BENCH_BATCH		6			//Payloads handed to nrf_transmit_stream() at a time in streaming table
+
+/*Modes*/
+#define NRF_BENCH_NOACK		0			//auto ack disabled (one way)
+#define NRF_BENCH_ACK		1			//auto ack
+#define NRF_BENCH_ACKPAY	2			//auto ack with ACK Payload of same size as payload
+
+/*Data rates (RF_SETUP)*/
+#define NRF_BENCH_250K		0
+#define NRF_BENCH_1M		1
+#define NRF_BENCH_2M		2
+
+struct nrf_bench_run {
+	unsigned char mode, rate, size, ard, arc, stream;
+	double loss;
+	unsigned char adapt;				//1 = retransmit tuning on (NRF_RETR_ADAPT)
+	unsigned char hop;					//1 = frequency hopping (NRF_HOP)
+	unsigned char jam;					//WiFi channels jammed (0 to 3)
+	unsigned char rate_adapt;			//1 = data rate control on (NRF_RATE_ADAPT), rate is the starting rate
+	double rssi;						//received power (dBm, 0 = strong link)
+};
+
+struct nrf_bench_result {
+	unsigned long sent, delivered;
+	double seconds;
+	double pkt_s, goodput;
+	double p50_us, p99_us, max_us;
+	double spi_per_payload, busy_per_payload_us;
+	double air_per_payload;
+};
+
+/*************************************************************************************************
+* Description : Sets up radio 0 (driver) and radio 1 (sink) for a run. Registers are written
+*				after nrf24l01_init() so settings of nrf24l01.h are overridden
+* Parameters  : const struct nrf_bench_run *run = mode, data rate, payload size, ARD, ARC, loss
+**************************************************************************************************/
+void nrf_bench_setup(const struct nrf_bench_run *run);
+
+/*************************************************************************************************
+* Description : Sends NRF_BENCH_PACKETS payloads and measures the run
+* Parameters  : const struct nrf_bench_run *run = settings of run
+*				struct nrf_bench_result *res = measured results
+**************************************************************************************************/
+void nrf_bench_measure(const struct nrf_bench_run *run, struct nrf_bench_result *res);
+
+/*************************************************************************************************
+* Description : Runs all sweeps and prints one line per run
+* Returns     : int nrf_bench_suite = 0 if every lossless run delivered all payloads, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_suite(void);
+
+/*************************************************************************************************
+* Description : Times transfer of one W_TX_PAYLOAD over each SPI path at fosc/2, fosc/4 and
+*				fosc/16 and prints one line per path
+**************************************************************************************************/
+void nrf_bench_spi(void);
+
+/*************************************************************************************************
+* Description : Sends NRF_BENCH_PACKETS 32 byte payloads on each of 1 to NRF_RADIOS radios at once
+*				and prints aggregate throughput
+* Returns     : int nrf_bench_radios = 0 if every payload was delivered, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_radios(void);
+
+/*************************************************************************************************
+* Description : Sends a 4096 byte message in frames with nrf_frag_send() and with nrf_send() one
+*				frame at a time over loss rates and prints one line per run
+* Returns     : int nrf_bench_frag = 0 if nrf_frag_send() delivered every message intact, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_frag(void);
+
+/*************************************************************************************************
+* Description : Runs 8 to 32 leaves (nrf_leaf_send() on radios 1 to 32) around radio 0 as hub
+*				(nrf_hub_poll()) and as many radios sending at random times, and prints one line
+*				per run
+* Returns     : int nrf_bench_hub = 0 if leaves joined, kept cycle and slot of hub and hub
+*				delivered more than aloha, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_hub(void);
+
+/*************************************************************************************************
+* Description : Runs NRF_BENCH_HOPS + 1 nodes in a line (nrf_route_send()), each hearing only its
+*				neighbours and then also nodes 2 hops away, with payloads from every node to gateway
+*				at one end and back over loss rates, and prints delivery and latency per hop count
+* Returns     : int nrf_bench_route = 0 if lossless runs delivered 90% of payloads and no node took
+*				a payload meant for another node, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_route(void);
+
+/*************************************************************************************************
+* Description : Sends NRF_BENCH_PACKETS numbered payloads without ACK (nrf_stream_write()) and with
+*				auto ack (nrf_transmit_stream()) at each data rate and loss rate and prints one line
+*				per run
+* Returns     : int nrf_bench_stream = 0 if lossless runs received every payload, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_stream(void);
+
+/*************************************************************************************************
+* Description : Runs blocking calls against faults of link and radio and prints result and time of
+*				each, and time nrf_recover() takes to get a payload through again after a reset
+* Returns     : int nrf_bench_recover = 0 if every call gave expected result within its deadlines
+*				and radio was recovered, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_recover(void);
+
+/*************************************************************************************************
+* Description : Sends NRF_BENCH_PACKETS numbered payloads from a source at fixed intervals to radio
+*				0 listening and takes them from its queue in place with a fixed time of work on each,
+*				printing one line per interval and work time
+* Returns     : int nrf_bench_ring = 0 if every run received payloads and each payload sent was
+*				either received once or counted lost, 1 otherwise
+**************************************************************************************************/
+int nrf_bench_ring(void);
+
+/************************FUNCTION DEFINATIONS*********************************/
+
+static const char *nrf_bench_mode_name[3] = {"noack", "ack", "ackpay"};
+static const char *nrf_bench_rate_name[3] = {"250k", "1M", "2M"};
+static double nrf_bench_lat[NRF_BENCH_PACKETS];
+static unsigned long nrf_bench_ctrl;					//control frames delivered to sink (not counted as payloads)
+
+static int nrf_bench_cmp(const void *a, const void *b){
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+void nrf_bench_setup(const struct nrf_bench_run *run){
+	static const unsigned char rf_dr[3] = {(1<<5), 0, (1<<3)};
+	unsigned char reg[1];
+	nrf_sim_reset(2);
+	nrf_sim_rand_state = 0x12345678;						//same air for every build
+	nrf_sim_loss = 0.0;
+	nrf24l01_init();
+	reg[0] = (NRF_RF_SETUP & ~((1<<5)|(1<<3))) | rf_dr[run->rate];
+	write_nrf(RF_SETUP,reg,1);
+	reg[0] = (run->ard<<4) | run->arc;
+	write_nrf(SETUP_RETR,reg,1);
+	reg[0] = (run->mode == NRF_BENCH_NOACK) ? 0x00 : 0x3F;
+	write_nrf(EN_AA,reg,1);
+	reg[0] = (run->mode == NRF_BENCH_ACKPAY) ? ((1<<2)|(1<<1)) : 0x00;
+	write_nrf(FEATURE,reg,1);
+	reg[0] = (run->mode == NRF_BENCH_ACKPAY) ? 0x01 : 0x00;
+	write_nrf(DYNPD,reg,1);
+	reg[0] = run->hop ? run->size + NRF_HOP_HEAD : run->size;		//hop header
+	write_nrf(RX_PW_P0,reg,1);
+	nrf_config(1,0);
+	nrf_sim_clone(1,0);
+	nrf_sim_sink(1,(run->mode == NRF_BENCH_ACKPAY) ? run->size : 0);
+	nrf_sim_loss = run->loss;
+	nrf_bench_ctrl = 0;
+	if(run->rssi < 0) nrf_sim_rssi = run->rssi;
+	for(unsigned char w = 0; w < run->jam; w++){
+		for(unsigned char ch = 1 + 25 * w; ch <= 23 + 25 * w; ch++){
+			nrf_sim_noise[ch] = 0.9;						//WiFi 1, 6, 11 : 2412, 2437, 2462MHz
+		}
+	}
+	nrf_cur->nrf_retr_soft = NRF_SOFT_RETRIES;
+#if NRF_RETR_ADAPT == 1
+	nrf_cur->nrf_retr_auto = run->adapt;
+	nrf_cur->nrf_retr_n = nrf_cur->nrf_retr_fail = nrf_cur->nrf_retr_max = nrf_cur->nrf_retr_down = 0;
+	nrf_cur->nrf_retr_floor = (run->ard << 4) | run->arc;
+#endif
+#if NRF_RATE_ADAPT == 1
+	nrf_cur->nrf_rate_auto = run->rate_adapt;
+	nrf_cur->nrf_rate_next = 0xFF;
+	nrf_cur->nrf_rate_tried = 0;
+	nrf_cur->nrf_rate_hold = nrf_cur->nrf_rate_backoff = NRF_RATE_HOLD;
+	nrf_sim[1].follow = run->rate_adapt;				//sink switches along with PTX
+#endif
+#if NRF_HOP == 1
+	nrf_hop_stop();
+	if(run->hop){
+		nrf_hop_start(0x2402);
+		nrf_sim[1].follow = 1;
+	}
+#endif
+#if NRF_IRQ_MODE == 1
+	sei();
+#endif
+}
+
+static void nrf_bench_send(const struct nrf_bench_run *run, const unsigned char *data){
+	unsigned char ack[32], ack_size;
+#if NRF_RATE_ADAPT == 1
+	if(run->rate_adapt){
+		unsigned long delivered = nrf_sim[1].delivered;
+		nrf_rate_poll();
+		nrf_bench_ctrl += nrf_sim[1].delivered - delivered;
+	}
+#endif
+#if NRF_HOP == 1
+	if(run->hop){
+		nrf_hop_send(data,run->size);
+		return;
+	}
+#endif
+	nrf_send(data,run->size,ack,&ack_size);
+}
+
+void nrf_bench_measure(const struct nrf_bench_run *run, struct nrf_bench_result *res){
+	static unsigned char data[NRF_BENCH_PACKETS][32];
+	static unsigned char result[NRF_BENCH_PACKETS];
+	unsigned long spi0, air0, n = 0;
+	uint64_t t0, busy0, t;
+	for(unsigned long i = 0; i < NRF_BENCH_PACKETS; i++){
+		memset(data[i], (unsigned char)i, 32);
+	}
+	nrf_bench_setup(run);
+	t0 = nrf_sim_now;
+	busy0 = nrf_sim_busy;
+	spi0 = nrf_sim_spi_bytes;
+	air0 = nrf_sim[0].air_packets;
+	if(run->stream){
+		for(unsigned long i = 0; i < NRF_BENCH_PACKETS; i += 100){
+			nrf_transmit_stream(data[i],run->size,100,result);
+		}
+	}
+	else{
+		for(unsigned long i = 0; i < NRF_BENCH_PACKETS; i++){
+			t = nrf_sim_now;
+			nrf_bench_send(run,data[i]);
+			nrf_bench_lat[n++] = (nrf_sim_now - t) / 1000.0;
+		}
+	}
+	res->sent = NRF_BENCH_PACKETS;
+	res->delivered = nrf_sim[1].delivered - nrf_bench_ctrl;
+	res->seconds = (nrf_sim_now - t0) / 1e9;
+	res->pkt_s = res->delivered / res->seconds;
+	res->goodput = res->pkt_s * run->size;
+	res->spi_per_payload = res->delivered ? (double)(nrf_sim_spi_bytes - spi0) / res->delivered : 0;
+	res->busy_per_payload_us = res->delivered ? (nrf_sim_busy - busy0) / 1000.0 / res->delivered : 0;
+	res->air_per_payload = (double)(nrf_sim[0].air_packets - air0) / res->sent;
+	res->p50_us = res->p99_us = res->max_us = -1;
+	if(n){
+		qsort(nrf_bench_lat, n, sizeof(nrf_bench_lat[0]), nrf_bench_cmp);
+		res->p50_us = nrf_bench_lat[n / 2];
+		res->p99_us = nrf_bench_lat[(n * 99) / 100];
+		res->max_us = nrf_bench_lat[n - 1];
+	}
+}
+
+static void nrf_bench_print(const struct nrf_bench_run *run, const struct nrf_bench_result *res){
+	printf("%-6s %-4s %3u %5u %3u %4.2f %-6s %8.0f %9.0f ",
+		nrf_bench_mode_name[run->mode], nrf_bench_rate_name[run->rate], run->size,
+		(run->ard + 1) * 250, run->arc, run->loss, run->stream ? "stream" : run->adapt ? "adapt" : run->rate_adapt ? "rate" : run->hop ? "hop" : "send",
+		res->pkt_s, res->goodput);
+	if(res->p50_us < 0) printf("%7s %7s %7s ", "-", "-", "-");
+	else printf("%7.0f %7.0f %7.0f ", res->p50_us, res->p99_us, res->max_us);
+	printf("%6.1f %7.1f %6.2f %3u ", res->spi_per_payload, res->busy_per_payload_us, res->air_per_payload, run->jam);
+	if(run->rssi < 0) printf("%4.0f ", run->rssi);
+	else printf("%4s ", "-");
+	printf("%5lu/%lu\n", res->delivered, res->sent);
+}
+
+int nrf_bench_suite(){
+	static const unsigned char sizes[3] = {1, 16, 32};
+	static const unsigned char ards[5] = {0, 1, 3, 7, 15};
+	static const unsigned char arcs[3] = {0, 3, 15};
+	struct nrf_bench_run run;
+	struct nrf_bench_result res;
+	int fail = 0;
+	printf("%-6s %-4s %3s %5s %3s %4s %-6s %8s %9s %7s %7s %7s %6s %7s %6s %3s %4s %s\n",
+		"mode", "rate", "len", "ard", "arc", "loss", "api", "pkt/s", "goodput", "p50", "p99", "max", "spi/pl", "busy/pl", "air/pl", "jam", "rssi", "dlv");
+	//data rate and payload size for every mode (ARD 1500us covers 32 byte ACK Payload at 250kbps)
+	for(unsigned char mode = 0; mode < 3; mode++){
+		for(unsigned char rate = 0; rate < 3; rate++){
+			for(unsigned char s = 0; s < 3; s++){
+				run = (struct nrf_bench_run){.mode = mode, .rate = rate, .size = sizes[s], .ard = 5, .arc = 3};
+				nrf_bench_measure(&run, &res);
+				nrf_bench_print(&run, &res);
+				if(res.delivered != res.sent) fail = 1;
+			}
+		}
+	}
+	//retransmit settings on a lossy link
+	for(unsigned char a = 0; a < 5; a++){
+		for(unsigned char c = 0; c < 3; c++){
+			run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = NRF_BENCH_1M, .size = 32, .ard = ards[a], .arc = arcs[c], .loss = 0.1};
+			nrf_bench_measure(&run, &res);
+			nrf_bench_print(&run, &res);
+		}
+	}
+	//one payload at a time against stream
+	for(unsigned char rate = 0; rate < 3; rate++){
+		for(unsigned char stream = 0; stream < 2; stream++){
+			run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = rate, .size = 32, .ard = 5, .arc = 3, .stream = stream};
+			nrf_bench_measure(&run, &res);
+			nrf_bench_print(&run, &res);
+			if(res.delivered != res.sent) fail = 1;
+		}
+	}
+#if NRF_RETR_ADAPT == 1
+	//fixed ARD/ARC against retransmit tuning starting from them, over loss rates (1.0 = peer absent)
+	static const double losses[6] = {0.0, 0.1, 0.3, 0.5, 0.7, 1.0};
+	for(unsigned char l = 0; l < 6; l++){
+		unsigned long fixed = 0;
+		for(unsigned char adapt = 0; adapt < 2; adapt++){
+			run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = NRF_BENCH_1M, .size = 32, .ard = 5, .arc = 3, .loss = losses[l], .adapt = adapt};
+			nrf_bench_measure(&run, &res);
+			nrf_bench_print(&run, &res);
+			if(!adapt) fixed = res.delivered;
+			else if(res.delivered < fixed) fail = 1;			//tuning must not deliver less than settings it started from
+		}
+	}
+#endif
+#if NRF_HOP == 1
+	//one channel (2402MHz, inside WiFi channel 1) against hopping over channels NRF_HOP_FIRST to NRF_HOP_LAST
+	for(unsigned char jam = 0; jam < 4; jam++){
+		for(unsigned char hop = 0; hop < 2; hop++){
+			run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = NRF_BENCH_1M, .size = 29, .ard = 5, .arc = 3, .hop = hop, .jam = jam};
+			nrf_bench_measure(&run, &res);
+			nrf_bench_print(&run, &res);
+		}
+	}
+#endif
+#if NRF_RATE_ADAPT == 1
+	//each fixed data rate against data rate control starting at 2Mbps, as received power nears sensitivity
+	static const double rssis[6] = {-60, -78, -82, -86, -90, -94};
+	for(unsigned char p = 0; p < 6; p++){
+		for(unsigned char rate = 0; rate < 4; rate++){
+			run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = (rate < 3) ? rate : NRF_BENCH_2M, .size = 32, .ard = ARD, .arc = ARC,
+				.rate_adapt = (rate == 3), .rssi = rssis[p]};
+			nrf_bench_measure(&run, &res);
+			nrf_bench_print(&run, &res);
+		}
+	}
+#endif
+	return fail;
+}
+
+static uint64_t nrf_bench_spi_end;
+static void nrf_bench_spi_done(void){
+	nrf_bench_spi_end = nrf_sim_now;
+}
+
+void nrf_bench_spi(){
+	static const unsigned char divs[3] = {2, 4, 16};
+	static const char *paths[3] = {"byte", "bulk", "async"};
+	unsigned char buf[33];
+	printf("\n%-4s %-6s %6s %6s  %s\n", "sck", "path", "bus", "cpu", "(estimates, SPI_CYCLES_* of SPI.h)");
+	for(unsigned char d = 0; d < 3; d++){
+		for(unsigned char path = 0; path < ((SPI_Engine == 1) ? 3 : 2); path++){
+			uint64_t t0, busy0, bus = 0, cpu = 0;
+			nrf_sim_reset(1);
+			nrf24l01_init();
+			nrf_sim_spi_ns = 8 * divs[d] * 125;
+			nrf_sim_cpu_ns = 125;								//8MHz
+			sei();
+			for(unsigned char n = 0; n < 100; n++){
+				buf[0] = W_TX_PAYLOAD;
+				memset(buf + 1, n, 32);
+				t0 = nrf_sim_now;
+				busy0 = nrf_sim_busy;
+				CSN_low;
+				if(path == 0){
+					for(unsigned char i = 0; i < 33; i++) SPI_Read_Write(buf[i]);
+					nrf_bench_spi_end = nrf_sim_now;
+				}
+				else if(path == 1){
+					SPI_Transfer(buf,0,33);
+					nrf_bench_spi_end = nrf_sim_now;
+				}
+				else{
+					SPI_Transfer_Async(buf,0,33,nrf_bench_spi_done);
+					while(SPI_Busy) sleep_cpu();
+				}
+				cpu += nrf_sim_busy - busy0;
+				bus += nrf_bench_spi_end - t0;
+				CSN_high;
+				write_nrf(FLUSH_TX,buf,0);
+			}
+			printf("/%-3u %-6s %6llu %6llu\n", divs[d], paths[path],
+				(unsigned long long)(bus / 100 / 125), (unsigned long long)(cpu / 100 / 125));
+		}
+	}
+	nrf_sim_spi_ns = NRF_SIM_SPI_NS;
+	nrf_sim_cpu_ns = 0;
+	cli();
+}
+
+int nrf_bench_radios(){
+	static unsigned char data[32];
+	unsigned long sent[NRF_RADIOS], delivered;
+	unsigned char reg[1], busy;
+	uint64_t t0;
+	int fail = 0;
+	printf("\n%-6s %8s %9s %s\n", "radios", "pkt/s", "goodput", "dlv");
+	for(unsigned char n = 1; n <= NRF_RADIOS; n++){
+		nrf_sim_reset(2 * n);								//radios 0 to n-1 are driven, n to 2n-1 are their sinks
+		nrf_sim_rand_state = 0x12345678;
+		for(unsigned char i = 0; i < n; i++){
+			nrf_select(i);
+			nrf24l01_init();
+			reg[0] = 32;
+			write_nrf(RX_PW_P0,reg,1);
+			nrf_config(1,0);
+			nrf_sim_clone(n + i,i);
+			nrf_sim_sink(n + i,0);
+			sent[i] = 0;
+		}
+#if NRF_IRQ_MODE == 1
+		sei();
+#endif
+		t0 = nrf_sim_now;
+		do{
+			busy = 0;
+			for(unsigned char i = 0; i < n; i++){
+				nrf_select(i);
+				if(nrf_poll() == NRF_STATE_TX){
+					busy = 1;
+				}
+				else if(sent[i] < NRF_BENCH_PACKETS){
+					data[0] = (unsigned char)sent[i]++;
+					nrf_send_async(data,32);
+					busy = 1;
+				}
+			}
+			_delay_us(10);										//rest of main loop (lets Tpd2stby pass)
+		}while(busy);
+		delivered = 0;
+		for(unsigned char i = 0; i < n; i++) delivered += nrf_sim[n + i].delivered;
+		printf("%-6u %8.0f %9.0f %5lu/%lu\n", n, delivered / ((nrf_sim_now - t0) / 1e9),
+			32 * delivered / ((nrf_sim_now - t0) / 1e9), delivered, (unsigned long)n * NRF_BENCH_PACKETS);
+		if(delivered != (unsigned long)n * NRF_BENCH_PACKETS) fail = 1;
+	}
+	nrf_select(0);
+	return fail;
+}
+
+#if NRF_FRAG == 1
+#define NRF_BENCH_MSG		4096
+#define NRF_BENCH_FRAMES	((NRF_BENCH_MSG + NRF_FRAG_DATA - 1) / NRF_FRAG_DATA)
+static unsigned char nrf_bench_got[NRF_BENCH_MSG];
+static unsigned char nrf_bench_seen[NRF_BENCH_FRAMES];
+static unsigned int nrf_bench_dups;
+
+//frames taken by sink go to nrf_frag_rx() of driver, or straight in place by frame number for nrf_send()
+static void nrf_bench_frag_rx(unsigned char id, const unsigned char *data, unsigned char len){
+	(void)id;
+	nrf_frag_rx(data,len);
+}
+static void nrf_bench_send_rx(unsigned char id, const unsigned char *data, unsigned char len){
+	(void)id;
+	(void)len;
+	unsigned int k = data[0] | (data[1]<<8), at = k * NRF_FRAG_DATA;
+	if(k >= NRF_BENCH_FRAMES) return;
+	if(nrf_bench_seen[k]++) nrf_bench_dups++;
+	memcpy(nrf_bench_got + at, data + NRF_FRAG_HEAD, (k + 1 == NRF_BENCH_FRAMES) ? NRF_BENCH_MSG - at : NRF_FRAG_DATA);
+}
+
+//driver as PRX : frames come in on data pipe 0 (nrf_frag_listen()) and payloads of another source on data pipe 1. While no
+//message is awaited frames of pipe 0 stay in RX FIFO and pipe 1 waits behind them, once it is awaited again both get through
+static int nrf_bench_frag_held(void){
+	static const char *phases[2] = {"held", "listen"};
+	unsigned long taken0, taken1, sent1, frames0 = 0, payloads1 = 0;
+	unsigned char reg[1];
+	unsigned int size;
+	uint64_t until;
+	int fail = 0;
+	printf("\n%-6s %6s %6s %6s\n", "frag", "frames", "pipe1", "sent1");
+	nrf_sim_reset(3);
+	nrf_sim_rand_state = 0x12345678;
+	nrf_sim_loss = 0;
+	nrf24l01_init();
+	reg[0] = NRF_FRAG_SIZE;
+	write_nrf(RX_PW_P0,reg,1);
+	reg[0] = 32;
+	write_nrf(RX_PW_P1,reg,1);
+	reg[0] = 0x03;
+	write_nrf(EN_RXADDR,reg,1);
+	nrf_config(1,1);
+	nrf_sim_clone(1,0);
+	nrf_sim_clone(2,0);
+	memcpy(nrf_sim[2].addr[6], nrf_sim[0].addr[1], 5);		//second source sends to data pipe 1
+	memcpy(nrf_sim[2].addr[0], nrf_sim[0].addr[1], 5);
+	nrf_sim[2].reg[0x04] = 0x53;							//other ARD than first source, retransmits do not collide again
+	nrf_listen();
+	nrf_frag_listen(0,nrf_bench_got,sizeof(nrf_bench_got));
+	nrf_cur->nrf_frag_state = NRF_FRAG_DONE;				//message taken, next one not awaited yet
+	nrf_sim_source(1,NRF_FRAG_SIZE,4000000ull);
+	nrf_sim_source(2,32,7000000ull);
+#if NRF_IRQ_MODE == 1
+	sei();
+#endif
+	for(unsigned char phase = 0; phase < 2; phase++){
+		taken0 = nrf_cur->nrf_rx_count[0];
+		taken1 = nrf_cur->nrf_rx_count[1];
+		sent1 = nrf_sim[2].source_seq;
+		until = nrf_sim_now + 200000000ull;
+		while(nrf_sim_now < until){
+			if(phase && nrf_frag_recv(&size) != NRF_FRAG_WAIT){
+				nrf_frag_listen(0,nrf_bench_got,sizeof(nrf_bench_got));	//message taken, listen for next one
+			}
+#if NRF_IRQ_MODE == 0
+			nrf_listen_poll();
+#endif
+			_delay_us(10);
+		}
+		taken0 = nrf_cur->nrf_rx_count[0] - taken0;
+		taken1 = nrf_cur->nrf_rx_count[1] - taken1;
+		sent1 = nrf_sim[2].source_seq - sent1;
+		frames0 += taken0;
+		payloads1 += taken1;
+		printf("%-6s %6lu %6lu %6lu\n", phases[phase], taken0, taken1, sent1);
+		if(phase && (taken0 == 0 || taken1 == 0)) fail = 1;
+	}
+	//sources stop : every payload put in RX FIFO must have been taken
+	nrf_sim[1].source_len = nrf_sim[2].source_len = 0;
+	until = nrf_sim_now + 20000000ull;
+	while(nrf_sim_now < until){
+		if(nrf_frag_recv(&size) != NRF_FRAG_WAIT) nrf_frag_listen(0,nrf_bench_got,sizeof(nrf_bench_got));
+#if NRF_IRQ_MODE == 0
+		nrf_listen_poll();
+#endif
+		_delay_us(10);
+	}
+	cli();
+	if(nrf_cur->nrf_rx_count[0] + nrf_cur->nrf_rx_count[1] != nrf_sim[0].delivered) fail = 1;
+	nrf_listen_stop();
+	return fail;
+}
+
+int nrf_bench_frag(){
+	static const double losses[4] = {0.0, 0.1, 0.3, 0.5};
+	static unsigned char msg[NRF_BENCH_MSG];
+	unsigned char frame[32], ack_size, ok;
+	unsigned int size;
+	unsigned long air0;
+	uint64_t t0;
+	struct nrf_bench_run run;
+	struct nrf_frag_stats report;
+	int fail = 0;
+	printf("\n%-4s %-4s %7s %9s %6s %6s %5s %s\n", "loss", "api", "ms", "goodput", "air/fr", "resent", "dups", "ok");
+	for(unsigned char l = 0; l < 4; l++){
+		for(unsigned char frag = 0; frag < 2; frag++){
+			run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = NRF_BENCH_1M, .size = NRF_FRAG_SIZE, .ard = 5, .arc = 3, .loss = losses[l]};
+			nrf_bench_setup(&run);
+			for(unsigned int i = 0; i < NRF_BENCH_MSG; i++) msg[i] = nrf_sim_rand();
+			memset(nrf_bench_got, 0, sizeof(nrf_bench_got));
+			memset(nrf_bench_seen, 0, sizeof(nrf_bench_seen));
+			nrf_bench_dups = 0;
+			t0 = nrf_sim_now;
+			air0 = nrf_sim[0].air_packets;
+			if(frag){
+				nrf_sim_sink_hook = nrf_bench_frag_rx;
+				nrf_frag_listen(0,nrf_bench_got,sizeof(nrf_bench_got));
+				nrf_frag_send(msg,NRF_BENCH_MSG);
+				nrf_frag_report(&report);
+				nrf_bench_dups = report.dups;
+				ok = nrf_frag_recv(&size) == NRF_FRAG_DONE && size == NRF_BENCH_MSG && !memcmp(msg, nrf_bench_got, NRF_BENCH_MSG);
+				if(!ok) fail = 1;
+			}
+			else{
+				//stop and wait : frame number and NRF_FRAG_DATA bytes, sent again by nrf_send() after MAX_RT
+				nrf_sim_sink_hook = nrf_bench_send_rx;
+				for(unsigned int k = 0; k < NRF_BENCH_FRAMES; k++){
+					frame[0] = k;
+					frame[1] = k>>8;
+					memcpy(frame + NRF_FRAG_HEAD, msg + k * NRF_FRAG_DATA, (k + 1 == NRF_BENCH_FRAMES) ? NRF_BENCH_MSG - k * NRF_FRAG_DATA : NRF_FRAG_DATA);
+					nrf_send(frame,NRF_FRAG_SIZE,0,&ack_size);
+				}
+				ok = !memcmp(msg, nrf_bench_got, NRF_BENCH_MSG);
+			}
+			printf("%4.2f %-4s %7.1f %9.0f %6.2f ", losses[l], frag ? "frag" : "send",
+				(nrf_sim_now - t0) / 1e6, NRF_BENCH_MSG / ((nrf_sim_now - t0) / 1e9),
+				(double)(nrf_sim[0].air_packets - air0) / NRF_BENCH_FRAMES);
+			if(frag) printf("%6u ", report.resent);
+			else printf("%6s ", "-");
+			printf("%5u %s\n", nrf_bench_dups, ok ? "yes" : "no");
+		}
+	}
+	nrf_sim_sink_hook = 0;
+	fail |= nrf_bench_frag_held();
+	nrf_pipe_attach(0,0);								//later tables listen on data pipe 0
+	return fail;
+}
+#endif
+
+#if NRF_ROUTE == 1 || NRF_HUB == 3
+static struct nrf_radio nrf_bench_node_state[NRF_SIM_RADIOS];
+static struct nrf_radio nrf_bench_fresh;
+//power on state of a radio (NRF_RADIO(0)), taken before any table runs
+static void nrf_bench_boot(void) __attribute__((constructor));
+static void nrf_bench_boot(void){
+	nrf_bench_fresh = nrf_radios[0];
+}
+//every node runs on its own radio with its own driver state (route nodes take turns on one simulated CPU)
+static void nrf_bench_node(unsigned char k){
+	nrf_bench_node_state[nrf_sim_cur] = nrf_radios[0];
+	nrf_radios[0] = nrf_bench_node_state[k];
+	nrf_sim_cur = k;
+}
+#endif
+
+#if NRF_HUB == 3
+static unsigned long nrf_bench_hub_bytes, nrf_bench_leaf_sent;
+static unsigned long nrf_bench_leaf_cycle[NRF_SIM_RADIOS];		//per leaf, as left by nrf_leaf_send()
+static unsigned char nrf_bench_leaf_synced[NRF_SIM_RADIOS];
+static unsigned char nrf_bench_leaves;							//leaves on radios 1 to nrf_bench_leaves
+static ucontext_t nrf_bench_cpu[NRF_SIM_RADIOS], nrf_bench_sched;	//CPU of every node and scheduler of them
+static char nrf_bench_stack[NRF_SIM_RADIOS][1<<16];
+static uint64_t nrf_bench_wake[NRF_SIM_RADIOS];				//simulated time CPU of node is busy (in _delay_us()) till
+static uint32_t nrf_bench_leaf_seq[NRF_SIM_RADIOS];			//per leaf, sequence number of its next payload
+static uint32_t nrf_bench_hub_from[NRF_HUB_NODES];				//per node, first sequence number sent in measured time
+static uint32_t nrf_bench_hub_next[NRF_HUB_NODES];				//per node, sequence number after last payload counted
+//payload of leaf starts with its sequence number : one sent before measured time or sent again by nrf_leaf_send() when
+//ACK was lost is not counted
+static void nrf_bench_hub_rx(unsigned char node, const unsigned char *data, unsigned char size){
+	uint32_t seq;
+	if(node >= NRF_HUB_NODES || size < sizeof(seq)) return;
+	memcpy(&seq, data, sizeof(seq));
+	if(seq < nrf_bench_hub_from[node] || seq + 1 == nrf_bench_hub_next[node]) return;
+	nrf_bench_hub_next[node] = seq + 1;
+	nrf_bench_hub_bytes += size;
+}
+//node waits on its own CPU : scheduler runs the others meanwhile
+static void nrf_bench_wait(uint64_t until){
+	nrf_bench_wake[nrf_sim_cur] = until;
+	swapcontext(&nrf_bench_cpu[nrf_sim_cur],&nrf_bench_sched);
+}
+//main loop of hub (radio 0) and of every leaf, sending a payload when it is due
+static void nrf_bench_main(void){
+	unsigned char data[32] = {0}, request;
+	for(;;){
+		if(nrf_sim_cur == 0){
+			nrf_hub_poll();
+		}
+		else if(nrf_leaf_due()){
+			memcpy(data, &nrf_bench_leaf_seq[nrf_sim_cur], sizeof(nrf_bench_leaf_seq[0]));
+			nrf_bench_leaf_seq[nrf_sim_cur]++;
+			nrf_leaf_send(data,sizeof(data),&request);
+			nrf_bench_leaf_sent++;
+			nrf_bench_leaf_cycle[nrf_sim_cur] = nrf_cur->nrf_leaf_cycle;
+			nrf_bench_leaf_synced[nrf_sim_cur] = nrf_cur->nrf_leaf_synced;
+		}
+		_delay_us(20);
+	}
+}
+//starts main loop on CPU of hub and leaves
+static void nrf_bench_boot_cpus(void){
+	for(unsigned char i = 0; i <= nrf_bench_leaves; i++){
+		getcontext(&nrf_bench_cpu[i]);
+		nrf_bench_cpu[i].uc_stack.ss_sp = nrf_bench_stack[i];
+		nrf_bench_cpu[i].uc_stack.ss_size = sizeof(nrf_bench_stack[i]);
+		nrf_bench_cpu[i].uc_link = 0;
+		makecontext(&nrf_bench_cpu[i],nrf_bench_main,0);
+		nrf_bench_wake[i] = nrf_sim_now;
+	}
+}
+//runs every CPU till simulated time until, always the one waiting for the earliest time first
+static void nrf_bench_cpus_run(uint64_t until){
+	unsigned char k;
+	nrf_sim_delay_hook = nrf_bench_wait;
+	for(;;){
+		k = 0;
+		for(unsigned char i = 1; i <= nrf_bench_leaves; i++){
+			if(nrf_bench_wake[i] < nrf_bench_wake[k]) k = i;
+		}
+		if(nrf_bench_wake[k] >= until) break;
+		nrf_sim_run(nrf_bench_wake[k]);
+		nrf_bench_node(k);
+		swapcontext(&nrf_bench_sched,&nrf_bench_cpu[k]);
+	}
+	nrf_sim_delay_hook = 0;
+	nrf_sim_run(until);
+	nrf_bench_node(0);
+}
+//main loop of hub without leaves (aloha) till simulated time until
+static void nrf_bench_aloha_run(uint64_t until){
+	unsigned char data[32];
+	while(nrf_sim_now < until){
+		nrf_listen_poll();
+		while(nrf_rx_available()) nrf_bench_hub_bytes += nrf_rx_read(data);
+		_delay_us(20);
+	}
+}
+
+int nrf_bench_hub(){
+	static const unsigned char nodes[3] = {8, 16, 32};
+	unsigned char reg[1], node[NRF_SIM_RADIOS], n, synced, in_slot;
+	unsigned long sent, coll, air, bytes, cycle;
+	uint64_t t0, join;
+	double sec, dlv, aloha = 0;
+	int fail = 0;
+	printf("\n%-5s %-5s %6s %6s %9s %6s %6s %5s %4s\n", "nodes", "mode", "join", "pkt/s", "goodput", "coll/s", "air/pl", "dlv", "slot");
+	for(unsigned char k = 0; k < 3; k++){
+		n = nodes[k];
+		if(n > NRF_HUB_NODES || n >= NRF_SIM_RADIOS) continue;
+		for(unsigned char hub = 0; hub < 2; hub++){
+			nrf_sim_reset(n + 1);
+			nrf_sim_rand_state = 0x12345678;
+			nrf_bench_node(0);
+			nrf24l01_init();
+			reg[0] = 0x02;										//ARD 750us, ARC 2 (leaves too)
+			write_nrf(SETUP_RETR,reg,1);
+			nrf_config(1,1);
+			for(unsigned char i = 1; i <= n; i++){
+				if(hub){
+					nrf_bench_node_state[i] = nrf_bench_fresh;
+					nrf_bench_node(i);
+					nrf24l01_init();
+					write_nrf(SETUP_RETR,reg,1);
+					nrf_config(1,0);
+					nrf_leaf_start(0x10 + i);
+					nrf_bench_leaf_synced[i] = 0;
+					nrf_bench_leaf_seq[i] = 0;
+					nrf_bench_node(0);
+				}
+				else{
+					//address of data pipe 1 + i % 5, one payload per cycle
+					nrf_sim_clone(i,0);
+					memcpy(nrf_sim[i].addr[6], nrf_sim[0].addr[1], 5);
+					if(i % 5) nrf_sim[i].addr[6][0] = nrf_sim[0].reg[RX_ADDR_P1 + i % 5];
+					memcpy(nrf_sim[i].addr[0], nrf_sim[i].addr[6], 5);
+					nrf_sim_source(i,32,n * NRF_HUB_SLOT_US * 1000ull);
+				}
+			}
+			nrf_listen();
+			t0 = nrf_sim_now;
+			nrf_bench_leaves = hub ? n : 0;
+			if(hub){
+				nrf_hub_start();
+				for(unsigned char i = 1; i <= n; i++) node[i] = nrf_hub_add(0x10 + i);
+				memset(nrf_bench_hub_from, 0, sizeof(nrf_bench_hub_from));
+				memset(nrf_bench_hub_next, 0, sizeof(nrf_bench_hub_next));
+				nrf_hub_attach(nrf_bench_hub_rx);
+				nrf_bench_boot_cpus();
+				do{
+					nrf_bench_cpus_run(nrf_sim_now + 1000000ull);
+					synced = 0;
+					for(unsigned char i = 1; i <= n; i++) synced += nrf_bench_leaf_synced[i];
+				}while(synced < n && nrf_sim_now < t0 + NRF_BENCH_JOIN_MS * 1000000ull);
+				if(synced < n) fail = 1;
+			}
+			else{
+				nrf_bench_aloha_run(t0 + 1000000000ull);			//1s to fill air
+			}
+			join = nrf_sim_now - t0;
+			sent = coll = air = 0;
+			for(unsigned char i = 1; i <= n; i++){
+				sent -= nrf_sim[i].source_seq;
+				coll -= nrf_sim[i].collisions;
+				air -= nrf_sim[i].air_packets;
+			}
+			sent -= nrf_bench_leaf_sent;
+			for(unsigned char i = 1; i <= n && hub; i++) nrf_bench_hub_from[node[i]] = nrf_bench_leaf_seq[i];
+			bytes = nrf_bench_hub_bytes;
+			t0 = nrf_sim_now;
+			if(hub) nrf_bench_cpus_run(t0 + NRF_BENCH_HUB_MS * 1000000ull);
+			else nrf_bench_aloha_run(t0 + NRF_BENCH_HUB_MS * 1000000ull);
+			for(unsigned char i = 1; i <= n; i++){
+				sent += nrf_sim[i].source_seq;
+				coll += nrf_sim[i].collisions;
+				air += nrf_sim[i].air_packets;
+			}
+			sent += nrf_bench_leaf_sent;
+			bytes = nrf_bench_hub_bytes - bytes;
+			sec = (nrf_sim_now - t0) / 1e9;
+			dlv = sent ? (double)(bytes / 32) / sent : 0;
+			printf("%-5u %-5s ", n, hub ? "hub" : "aloha");
+			if(hub) printf("%6.0f ", join / 1e6);
+			else printf("%6s ", "-");
+			printf("%6.0f %9.0f %6.0f %6.2f %5.3f ", bytes / 32 / sec, bytes / sec, coll / sec, bytes ? air * 32.0 / bytes : 0, dlv);
+			if(hub){
+				//every leaf on cycle of hub, which expects its next payload within a quarter slot of its point in slot
+				cycle = (unsigned long)nrf_cur->nrf_hub_count * NRF_HUB_SLOT_US;
+				in_slot = 0;
+				for(unsigned char i = 1; i <= n; i++){
+					in_slot += nrf_bench_leaf_synced[i] && nrf_bench_leaf_cycle[i] == cycle &&
+						abs(nrf_cur->nrf_hub_pred[node[i]]) <= (int)(NRF_HUB_SLOT_US / 4 / NRF_HUB_TICK_US);
+				}
+				printf("%4u\n", in_slot);
+				if(in_slot < n || dlv <= aloha) fail = 1;
+			}
+			else{
+				printf("%4s\n", "-");
+				aloha = dlv;
+			}
+		}
+	}
+	nrf_hub_attach(0);
+	return fail;
+}
+#endif
+
+#if NRF_ROUTE == 1
+#define NRF_BENCH_NODES		(NRF_BENCH_HOPS + 1)
+static unsigned long nrf_bench_route_sent[2][NRF_BENCH_NODES];		//per direction (0 = to gateway) and hops
+static unsigned long nrf_bench_route_got[2][NRF_BENCH_NODES];
+static double nrf_bench_route_sum[2][NRF_BENCH_NODES], nrf_bench_route_max[2][NRF_BENCH_NODES];
+static uint64_t nrf_bench_route_start;							//payloads sent from then on are counted
+//payload carries nrf_sim_now when it was sent. Node k has address k + 1 and is k hops from gateway
+static void nrf_bench_route_rx(unsigned char src, const unsigned char *data, unsigned char size, unsigned char hops){
+	uint64_t sent;
+	double ms;
+	unsigned char dir = (nrf_cur->nrf_route_addr != 1), k = dir ? nrf_cur->nrf_route_addr - 1 : src - 1;
+	(void)hops;
+	if(size != sizeof(sent) || k >= NRF_BENCH_NODES) return;
+	memcpy(&sent, data, sizeof(sent));
+	if(sent < nrf_bench_route_start) return;
+	ms = (nrf_sim_now - sent) / 1e6;
+	nrf_bench_route_got[dir][k]++;
+	nrf_bench_route_sum[dir][k] += ms;
+	if(ms > nrf_bench_route_max[dir][k]) nrf_bench_route_max[dir][k] = ms;
+}
+
+int nrf_bench_route(){
+	static const double losses[3] = {0.0, 0.1, 0.3};
+	struct nrf_route_stats stats;
+	unsigned long dups, full, lost, stray;
+	uint64_t next[NRF_BENCH_NODES], start, end;
+	unsigned char k, dir, to = 1;
+	int fail = 0;
+	printf("\n%-5s %-5s %-4s %-4s %6s %6s %6s %7s %7s %5s %5s %5s %5s\n", "reach", "loss", "hops", "dir", "sent", "got", "dlv", "avg ms", "max ms", "dups", "full", "lost", "stray");
+	for(unsigned char reach = 1; reach <= 2; reach++)
+	for(unsigned char l = 0; l < 3; l++){
+		nrf_sim_reset(NRF_BENCH_NODES);
+		nrf_sim_rand_state = 0x12345678;
+		for(k = 0; k < NRF_BENCH_NODES; k++){
+			nrf_bench_node_state[k] = nrf_bench_fresh;
+			for(unsigned char j = k + 1 + reach; j < NRF_BENCH_NODES; j++) nrf_sim_link(k,j,0);
+		}
+		for(k = 0; k < NRF_BENCH_NODES; k++){
+			nrf_bench_node(k);
+			nrf24l01_init();
+			nrf_route_start(k + 1);
+			if(k) nrf_route_set(NRF_ROUTE_DEFAULT,k);			//towards gateway, routes back are learned
+			nrf_route_attach(nrf_bench_route_rx);
+			nrf_route_report(0,1);
+			nrf_config(1,1);
+			nrf_listen();
+			next[k] = nrf_sim_now + nrf_sim_rand() % (NRF_BENCH_ROUTE_MS * 1000000ull);
+		}
+		nrf_sim_loss = losses[l];
+		memset(nrf_bench_route_sent, 0, sizeof(nrf_bench_route_sent));
+		memset(nrf_bench_route_got, 0, sizeof(nrf_bench_route_got));
+		memset(nrf_bench_route_sum, 0, sizeof(nrf_bench_route_sum));
+		memset(nrf_bench_route_max, 0, sizeof(nrf_bench_route_max));
+		start = nrf_bench_route_start = nrf_sim_now + 1000000000ull;
+		end = start + NRF_BENCH_ROUTE_S * 1000000000ull;
+		while(nrf_sim_now < end + 1000000000ull){				//1s more for payloads on their way
+			for(k = 0; k < NRF_BENCH_NODES; k++){
+				nrf_bench_node(k);
+				nrf_route_poll();
+				if(nrf_sim_now < next[k] || nrf_sim_now >= end) continue;
+				//node to gateway, gateway to nodes in turn (NRF_BENCH_HOPS payloads per interval)
+				next[k] += NRF_BENCH_ROUTE_MS * 1000000ull / (k ? 1 : NRF_BENCH_HOPS);
+				if(k) dir = 0;
+				else{
+					dir = 1;
+					to = (to % NRF_BENCH_HOPS) + 1;
+				}
+				if(nrf_sim_now >= start) nrf_bench_route_sent[dir][dir ? to : k]++;
+				nrf_route_send(dir ? to + 1 : 1,(const unsigned char *)&nrf_sim_now,sizeof(nrf_sim_now));
+			}
+			_delay_us(20);
+		}
+		dups = full = lost = stray = 0;
+		for(k = 0; k < NRF_BENCH_NODES; k++){
+			nrf_bench_node(k);
+			nrf_route_report(&stats,0);
+			dups += stats.dups;
+			full += stats.full;
+			lost += stats.lost;
+			stray += nrf_cur->nrf_rx_count[0];
+		}
+		if(stray) fail = 1;
+		nrf_bench_node(0);
+		for(unsigned char h = 1; h < NRF_BENCH_NODES; h++){
+			for(dir = 0; dir < 2; dir++){
+				unsigned long sent = nrf_bench_route_sent[dir][h], got = nrf_bench_route_got[dir][h];
+				printf("%-5u %-5.2f %-4u %-4s %6lu %6lu %6.3f %7.2f %7.2f", reach, losses[l], h, dir ? "down" : "up", sent, got,
+					sent ? (double)got / sent : 0, got ? nrf_bench_route_sum[dir][h] / got : 0, nrf_bench_route_max[dir][h]);
+				if(h == 1 && !dir) printf(" %5lu %5lu %5lu %5lu\n", dups, full, lost, stray);
+				else printf("\n");
+				if(losses[l] == 0.0 && got * 10 < sent * 9) fail = 1;
+			}
+		}
+	}
+	nrf_sim_loss = 0.0;
+	return fail;
+}
+#endif
+
+#if NRF_STREAM == 1
+//payloads taken by sink go to nrf_stream_rx() of driver
+static void nrf_bench_stream_rx(unsigned char id, const unsigned char *data, unsigned char len){
+	(void)id;
+	nrf_stream_rx(data,len);
+}
+
+int nrf_bench_stream(){
+	static const unsigned char rates[3] = {NRF_BENCH_250K, NRF_BENCH_1M, NRF_BENCH_2M};
+	static const double losses[2] = {0.0, 0.05};
+	static unsigned char frames[NRF_BENCH_BATCH][32];
+	unsigned char data[NRF_STREAM_DATA], reg[1], n;
+	unsigned int seq, first = 0x10000ul - NRF_BENCH_PACKETS / 2;	//sequence numbers wrap half way through every run
+	unsigned long air0;
+	uint64_t t0, spi_ns = nrf_sim_spi_ns;
+	struct nrf_bench_run run;
+	struct nrf_stream_stats report;
+	double sec;
+	int fail = 0;
+	printf("\n%-4s %-4s %-5s %6s %9s %6s %5s %5s %6s %5s %5s\n", "rate", "loss", "api", "pkt/s", "goodput", "air/pl", "lost", "gaps", "loss%", "int", "jit");
+	nrf_sim_spi_ns = 2000;									//fosc/2
+	for(unsigned char r = 0; r < 3; r++){
+		for(unsigned char l = 0; l < 2; l++){
+			for(unsigned char noack = 0; noack < 2; noack++){
+				run = (struct nrf_bench_run){.mode = NRF_BENCH_ACK, .rate = rates[r], .size = 32, .ard = (rates[r] == NRF_BENCH_250K), .arc = 3, .loss = losses[l]};
+				nrf_bench_setup(&run);
+				reg[0] = nrf_shadow_get(FEATURE) | 1;			//EN_DYN_ACK
+				write_nrf(FEATURE,reg,1);
+				nrf_sim_sink_hook = nrf_bench_stream_rx;
+				nrf_stream_report(0,1);
+				t0 = nrf_sim_now;
+				air0 = nrf_sim[0].air_packets;
+				if(noack){
+					nrf_cur->nrf_stream_tx_seq = first;
+					nrf_stream_begin();
+					for(seq = 0; seq < NRF_BENCH_PACKETS; seq++){
+						memset(data, seq, sizeof(data));
+						while(!nrf_stream_write(data,sizeof(data)));
+					}
+					nrf_stream_end();
+				}
+				else{
+					for(seq = 0; seq < NRF_BENCH_PACKETS; seq += n){
+						n = (NRF_BENCH_PACKETS - seq < NRF_BENCH_BATCH) ? NRF_BENCH_PACKETS - seq : NRF_BENCH_BATCH;
+						for(unsigned char i = 0; i < n; i++){
+							frames[i][0] = first + seq + i;
+							frames[i][1] = (first + seq + i) >> 8;
+							memset(frames[i] + NRF_STREAM_HEAD, seq + i, NRF_STREAM_DATA);
+						}
+						nrf_transmit_stream(frames[0],32,n,0);
+					}
+				}
+				sec = (nrf_sim_now - t0) / 1e9;
+				nrf_stream_report(&report,0);
+				printf("%-4s %4.2f %-5s %6.0f %9.0f %6.2f %5lu %5lu %6.2f %5lu %5lu\n", nrf_bench_rate_name[rates[r]], losses[l],
+					noack ? "noack" : "ack", report.received / sec, report.received * NRF_STREAM_DATA / sec,
+					(double)(nrf_sim[0].air_packets - air0) / NRF_BENCH_PACKETS, report.lost, report.gaps,
+					report.loss_ppm / 1e4, report.interval_us, report.jitter_us);
+				if(losses[l] == 0.0 && report.received != NRF_BENCH_PACKETS) fail = 1;
+			}
+		}
+	}
+	nrf_sim_spi_ns = spi_ns;
+	nrf_sim_sink_hook = 0;
+	return fail;
+}
+#endif
+
+static const char *nrf_bench_result_name[5] = {"failed", "sent", "ackpay", "timeout", "nochip"};
+
+/*Times one nrf_send() of a 32 byte payload (ms), returns its result*/
+static unsigned char nrf_bench_try(double *ms){
+	unsigned char data[32] = {0}, ack[32], ack_size, result;
+	uint64_t t0 = nrf_sim_now;
+	result = nrf_send(data,32,ack,&ack_size);
+	*ms = (nrf_sim_now - t0) / 1e6;
+	return result;
+}
+
+int nrf_bench_recover(){
+	static const char *cases[6] = {"peer", "no peer", "brownout", "por", "unplugged", "recv"};
+	//results expected (bit n = result n). With NRF_IRQ_MODE 1 power on reset is over by end of deadline, nrf is set up again
+	static const unsigned char expect[6] = {1<<NRF_TX_SENT, 1<<NRF_TX_FAILED, 1<<NRF_TIMEOUT, (1<<NRF_NO_CHIP)|(1<<NRF_TIMEOUT), 1<<NRF_NO_CHIP, 1<<NRF_TIMEOUT};
+	struct nrf_bench_run run = {.mode = NRF_BENCH_ACK, .rate = NRF_BENCH_2M, .size = 32, .ard = 1, .arc = 3};
+	unsigned char data[32], result;
+	unsigned int tries;
+	uint64_t t0;
+	double ms, again, back;
+	double bound = (NRF_SOFT_RETRIES + 1) * (NRF_TX_DEADLINE_US / 1000.0);	//ms
+	int fail = 0;
+	printf("\n%-9s %-7s %8s %5s %8s\n", "case", "result", "ms", "tries", "back ms");
+	for(unsigned char c = 0; c < 6; c++){
+		nrf_bench_setup(&run);
+		if(c == 1) nrf_sim_link(0,1,0);
+		if(c == 2) nrf_sim_brownout(0,0);
+		if(c == 3) nrf_sim_brownout(0,100000000ull);
+		if(c == 4) nrf_sim_brownout(0,UINT64_MAX);
+		if(c == 5){
+			nrf_config(1,1);
+			nrf_cur->nrf_deadline_rx = 50000;
+			t0 = nrf_sim_now;
+			nrf_recv(data,sizeof(data));
+			ms = (nrf_sim_now - t0) / 1e6;
+			result = nrf_cur->nrf_result;
+			nrf_cur->nrf_deadline_rx = NRF_RX_DEADLINE_US;
+			if(ms > 50.0 + bound) fail = 1;
+		}
+		else{
+			result = nrf_bench_try(&ms);
+			if(ms > bound) fail = 1;
+		}
+		if(!(expect[c] & (1<<result))) fail = 1;
+		printf("%-9s %-7s %8.2f", cases[c], nrf_bench_result_name[result], ms);
+		if(c != 2 && c != 3){
+			printf(" %5s %8s\n", "-", "-");
+			continue;
+		}
+		//application retries every 10ms, nrf_recover() tells when nrf answers again
+		t0 = nrf_sim_now;
+		for(tries = 1; nrf_sim_now - t0 < 1000000000ull; tries++){
+			if(nrf_recover() && nrf_bench_try(&again) == NRF_TX_SENT) break;
+			_delay_ms(10);
+		}
+		back = (nrf_sim_now - t0) / 1e6;
+		printf(" %5u %8.2f\n", tries, back);
+		if(back >= 1000.0) fail = 1;
+	}
+	memset(data, 0, sizeof(data));
+#if NRF_HOP == 1
+	//unplugged nrf while hopping : returned at once, no channel of sequence is blacklisted
+	run.hop = 1;
+	nrf_bench_setup(&run);
+	nrf_sim_brownout(0,UINT64_MAX);
+	t0 = nrf_sim_now;
+	result = nrf_hop_send(data,sizeof(data));
+	ms = (nrf_sim_now - t0) / 1e6;
+	printf("%-9s %-7s %8.2f %5s %8s\n", "hop", nrf_bench_result_name[result], ms, "-", "-");
+	if(result != NRF_NO_CHIP || nrf_cur->nrf_hop_black || ms > bound) fail = 1;
+	nrf_hop_stop();
+	run.hop = 0;
+#endif
+#if NRF_ROUTE == 1
+	//unplugged nrf on a learned route : route is dropped
+	nrf_bench_setup(&run);
+	nrf_route_start(1);
+	nrf_cur->nrf_route_next[2] = 2;
+	nrf_cur->nrf_route_hops[2] = 1;
+	nrf_sim_brownout(0,UINT64_MAX);
+	t0 = nrf_sim_now;
+	result = nrf_route_send(2,data,sizeof(data));
+	ms = (nrf_sim_now - t0) / 1e6;
+	printf("%-9s %-7s %8.2f %5s %8s\n", "route", nrf_bench_result_name[result], ms, "-", "-");
+	if(result != NRF_NO_CHIP || nrf_cur->nrf_route_hops[2] != NRF_ROUTE_NONE || ms > bound) fail = 1;
+	nrf_pipe_attach(1,0);
+#endif
+	cli();
+	return fail;
+}
+
+int nrf_bench_ring(){
+	static const unsigned int every[3] = {2000, 1000, 700};
+	static const unsigned int works[3] = {0, 300, 1000};
+	static unsigned char seen[NRF_BENCH_PACKETS];
+	const struct nrf_rx_slot *slot;
+	unsigned char reg[1];
+	unsigned long recv, lost;
+	uint32_t seq;
+	int fail = 0;
+	printf("\n%-5s %5s %5s %5s %5s %7s %7s %7s\n", "every", "work", "recv", "full", "lost", "p50", "p99", "max");
+	for(unsigned char e = 0; e < 3; e++){
+		for(unsigned char w = 0; w < 3; w++){
+			nrf_sim_reset(2);
+			nrf_sim_rand_state = 0x12345678;
+			nrf24l01_init();
+			reg[0] = 32;
+			write_nrf(RX_PW_P0,reg,1);
+			nrf_config(1,1);
+			nrf_sim_clone(1,0);
+			nrf_listen();
+			nrf_cur->nrf_rx_dropped[0] = 0;
+			nrf_sim_source(1,32,every[e] * 1000ull);
+#if NRF_IRQ_MODE == 1
+			sei();
+#endif
+			memset(seen, 0, sizeof(seen));
+			recv = 0;
+			while(nrf_sim[1].source_seq < NRF_BENCH_PACKETS || nrf_sim[1].tx_n || nrf_rx_available()){
+				if(nrf_sim[1].source_seq >= NRF_BENCH_PACKETS) nrf_sim[1].source_len = 0;
+#if NRF_IRQ_MODE == 0
+				nrf_listen_poll();
+#endif
+				if((slot = nrf_rx_peek()) != 0){
+					memcpy(&seq, slot->data, sizeof(seq));
+					if(seq < NRF_BENCH_PACKETS){				//source may get one more out before it is stopped
+						seen[seq] = 1;
+						nrf_bench_lat[recv++] = NRF_CLOCK_US() - slot->time;
+					}
+					_delay_us(works[w]);					//payload used in place
+					nrf_rx_release(slot);
+				}
+				else{
+					_delay_us(10);
+				}
+			}
+			lost = 0;
+			for(unsigned int i = 0; i < NRF_BENCH_PACKETS; i++) lost += !seen[i];
+			qsort(nrf_bench_lat, recv, sizeof(nrf_bench_lat[0]), nrf_bench_cmp);
+			printf("%-5u %5u %5lu %5lu %5lu %7.0f %7.0f %7.0f\n", every[e], works[w], recv, nrf_cur->nrf_rx_dropped[0],
+				lost, recv ? nrf_bench_lat[recv / 2] : 0, recv ? nrf_bench_lat[(recv * 99) / 100] : 0, recv ? nrf_bench_lat[recv - 1] : 0);
+			if(recv == 0 || recv + lost != NRF_BENCH_PACKETS) fail = 1;
+		}
+	}
+	cli();
+	return fail;
+}
+
+#ifdef NRF_BENCH_MAIN
+int main(void){
+	int fail = nrf_bench_suite();
+	nrf_bench_spi();
+#if NRF_RADIOS > 1
+	fail |= nrf_bench_radios();
+#endif
+#if NRF_FRAG == 1
+	fail |= nrf_bench_frag();
+#endif
+#if NRF_HUB == 3
+	fail |= nrf_bench_hub();
+#endif
+#if NRF_ROUTE == 1
+	fail |= nrf_bench_route();
+#endif
+#if NRF_STREAM == 1
+	fail |= nrf_bench_stream();
+#endif
+	fail |= nrf_bench_recover();
+	fail |= nrf_bench_ring();
+	return fail;
+}
+#endif
+
+#endif /* NRF_BENCH_H_ */
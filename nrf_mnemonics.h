@@ -62,18 +62,63 @@
 #define DYNPD					0x1C
 #define FEATURE					0x1D
 
-/***************************DO NOT MODIFY THESE***************************************/
-
-#define DDR_high				Cont_DDR |= ((1<<CE) | (1<<CSN))	//CE and CSN as output
-#define DDR_low					Cont_DDR &= ~(1<<IRQ)			//IRQ as Input (comment it out if you want to use IRQ)
+/*STATUS register bits*/
+#define RX_DR					6			//Data ready in RX FIFO
+#define TX_DS					5			//Data sent from TX FIFO
+#define MAX_RT					4			//Maximum number of retransmits reached
+#define RX_P_NO					1			//Data pipe number of payload at top of RX FIFO (3 bits)
+#define TX_FULL					0			//TX FIFO full
+
+/*FIFO_STATUS register bits*/
+#define TX_REUSE				6			//Reusing last transmitted payload (REUSE_TX_PL)
+#define FIFO_FULL				5			//TX FIFO full
+#define TX_EMPTY				4			//TX FIFO empty
+#define RX_FULL					1			//RX FIFO full
+#define RX_EMPTY				0			//RX FIFO empty
 
-#define CE_low					Cont_Pull &= ~(1<<CE)				//disables transmission
-#define CE_high					Cont_Pull |= (1<<CE)				//enables transmission
-
-#define CSN_low					Cont_Pull &= ~(1<<CSN)				//enables communication with nrf
-#define CSN_high				Cont_Pull |= (1<<CSN)				//disables communication with nrf
+/***************************DO NOT MODIFY THESE***************************************/
 
-#define IRQ_low					Cont_Pull &= ~(1<<IRQ)
+//pin sets of radios : DDR and PORT of CE and CSN, CE, CSN (IRQ sets : DDR and PORT of IRQ, IRQ). A pin set is passed whole
+//as a macro argument, so an operation on it is a single sbi/cbi fixed at compile time
+#define NRF_PINS_0				Cont_DDR, Cont_Pull, CE, CSN
+#define NRF_PINS_1				Cont_DDR_1, Cont_Pull_1, CE_1, CSN_1
+#define NRF_PINS_2				Cont_DDR_2, Cont_Pull_2, CE_2, CSN_2
+#define NRF_IRQ_PINS_0			Irq_DDR, Irq_Pull, IRQ
+#define NRF_IRQ_PINS_1			Irq_DDR, Irq_Pull, IRQ_1				//third radio has no IRQ line
+
+#define NRF_OUT_(ddr, port, ce, csn)		ddr |= ((1<<ce) | (1<<csn))
+#define NRF_CE_LOW_(ddr, port, ce, csn)		port &= ~(1<<ce)
+#define NRF_CE_HIGH_(ddr, port, ce, csn)	port |= (1<<ce)
+#define NRF_CSN_LOW_(ddr, port, ce, csn)	port &= ~(1<<csn)
+#define NRF_CSN_HIGH_(ddr, port, ce, csn)	port |= (1<<csn)
+#define NRF_IRQ_IN_(ddr, port, irq)			ddr &= ~(1<<irq)
+#define NRF_IRQ_FLOAT_(ddr, port, irq)		port &= ~(1<<irq)
+#define NRF_ON_PINS(op, pins)	op(pins)									//expands pin set before op takes it apart
+
+//operation on lines of radio NRF_ID. With one radio NRF_ID is constant 0 and only pin set 0 is compiled. With more radios
+//nrf_select() picks radio at run time, so each use picks one of the fixed pin sets by NRF_ID (one compare with 2 radios, two with 3)
+#define NRF_PIN(op)				do{ if(NRF_ID == 0){ NRF_ON_PINS(op, NRF_PINS_0); } else if(NRF_RADIOS == 2 || NRF_ID == 1){ NRF_ON_PINS(op, NRF_PINS_1); } \
+									else{ NRF_ON_PINS(op, NRF_PINS_2); } }while(0)
+#define NRF_IRQ_PIN(op)			do{ if(NRF_ID == 0){ NRF_ON_PINS(op, NRF_IRQ_PINS_0); } else if(NRF_ID == 1){ NRF_ON_PINS(op, NRF_IRQ_PINS_1); } }while(0)
+
+#define DDR_high				NRF_PIN(NRF_OUT_)			//CE and CSN as output
+#define DDR_low					NRF_IRQ_PIN(NRF_IRQ_IN_)	//IRQ as Input
+
+#ifndef NRF_SIM
+#define CE_low					NRF_PIN(NRF_CE_LOW_)		//disables transmission
+#define CE_high					NRF_PIN(NRF_CE_HIGH_)		//enables transmission
+
+#define CSN_low					NRF_PIN(NRF_CSN_LOW_)		//enables communication with nrf
+#define CSN_high				NRF_PIN(NRF_CSN_HIGH_)		//disables communication with nrf
+#else
+#define CE_low					nrf_sim_ce(nrf_sim_cur + NRF_ID,0)			//simulated radio (nrf_sim.h)
+#define CE_high					nrf_sim_ce(nrf_sim_cur + NRF_ID,1)
+
+#define CSN_low					nrf_sim_csn(nrf_sim_cur + NRF_ID,0)
+#define CSN_high				nrf_sim_csn(nrf_sim_cur + NRF_ID,1)
+#endif
+
+#define IRQ_low					NRF_IRQ_PIN(NRF_IRQ_FLOAT_)
 /************************************************************************************/
 
 #endif /* NRF_MNEMONICS_H_ */
\ No newline at end of file
@@ -0,0 +1,914 @@
+/*
+ * nrf_sim.h
+ *
+ * Host (Linux) model of nrf24l01+ used in place of <avr/io.h> when NRF_SIM is defined.
+ * Models register file, 3 deep TX/RX FIFOs, Enhanced ShockBurst auto ack and
+ * retransmission (ARD/ARC) and a shared air medium connecting several radios,
+ * all running on a simulated clock.
+ *
+ * Driver code runs unmodified : SPI_Read_Write(), CE_low/CE_high and CSN_low/CSN_high
+ * are routed to radio nrf_sim_cur, _delay_us()/_delay_ms() advance simulated time and
+ * sleep_cpu() skips to next radio event. IRQ of radio nrf_sim_cur calls INT0_vect when
+ * interrupts are enabled (NRF_IRQ_MODE 1). A byte written to SPDR (SPI_Engine 1) is
+ * clocked in background and SPIF calls SPI_STC_vect if SPIE is set. nrf_sim_cpu_ns times
+ * the estimated CPU cycles of SPI.h loops and interrupts (0 = bytes back to back).
+ *
+ * Build : gcc -DNRF_SIM main.c   (main.c includes "nrf24l01.h" as usual)
+ *
+ * main.c sets up the air with nrf_sim_reset(radios), configures radio 0 with the driver
+ * (nrf24l01_init(), nrf_config()) and turns other radios into peers with nrf_sim_clone()
+ * and nrf_sim_sink(), nrf_sim_source() or nrf_sim_leaf(). nrf_sim_now, nrf_sim_busy, nrf_sim_idle and
+ * counters of struct nrf_sim_radio give timing and throughput, nrf_sim_sink_hook sees
+ * payloads taken by sinks. nrf_sim_delay_hook lets a program with several driver states (one per
+ * radio, each on its own CPU) run the others while one waits. nrf_sim_loss,
+ * nrf_sim_noise[channel] (foreign carrier, also seen by RPD) and nrf_sim_rssi (weak
+ * signal, lossier at higher data rates) make the air lossy. nrf_sim_link() puts radios out of
+ * range of each other (multi-hop topologies), a packet is then lost only at receivers hearing
+ * another radio on air with it. nrf_sim_brownout() resets a radio in the middle of a run
+ * (supply dip or module unplugged).
+ */
+
+#ifndef NRF_SIM_H_
+#define NRF_SIM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*************************SIMULATION SETTINGS*********************************/
+
+#ifndef NRF_SIM_RADIOS
+#define NRF_SIM_RADIOS		8				//Number of simulated radios sharing the air
+#endif
+#ifndef NRF_SIM_SPI_NS
+#define NRF_SIM_SPI_NS		16000ull		//Time of one SPI byte (fosc/16 at 8MHz)
+#endif
+
+#define NRF_SIM_TPD2STBY	1500000ull		//Power down to standby (ns)
+#define NRF_SIM_TSTBY2A		130000ull		//Standby to TX/RX settling (ns)
+
+/*************************AVR STAND-INS**************************************/
+
+volatile unsigned char DDRB, PORTB, PINB, DDRC, PORTC, PINC, DDRD, PORTD, PIND;
+volatile unsigned char SPCR, SPSR, SPDR, GICR, MCUCR, SREG;
+#define SREG_I	7
+
+#define PINB0	0
+#define PINB1	1
+#define PINB2	2
+#define PINB3	3
+#define PINB4	4
+#define PINB5	5
+#define PINC0	0
+#define PINC1	1
+#define PINC2	2
+#define PINC3	3
+#define PIND2	2
+#define PIND3	3
+#define SPIE	7
+#define SPE		6
+#define DORD	5
+#define MSTR	4
+#define CPOL	3
+#define CPHA	2
+#define SPIF	7
+#define SPI2X	0
+#define INT0	6
+#define INT1	7
+#define ISC01	1
+#define ISC00	0
+#define ISC11	3
+#define ISC10	2
+
+#define PROGMEM
+#define pgm_read_byte(p)	(*(const unsigned char *)(p))
+#define NRF_CLOCK_US()		((unsigned long)(nrf_sim_now / 1000))		//clock of nrf_poll()
+
+#define ISR(vector)		void vector(void); void vector(void)
+void INT0_vect(void) __attribute__((weak));
+void INT1_vect(void) __attribute__((weak));
+void SPI_STC_vect(void) __attribute__((weak));
+
+void nrf_sim_cli(void);
+void nrf_sim_sei(void);
+void nrf_sim_sleep(void);
+void nrf_sim_delay_ns(uint64_t ns);
+void nrf_sim_cpu(unsigned int cycles);
+void nrf_sim_spdr_write(unsigned char data);
+unsigned char nrf_sim_spdr_read(void);
+
+#define cli()			nrf_sim_cli()
+#define sei()			nrf_sim_sei()
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()		nrf_sim_sleep()
+
+static inline void _delay_us(double us){ nrf_sim_delay_ns((uint64_t)(us * 1000.0)); }
+static inline void _delay_ms(double ms){ nrf_sim_delay_ns((uint64_t)(ms * 1000000.0)); }
+
+/*************************SIMULATED RADIO*************************************/
+
+struct nrf_sim_fifo {
+	unsigned char data[32];
+	unsigned char len;
+	unsigned char pipe;					//data pipe of RX payload or ACK payload
+	unsigned char noack;				//written with W_TX_PAYLOAD_NOACK
+};
+
+struct nrf_sim_radio {
+	unsigned char reg[0x20];			//single byte registers
+	unsigned char addr[7][5];			//RX_ADDR_P0 - RX_ADDR_P5 and TX_ADDR
+	struct nrf_sim_fifo tx[3];
+	struct nrf_sim_fifo rx[3];
+	unsigned char tx_n, rx_n;
+	unsigned char ce, csn;
+	unsigned char reuse;				//REUSE_TX_PL active
+	unsigned char halted;				//MAX_RT stops TX FIFO till flag is cleared
+	uint64_t por_end;					//end of power on reset, SPI is ignored (MISO high) till then
+
+	/*SPI command in progress*/
+	unsigned char cmd, cmd_n;
+	unsigned char buf[32];
+
+	/*state machine*/
+	unsigned char state;
+	uint64_t ready;						//end of power up
+	uint64_t rx_ready;					//end of RX settling
+	uint64_t event;						//time of next internal event
+	unsigned char retr;					//retransmits of current payload
+	unsigned char pid;
+	struct nrf_sim_fifo ack;			//ACK payload received for current packet
+	unsigned char ack_valid;
+
+	/*air*/
+	uint64_t air_start, air_end;
+	unsigned char air_ch;
+
+	/*PRX duplicate detection (PID and payload of last packet per pipe)*/
+	unsigned char last_pid[6];
+	uint16_t last_sum[6];
+	struct nrf_sim_fifo last_ack[6];
+	unsigned char last_ack_valid[6];
+	unsigned char src_id[6];
+
+	/*scripted peers*/
+	unsigned char sink;					//drains RX FIFO on its own
+	unsigned char sink_ack_len;			//ACK payload length loaded by sink (0 = none)
+	unsigned char follow;				//1 = receives on channel, data rate and payload width of any transmitter (ideal peer of a hopping or rate changing PTX)
+	unsigned char source_len;			//payload length sent by source (0 = not a source)
+	uint64_t source_interval, source_next;
+	uint32_t source_seq;
+	unsigned char leaf;					//1 = source is a leaf of hub (NRF_HUB), one payload at a time timed by grant in ACK Payload
+	unsigned char leaf_synced, leaf_misses;
+	uint64_t leaf_sent, leaf_cycle;		//payload queued at, cycle of last grant
+
+	/*counters*/
+	unsigned long air_packets;			//packets put on air (including retransmits)
+	unsigned long delivered;			//new payloads accepted in RX FIFO
+	unsigned long rx_dropped;			//packets lost because RX FIFO was full
+	unsigned long collisions;
+	unsigned long rx_bytes;
+	unsigned long sent_ok, sent_fail;	//source/sink peer view
+};
+
+enum {
+	NRF_SIM_PD = 0,
+	NRF_SIM_STBY,
+	NRF_SIM_TX_SETTLE,					//waiting for settling or ARD before air
+	NRF_SIM_TX_AIR,
+	NRF_SIM_TX_ACK,						//ACK is on air
+	NRF_SIM_RX
+};
+
+struct nrf_sim_radio nrf_sim[NRF_SIM_RADIOS];
+unsigned char nrf_sim_count = 1;		//radios in use
+unsigned char nrf_sim_cur = 0;			//radio driven by nrf24l01.h (CE, CSN and IRQ on INT0). With NRF_RADIOS above 1, radio n of driver is nrf_sim_cur + n (IRQ of second one on INT1)
+uint64_t nrf_sim_now = 0;				//simulated time (ns)
+uint64_t nrf_sim_busy = 0;				//time spent in SPI and delays
+uint64_t nrf_sim_idle = 0;				//time spent sleeping for IRQ
+unsigned long nrf_sim_spi_bytes = 0;
+uint64_t nrf_sim_spi_ns = NRF_SIM_SPI_NS;
+uint64_t nrf_sim_cpu_ns = 0;			//time of one CPU cycle charged by SPI.h (0 = not modelled)
+uint64_t nrf_sim_spi_end = UINT64_MAX;	//end of byte written to SPDR (SPIF)
+unsigned char nrf_sim_spi_in;			//byte clocked in by it
+double nrf_sim_loss = 0.0;				//probability that a frame is lost on air
+double nrf_sim_noise[128];				//per RF channel : fraction of time a foreign carrier (eg. WiFi) is above -64dBm. Frames on air then are lost and RPD is set
+double nrf_sim_rssi = -40.0;			//received power (dBm) on every link. Frames get lost as it nears sensitivity of data rate
+unsigned char nrf_sim_cut[NRF_SIM_RADIOS][NRF_SIM_RADIOS];	//1 = radios are out of range of each other (nrf_sim_link())
+unsigned char nrf_sim_cuts = 0;			//1 = some radios are out of range, collisions are decided per receiver
+uint32_t nrf_sim_rand_state = 0x12345678;
+void (*nrf_sim_sink_hook)(unsigned char id, const unsigned char *data, unsigned char len);	//sees every payload a sink accepts (0 = none)
+void (*nrf_sim_delay_hook)(uint64_t until);	//takes simulated time on to until in place of _delay_us()/_delay_ms() of driver (0 = none)
+static unsigned char nrf_sim_in_isr = 0;
+
+#define nrf_sim_hears(r, o)		(!nrf_sim_cut[(r) - nrf_sim][(o) - nrf_sim])
+
+static uint32_t nrf_sim_rand(void){
+	uint32_t x = nrf_sim_rand_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return nrf_sim_rand_state = x;
+}
+static int nrf_sim_chance(double p){
+	if(p <= 0.0) return 0;
+	return (nrf_sim_rand() / 4294967296.0) < p;
+}
+
+/*************************REGISTER HELPERS************************************/
+
+static unsigned char nrf_sim_aw(struct nrf_sim_radio *r){
+	unsigned char aw = r->reg[0x03] & 0x03;
+	return aw ? aw + 2 : 3;
+}
+static uint64_t nrf_sim_bit_ns(struct nrf_sim_radio *r){
+	unsigned char rf = r->reg[0x06];
+	if(rf & (1<<5)) return 4000;		//250kbps
+	if(rf & (1<<3)) return 500;			//2Mbps
+	return 1000;						//1Mbps
+}
+/*Frame error rate at nrf_sim_rssi, rising from 0 at 6dB above sensitivity (-94dBm 250kbps, -85dBm 1Mbps, -82dBm 2Mbps) to 1 at 6dB below*/
+static double nrf_sim_fer(struct nrf_sim_radio *r){
+	uint64_t bit = nrf_sim_bit_ns(r);
+	double sens = (bit == 4000) ? -94.0 : (bit == 500) ? -82.0 : -85.0;
+	double fer = (sens + 6.0 - nrf_sim_rssi) / 12.0;
+	return fer < 0.0 ? 0.0 : fer > 1.0 ? 1.0 : fer;
+}
+static unsigned char nrf_sim_crc(struct nrf_sim_radio *r){
+	unsigned char cfg = r->reg[0x00];
+	if(!(cfg & (1<<3)) && !r->reg[0x01]) return 0;
+	return (cfg & (1<<2)) ? 2 : 1;
+}
+static uint64_t nrf_sim_air(struct nrf_sim_radio *r, unsigned char len){
+	return (uint64_t)(8 * (1 + nrf_sim_aw(r) + len + nrf_sim_crc(r)) + 9) * nrf_sim_bit_ns(r);
+}
+static uint64_t nrf_sim_ard(struct nrf_sim_radio *r){
+	return (uint64_t)(((r->reg[0x04] >> 4) & 0x0F) + 1) * 250000ull;
+}
+static unsigned char nrf_sim_dpl(struct nrf_sim_radio *r, unsigned char pipe){
+	return (r->reg[0x1D] & (1<<2)) && (r->reg[0x1C] & (1<<pipe));
+}
+static unsigned char nrf_sim_status(struct nrf_sim_radio *r){
+	unsigned char s = r->reg[0x07] & 0x70;
+	s |= (r->rx_n ? (r->rx[0].pipe << 1) : 0x0E);
+	if(r->tx_n == 3) s |= 1;
+	return s;
+}
+static unsigned char nrf_sim_fifo_status(struct nrf_sim_radio *r){
+	unsigned char s = 0;
+	if(r->reuse) s |= (1<<6);
+	if(r->tx_n == 3) s |= (1<<5);
+	if(r->tx_n == 0) s |= (1<<4);
+	if(r->rx_n == 3) s |= (1<<1);
+	if(r->rx_n == 0) s |= (1<<0);
+	return s;
+}
+static unsigned char nrf_sim_irq(struct nrf_sim_radio *r){
+	return (r->reg[0x07] & 0x70 & ~r->reg[0x00]) != 0;
+}
+
+static void nrf_sim_pop(struct nrf_sim_fifo *f, unsigned char *n){
+	if(!*n) return;
+	memmove(f, f + 1, (*n - 1) * sizeof(*f));
+	(*n)--;
+}
+
+/*************************STATE MACHINE***************************************/
+
+static void nrf_sim_update(struct nrf_sim_radio *r);
+
+static void nrf_sim_power_on(struct nrf_sim_radio *r){
+	static const unsigned char reset[0x20] = {
+		0x08, 0x3F, 0x03, 0x03, 0x03, 0x02, 0x0E, 0x0E, 0x00, 0x00, 0, 0, 0xC3, 0xC4, 0xC5, 0xC6,
+		0, 0, 0, 0, 0, 0, 0, 0x11, 0, 0, 0, 0, 0x00, 0x00, 0, 0 };
+	memset(r, 0, sizeof(*r));
+	memcpy(r->reg, reset, sizeof(reset));
+	memset(r->addr[0], 0xE7, 5);
+	memset(r->addr[1], 0xC2, 5);
+	memset(r->addr[6], 0xE7, 5);
+	r->csn = 1;
+	r->state = NRF_SIM_PD;
+	r->event = UINT64_MAX;
+}
+
+/*Returns index of data pipe that accepts the address of transmitter t (or -1)*/
+static int nrf_sim_match(struct nrf_sim_radio *r, struct nrf_sim_radio *t){
+	unsigned char aw = nrf_sim_aw(r);
+	if(aw != nrf_sim_aw(t)) return -1;
+	for(int p = 0; p < 6; p++){
+		if(!(r->reg[0x02] & (1<<p))) continue;
+		if(p < 2){
+			if(!memcmp(r->addr[p], t->addr[6], aw)) return p;
+		}
+		else if(r->reg[0x0A + p] == t->addr[6][0] && !memcmp(r->addr[1] + 1, t->addr[6] + 1, aw - 1)) return p;
+	}
+	return -1;
+}
+
+/*CRC-16-CCITT of payload, nrf tells a retransmission from a new packet by PID and CRC*/
+static uint16_t nrf_sim_sum(const struct nrf_sim_fifo *f){
+	uint16_t s = 0xFFFF;
+	for(unsigned char i = 0; i < f->len; i++){
+		s ^= (uint16_t)f->data[i] << 8;
+		for(unsigned char b = 0; b < 8; b++) s = (s & 0x8000) ? (uint16_t)((s << 1) ^ 0x1021) : (uint16_t)(s << 1);
+	}
+	return s;
+}
+
+/*Returns 1 if r hears another radio on air during packet of t on same channel*/
+static int nrf_sim_jammed(struct nrf_sim_radio *r, struct nrf_sim_radio *t){
+	for(int i = 0; i < nrf_sim_count; i++){
+		struct nrf_sim_radio *o = &nrf_sim[i];
+		if(o == t || o == r || o->air_end <= t->air_start || o->air_start >= t->air_end || o->air_ch != t->air_ch) continue;
+		if(nrf_sim_hears(r, o)) return 1;
+	}
+	return 0;
+}
+
+/*Delivers packet of t to receivers. Returns 1 if ACK is sent back and fills ack*/
+static int nrf_sim_deliver(struct nrf_sim_radio *t, const struct nrf_sim_fifo *f, int want_ack, struct nrf_sim_fifo *ack, int *ack_valid){
+	int acked = 0, jam = 0;
+	*ack_valid = 0;
+	for(int i = 0; i < nrf_sim_count; i++){
+		struct nrf_sim_radio *o = &nrf_sim[i];
+		if(o == t || o->air_end <= t->air_start || o->air_start >= t->air_end || o->air_ch != t->air_ch) continue;
+		if(nrf_sim_cuts){
+			jam = 1;								//decided per receiver
+			break;
+		}
+		t->collisions++;
+		return 0;
+	}
+	if(nrf_sim_chance(nrf_sim_loss) || nrf_sim_chance(nrf_sim_noise[t->air_ch]) || nrf_sim_chance(nrf_sim_fer(t))) return 0;
+	for(int i = 0; i < nrf_sim_count; i++){
+		struct nrf_sim_radio *r = &nrf_sim[i];
+		if(r == t || r->state != NRF_SIM_RX || r->rx_ready > t->air_start || !nrf_sim_hears(r, t)) continue;
+		if((!r->follow && ((r->reg[0x05] & 0x7F) != t->air_ch || nrf_sim_bit_ns(r) != nrf_sim_bit_ns(t))) || nrf_sim_crc(r) != nrf_sim_crc(t)) continue;
+		int p = nrf_sim_match(r, t);
+		if(p < 0) continue;
+		if(jam && nrf_sim_jammed(r, t)){
+			t->collisions++;
+			continue;
+		}
+		if(!r->follow && !nrf_sim_dpl(r, p) && (r->reg[0x11 + p] & 0x3F) != f->len) continue;
+		int ack_en = want_ack && (r->reg[0x01] & (1<<p));
+		uint16_t sum = nrf_sim_sum(f);
+		if(ack_en && r->last_pid[p] == t->pid && r->last_sum[p] == sum && r->src_id[p] == (unsigned char)(t - nrf_sim)){
+			//retransmission of a packet that was already received : ACK again, discard
+			if(!acked){
+				acked = 1;
+				if(r->last_ack_valid[p]){ *ack = r->last_ack[p]; *ack_valid = 1; }
+			}
+			continue;
+		}
+		if(r->rx_n == 3){
+			r->rx_dropped++;
+			continue;
+		}
+		struct nrf_sim_fifo *slot = &r->rx[r->rx_n++];
+		*slot = *f;
+		slot->pipe = (unsigned char)p;
+		slot->noack = 0;
+		r->reg[0x07] |= (1<<6);
+		r->delivered++;
+		r->rx_bytes += f->len;
+		r->last_pid[p] = t->pid;
+		r->last_sum[p] = sum;
+		r->src_id[p] = (unsigned char)(t - nrf_sim);
+		r->last_ack_valid[p] = 0;
+		if(ack_en && !acked){
+			acked = 1;
+			if(r->reg[0x1D] & (1<<1)){
+				for(unsigned char k = 0; k < r->tx_n; k++){
+					if(r->tx[k].pipe == p){
+						*ack = r->tx[k];
+						*ack_valid = 1;
+						r->last_ack[p] = r->tx[k];
+						r->last_ack_valid[p] = 1;
+						memmove(&r->tx[k], &r->tx[k + 1], (r->tx_n - k - 1) * sizeof(r->tx[0]));
+						r->tx_n--;
+						break;
+					}
+				}
+				if(!*ack_valid && r->sink && r->sink_ack_len){
+					memset(ack->data, 0xAC, sizeof(ack->data));
+					ack->len = r->sink_ack_len;
+					*ack_valid = 1;
+					r->last_ack[p] = *ack;
+					r->last_ack_valid[p] = 1;
+				}
+			}
+		}
+		if(r->sink){
+			if(nrf_sim_sink_hook) nrf_sim_sink_hook((unsigned char)i, slot->data, slot->len);
+			r->rx_n = 0;
+			r->reg[0x07] &= ~(1<<6);
+		}
+	}
+	if(acked && (nrf_sim_chance(nrf_sim_loss) || nrf_sim_chance(nrf_sim_noise[t->air_ch]) || nrf_sim_chance(nrf_sim_fer(t)))) return 0;
+	return acked;
+}
+
+static void nrf_sim_start_air(struct nrf_sim_radio *r){
+	r->state = NRF_SIM_TX_AIR;
+	r->air_start = nrf_sim_now;
+	r->air_end = nrf_sim_now + nrf_sim_air(r, r->tx[0].len);
+	r->air_ch = r->reg[0x05] & 0x7F;
+	r->event = r->air_end;
+	r->air_packets++;
+}
+
+/*Times next payload of leaf as nrf_leaf_send() does. Grant of hub : delay and cycle (8us, LSByte first), request*/
+static void nrf_sim_leaf_done(struct nrf_sim_radio *r, const struct nrf_sim_fifo *grant){
+	if(grant && grant->len == 5){
+		r->source_next = r->leaf_sent + (uint64_t)(grant->data[0] | (grant->data[1]<<8)) * 8000;
+		r->leaf_cycle = (uint64_t)(grant->data[2] | (grant->data[3]<<8)) * 8000;
+		r->leaf_synced = 1;
+		r->leaf_misses = 0;
+	}
+	else if(r->leaf_synced && ++r->leaf_misses < 4){
+		r->source_next = r->leaf_sent + r->leaf_cycle;
+	}
+	else{
+		r->leaf_synced = 0;
+		r->source_next = nrf_sim_now + nrf_sim_rand() % (r->source_interval + 1);
+	}
+	r->rx_n = 0;										//ACK Payload is taken
+	r->reg[0x07] &= ~(1<<6);
+}
+
+static void nrf_sim_tx_done(struct nrf_sim_radio *r){
+	r->reg[0x07] |= (1<<5);
+	r->reg[0x08] = (r->reg[0x08] & 0xF0) | (r->retr & 0x0F);
+	if(!r->reuse) nrf_sim_pop(r->tx, &r->tx_n);
+	if(r->ack_valid && r->ack.len){
+		if(r->rx_n < 3){
+			r->rx[r->rx_n] = r->ack;
+			r->rx[r->rx_n].pipe = 0;
+			r->rx_n++;
+			r->reg[0x07] |= (1<<6);
+		}
+		else r->rx_dropped++;
+	}
+	if(r->leaf) nrf_sim_leaf_done(r, r->ack_valid ? &r->ack : 0);
+	r->ack_valid = 0;
+	r->retr = 0;
+	r->pid = (r->pid + 1) & 3;
+	r->sent_ok++;
+	r->state = NRF_SIM_STBY;
+	r->event = UINT64_MAX;
+	if(r->ce && r->tx_n){
+		r->state = NRF_SIM_TX_SETTLE;
+		r->event = nrf_sim_now + NRF_SIM_TSTBY2A;
+	}
+}
+
+static void nrf_sim_step(struct nrf_sim_radio *r){
+	switch(r->state){
+	case NRF_SIM_PD:
+	case NRF_SIM_STBY:
+	case NRF_SIM_RX:
+		r->event = UINT64_MAX;
+		nrf_sim_update(r);
+		break;
+	case NRF_SIM_TX_SETTLE:
+		if(!r->tx_n){
+			r->state = NRF_SIM_STBY;
+			r->event = UINT64_MAX;
+			break;
+		}
+		nrf_sim_start_air(r);
+		break;
+	case NRF_SIM_TX_AIR: {
+		int want_ack = (r->reg[0x01] & 1) && !r->tx[0].noack;
+		int acked = nrf_sim_deliver(r, &r->tx[0], want_ack, &r->ack, (int *)&r->ack_valid);
+		if(!want_ack){
+			nrf_sim_tx_done(r);
+			break;
+		}
+		uint64_t ack_air = nrf_sim_air(r, r->ack_valid ? r->ack.len : 0);
+		if(acked && (r->addr[0][0] == r->addr[6][0] && !memcmp(r->addr[0], r->addr[6], nrf_sim_aw(r)))
+			&& NRF_SIM_TSTBY2A + ack_air <= nrf_sim_ard(r)){
+			r->state = NRF_SIM_TX_ACK;
+			r->event = nrf_sim_now + NRF_SIM_TSTBY2A + ack_air;
+			break;
+		}
+		r->ack_valid = 0;
+		if(r->retr >= (r->reg[0x04] & 0x0F)){
+			r->reg[0x07] |= (1<<4);
+			if((r->reg[0x08] >> 4) < 15) r->reg[0x08] += 0x10;
+			r->reg[0x08] = (r->reg[0x08] & 0xF0) | (r->retr & 0x0F);
+			r->halted = 1;
+			r->sent_fail++;
+			r->state = NRF_SIM_STBY;
+			r->event = UINT64_MAX;
+			if(r->source_len){
+				//scripted source drops payload and goes on after a random backoff
+				nrf_sim_pop(r->tx, &r->tx_n);
+				r->reg[0x07] &= ~(1<<4);
+				r->halted = 0;
+				r->retr = 0;
+				if(r->leaf) nrf_sim_leaf_done(r, 0);
+				if(r->tx_n){
+					r->state = NRF_SIM_TX_SETTLE;
+					r->event = nrf_sim_now + NRF_SIM_TSTBY2A + nrf_sim_rand() % nrf_sim_ard(r);
+				}
+			}
+			break;
+		}
+		r->retr++;
+		r->state = NRF_SIM_TX_SETTLE;
+		r->event = nrf_sim_now + nrf_sim_ard(r);
+		break;
+	}
+	case NRF_SIM_TX_ACK:
+		nrf_sim_tx_done(r);
+		break;
+	}
+}
+
+/*Latches RPD when RX ends (CE low) : foreign carrier or another radio on air on same channel*/
+static void nrf_sim_rpd(struct nrf_sim_radio *r){
+	unsigned char ch = r->reg[0x05] & 0x7F;
+	int busy = 0;
+	if(nrf_sim_now < r->rx_ready + 40000ull) return;		//AGC not settled, RPD unchanged
+	busy = nrf_sim_chance(nrf_sim_noise[ch]);
+	for(int i = 0; i < nrf_sim_count && !busy; i++){
+		struct nrf_sim_radio *o = &nrf_sim[i];
+		if(o != r && o->air_ch == ch && o->air_end > r->rx_ready && o->air_start < nrf_sim_now && nrf_sim_hears(r, o)) busy = 1;
+	}
+	r->reg[0x09] = busy;
+}
+
+/*Re-evaluates mode of radio after CE, CONFIG, FIFO or STATUS change*/
+static void nrf_sim_update(struct nrf_sim_radio *r){
+	unsigned char cfg = r->reg[0x00];
+	if(!(cfg & (1<<1))){
+		r->state = NRF_SIM_PD;
+		r->event = UINT64_MAX;
+		return;
+	}
+	if(nrf_sim_now < r->ready){
+		r->event = r->ready;
+		return;
+	}
+	if(cfg & 1){
+		if(r->ce && r->state != NRF_SIM_RX){
+			r->state = NRF_SIM_RX;
+			r->rx_ready = nrf_sim_now + NRF_SIM_TSTBY2A;
+		}
+		if(!r->ce && r->state == NRF_SIM_RX){
+			nrf_sim_rpd(r);
+			r->state = NRF_SIM_STBY;
+		}
+		if(r->state == NRF_SIM_PD) r->state = NRF_SIM_STBY;
+		return;
+	}
+	if(r->state == NRF_SIM_RX || r->state == NRF_SIM_PD) r->state = NRF_SIM_STBY;
+	if(r->state == NRF_SIM_STBY && r->ce && r->tx_n && !r->halted){
+		r->state = NRF_SIM_TX_SETTLE;
+		r->event = nrf_sim_now + NRF_SIM_TSTBY2A;
+	}
+}
+
+static void nrf_sim_source_step(struct nrf_sim_radio *r){
+	if(!r->source_len || nrf_sim_now < r->source_next) return;
+	if(r->leaf){
+		r->source_next = UINT64_MAX;					//till payload is done
+		if(r->tx_n) return;
+		r->leaf_sent = nrf_sim_now;
+	}
+	if(r->tx_n < 3){
+		struct nrf_sim_fifo *f = &r->tx[r->tx_n++];
+		memset(f, 0, sizeof(*f));
+		f->len = r->source_len;
+		memcpy(f->data, &r->source_seq, sizeof(r->source_seq));
+		r->source_seq++;
+		nrf_sim_update(r);
+	}
+	if(!r->leaf) r->source_next += r->source_interval;
+}
+
+/*Advances simulated time, running radio events in order*/
+static void nrf_sim_deliver_irq(void);
+static void nrf_sim_run(uint64_t until){
+	for(;;){
+		struct nrf_sim_radio *next = 0;
+		uint64_t t = until;
+		for(int i = 0; i < nrf_sim_count; i++){
+			struct nrf_sim_radio *r = &nrf_sim[i];
+			if(r->source_len && r->source_next < t){ t = r->source_next; next = r; }
+			if(r->event <= t){ t = r->event; next = r; }
+		}
+		if(nrf_sim_spi_end <= t){ t = nrf_sim_spi_end; next = &nrf_sim[nrf_sim_cur]; }
+		if(!next) break;
+		nrf_sim_now = t;
+		for(int i = 0; i < nrf_sim_count; i++){
+			struct nrf_sim_radio *r = &nrf_sim[i];
+			if(r->source_len) nrf_sim_source_step(r);
+			if(r->event <= nrf_sim_now) nrf_sim_step(r);
+			if(r->sink && r->rx_n){
+				r->rx_n = 0;
+				r->reg[0x07] &= ~(1<<6);
+			}
+		}
+		if(nrf_sim_spi_end <= nrf_sim_now){
+			nrf_sim_spi_end = UINT64_MAX;
+			SPDR = nrf_sim_spi_in;
+			SPSR |= (1<<SPIF);
+			nrf_sim_deliver_irq();						//may run past until
+		}
+	}
+	if(nrf_sim_now < until) nrf_sim_now = until;
+	nrf_sim_deliver_irq();
+}
+
+/*Time of next internal event of any radio*/
+static uint64_t nrf_sim_next_event(void){
+	uint64_t t = UINT64_MAX;
+	for(int i = 0; i < nrf_sim_count; i++){
+		if(nrf_sim[i].event < t) t = nrf_sim[i].event;
+		if(nrf_sim[i].source_len && nrf_sim[i].source_next < t) t = nrf_sim[i].source_next;
+	}
+	if(nrf_sim_spi_end < t) t = nrf_sim_spi_end;
+	return t;
+}
+
+/*************************PUBLIC INTERFACE************************************/
+
+void nrf_sim_delay_ns(uint64_t ns){
+	nrf_sim_busy += ns;
+	if(nrf_sim_delay_hook) nrf_sim_delay_hook(nrf_sim_now + ns);
+	else nrf_sim_run(nrf_sim_now + ns);
+}
+
+void nrf_sim_cpu(unsigned int cycles){
+	if(nrf_sim_cpu_ns) nrf_sim_delay_ns(cycles * nrf_sim_cpu_ns);
+}
+
+/*INT0 (IRQ of radio nrf_sim_cur) and INT1 (nrf_sim_cur + 1) come before SPI_STC (SPIF with SPIE set), as on AVR*/
+static void nrf_sim_deliver_irq(void){
+	if(nrf_sim_in_isr || !(SREG & 0x80)) return;
+	for(int guard = 0, irq = 0; guard < 64; guard++){
+		void (*vect)(void) = 0;
+		if(INT0_vect && (GICR & (1<<INT0)) && irq < 8 && nrf_sim_irq(&nrf_sim[nrf_sim_cur])){
+			vect = INT0_vect;
+			irq++;
+		}
+		else if(INT1_vect && (GICR & (1<<INT1)) && irq < 8 && nrf_sim_irq(&nrf_sim[nrf_sim_cur + 1])){
+			vect = INT1_vect;
+			irq++;
+		}
+		else if(SPI_STC_vect && (SPCR & (1<<SPIE)) && (SPSR & (1<<SPIF))){
+			vect = SPI_STC_vect;
+			SPSR &= ~(1<<SPIF);							//cleared by hardware on entry
+		}
+		if(!vect) return;
+		nrf_sim_in_isr = 1;
+		SREG &= ~0x80;
+		vect();
+		SREG |= 0x80;
+		nrf_sim_in_isr = 0;
+	}
+}
+
+void nrf_sim_cli(void){
+	SREG &= ~0x80;
+}
+void nrf_sim_sei(void){
+	SREG |= 0x80;
+	nrf_sim_deliver_irq();
+}
+void nrf_sim_sleep(void){
+	uint64_t t = nrf_sim_next_event();
+	if(t == UINT64_MAX || t > nrf_sim_now + 1000000000ull) t = nrf_sim_now + 1000000ull;
+	if(t < nrf_sim_now) t = nrf_sim_now;
+	nrf_sim_idle += t - nrf_sim_now;
+	nrf_sim_run(t);
+}
+
+/*************************************************************************************************
+* Description : Resets simulation time and all radios (power on reset state)
+* Parameters  : unsigned char radios = number of radios sharing the air (max NRF_SIM_RADIOS)
+**************************************************************************************************/
+void nrf_sim_reset(unsigned char radios){
+	for(int i = 0; i < NRF_SIM_RADIOS; i++) nrf_sim_power_on(&nrf_sim[i]);
+	nrf_sim_count = radios;
+	memset(nrf_sim_noise, 0, sizeof(nrf_sim_noise));
+	memset(nrf_sim_cut, 0, sizeof(nrf_sim_cut));
+	nrf_sim_cuts = 0;
+	nrf_sim_rssi = -40.0;
+	nrf_sim_now = nrf_sim_busy = nrf_sim_idle = 0;
+	nrf_sim_spi_bytes = 0;
+	nrf_sim_spi_end = UINT64_MAX;
+	SPSR &= ~(1<<SPIF);
+	nrf_sim_in_isr = 0;
+	nrf_sim_cur = 0;
+	nrf_sim_sink_hook = 0;
+	nrf_sim_delay_hook = 0;
+	SREG = 0;
+	GICR = 0;
+}
+
+void nrf_sim_ce(unsigned char id, unsigned char level){
+	struct nrf_sim_radio *r = &nrf_sim[id];
+	if(r->ce == level) return;
+	r->ce = level;
+	nrf_sim_update(r);
+}
+
+static void nrf_sim_end_command(struct nrf_sim_radio *r);
+void nrf_sim_csn(unsigned char id, unsigned char level){
+	struct nrf_sim_radio *r = &nrf_sim[id];
+	if(r->csn == level) return;
+	r->csn = level;
+	if(level) nrf_sim_end_command(r);
+	else r->cmd_n = 0;
+}
+
+static void nrf_sim_write_reg(struct nrf_sim_radio *r, unsigned char reg, const unsigned char *buf, unsigned char n){
+	if(!n) return;
+	if(reg >= 0x0A && reg <= 0x0B){
+		memcpy(r->addr[reg - 0x0A], buf, n > 5 ? 5 : n);
+		return;
+	}
+	if(reg == 0x10){
+		memcpy(r->addr[6], buf, n > 5 ? 5 : n);
+		return;
+	}
+	if(reg == 0x07){
+		r->reg[0x07] &= ~(buf[0] & 0x70);
+		if((buf[0] & (1<<4)) && r->halted){
+			r->halted = 0;
+			nrf_sim_update(r);
+		}
+		return;
+	}
+	if(reg == 0x08 || reg == 0x09 || reg == 0x17) return;	//read only
+	if(reg == 0x05) r->reg[0x08] &= 0x0F;					//writing RF_CH resets PLOS_CNT
+	unsigned char old = r->reg[reg];
+	r->reg[reg] = buf[0];
+	if(reg == 0x00){
+		if(!(old & (1<<1)) && (buf[0] & (1<<1))) r->ready = nrf_sim_now + NRF_SIM_TPD2STBY;
+		if((old ^ buf[0]) & 0x03) nrf_sim_update(r);
+	}
+}
+
+static unsigned char nrf_sim_read_reg(struct nrf_sim_radio *r, unsigned char reg, unsigned char i){
+	if(reg >= 0x0A && reg <= 0x0B) return i < 5 ? r->addr[reg - 0x0A][i] : 0;
+	if(reg == 0x10) return i < 5 ? r->addr[6][i] : 0;
+	if(i) return 0;
+	if(reg == 0x07) return nrf_sim_status(r);
+	if(reg == 0x17) return nrf_sim_fifo_status(r);
+	return r->reg[reg];
+}
+
+static void nrf_sim_end_command(struct nrf_sim_radio *r){
+	unsigned char cmd = r->cmd, n = r->cmd_n ? r->cmd_n - 1 : 0;
+	if(!r->cmd_n) return;
+	if(cmd >= 0x20 && cmd < 0x40) nrf_sim_write_reg(r, cmd & 0x1F, r->buf, n);
+	else if(cmd == 0xA0 || cmd == 0xB0 || (cmd & 0xF8) == 0xA8){
+		if(r->tx_n < 3 && n){
+			struct nrf_sim_fifo *f = &r->tx[r->tx_n++];
+			memcpy(f->data, r->buf, n);
+			f->len = n;
+			f->noack = (cmd == 0xB0);
+			f->pipe = (cmd & 0xF8) == 0xA8 ? (cmd & 0x07) : 0;
+			if((cmd & 0xF8) != 0xA8) r->reuse = 0;
+			nrf_sim_update(r);
+		}
+	}
+	else if(cmd == 0x61 && n) nrf_sim_pop(r->rx, &r->rx_n);
+	else if(cmd == 0xE1){ r->tx_n = 0; r->reuse = 0; }
+	else if(cmd == 0xE2) r->rx_n = 0;
+	else if(cmd == 0xE3){ r->reuse = 1; nrf_sim_update(r); }
+	r->cmd_n = 0;
+}
+
+/*Exchanges one byte with radio whose CSN is low, returns byte clocked out by radio*/
+static unsigned char nrf_sim_shift(unsigned char data){
+	struct nrf_sim_radio *r = 0;
+	unsigned char out = 0xFF;
+	nrf_sim_spi_bytes++;
+	if(nrf_sim_cur < nrf_sim_count && !nrf_sim[nrf_sim_cur].csn) r = &nrf_sim[nrf_sim_cur];		//own bus of CPU of radio nrf_sim_cur (nrf_sim_delay_hook)
+	else for(int i = 0; i < nrf_sim_count; i++) if(!nrf_sim[i].csn){ r = &nrf_sim[i]; break; }
+	if(!r || nrf_sim_now < r->por_end) return out;
+	if(r->cmd_n == 0){
+		r->cmd = data;
+		out = nrf_sim_status(r);
+	}
+	else{
+		unsigned char i = r->cmd_n - 1;
+		unsigned char cmd = r->cmd;
+		if(cmd < 0x20) out = nrf_sim_read_reg(r, cmd, i);
+		else if(cmd == 0x61) out = (r->rx_n && i < 32) ? r->rx[0].data[i] : 0;
+		else if(cmd == 0x60) out = r->rx_n ? r->rx[0].len : 0;
+		if(i < 32) r->buf[i] = data;
+	}
+	if(r->cmd_n < 255) r->cmd_n++;
+	return out;
+}
+/*************************************************************************************************
+* Description : Shifts one byte over SPI to radio whose CSN is low
+* Returns     : byte clocked out by radio (STATUS for first byte of command)
+**************************************************************************************************/
+unsigned char nrf_sim_spi(unsigned char data){
+	nrf_sim_delay_ns(nrf_sim_spi_ns);
+	return nrf_sim_shift(data);
+}
+
+/*************************************************************************************************
+* Description : Writes SPDR. Byte is clocked in background, SPIF is set and SPDR holds received
+*				byte after nrf_sim_spi_ns (SPI_STC_vect is called if SPIE is set)
+**************************************************************************************************/
+void nrf_sim_spdr_write(unsigned char data){
+	nrf_sim_spi_in = nrf_sim_shift(data);
+	nrf_sim_spi_end = nrf_sim_now + nrf_sim_spi_ns;
+}
+
+/*************************************************************************************************
+* Description : Reads SPDR, clearing SPIF (SPSR was read before, as on AVR)
+**************************************************************************************************/
+unsigned char nrf_sim_spdr_read(void){
+	SPSR &= ~(1<<SPIF);
+	return SPDR;
+}
+
+/*************************************************************************************************
+* Description : Makes radio id an ideal receiver that drains its RX FIFO instantly
+*				(configured with PRIM_RX, powered up and CE high)
+* Parameters  : unsigned char ack_len = length of ACK payload returned with each ACK (0 = none)
+**************************************************************************************************/
+void nrf_sim_sink(unsigned char id, unsigned char ack_len){
+	struct nrf_sim_radio *r = &nrf_sim[id];
+	r->sink = 1;
+	r->sink_ack_len = ack_len;
+	r->reg[0x00] |= (1<<1) | 1;
+	r->ce = 1;
+	r->state = NRF_SIM_STBY;
+	nrf_sim_update(r);
+}
+
+/*************************************************************************************************
+* Description : Makes radio id a transmitter that queues a payload every interval_ns
+**************************************************************************************************/
+void nrf_sim_source(unsigned char id, unsigned char len, uint64_t interval_ns){
+	struct nrf_sim_radio *r = &nrf_sim[id];
+	r->source_len = len;
+	r->source_interval = interval_ns;
+	r->source_next = nrf_sim_now + nrf_sim_rand() % (interval_ns + 1);
+	r->reg[0x00] = (r->reg[0x00] | (1<<1)) & ~1;
+	r->ce = 1;
+	nrf_sim_update(r);
+}
+
+/*************************************************************************************************
+* Description : Makes radio id a leaf of a hub (NRF_HUB 1) sending len byte payloads to address
+*				of data pipe 1 with LSByte node_id (RX_ADDR_P0 too, for ACK). Like nrf_leaf_send()
+*				it sends when grant of its last payload tells it, keeps its slot for 3 payloads
+*				without grant and else sends again after a random time upto retry_ns
+**************************************************************************************************/
+void nrf_sim_leaf(unsigned char id, unsigned char node_id, unsigned char len, uint64_t retry_ns){
+	struct nrf_sim_radio *r = &nrf_sim[id];
+	memcpy(r->addr[6], r->addr[1], 5);
+	r->addr[6][0] = node_id;
+	memcpy(r->addr[0], r->addr[6], 5);
+	r->leaf = 1;
+	r->leaf_synced = 0;
+	nrf_sim_source(id, len, retry_ns);
+}
+
+/*************************************************************************************************
+* Description : Puts radios a and b in range (on = 1) or out of range (on = 0) of each other. All
+*				radios are in range after nrf_sim_reset()
+**************************************************************************************************/
+void nrf_sim_link(unsigned char a, unsigned char b, unsigned char on){
+	nrf_sim_cut[a][b] = nrf_sim_cut[b][a] = !on;
+	if(!on) nrf_sim_cuts = 1;
+}
+
+/*************************************************************************************************
+* Description : Power on reset of radio id in the middle of a run (brown out) : registers and FIFOs
+*				go back to reset values and SPI is ignored for por_ns (MISO reads high). CE and CSN
+*				lines keep their level. por_ns = UINT64_MAX takes radio off the bus for good
+*				(module unplugged), call it again with a finite por_ns to plug it back
+**************************************************************************************************/
+void nrf_sim_brownout(unsigned char id, uint64_t por_ns){
+	struct nrf_sim_radio *r = &nrf_sim[id];
+	unsigned char ce = r->ce, csn = r->csn;
+	nrf_sim_power_on(r);
+	r->ce = ce;
+	r->csn = csn;
+	r->por_end = (por_ns == UINT64_MAX) ? UINT64_MAX : nrf_sim_now + por_ns;
+}
+
+/*************************************************************************************************
+* Description : Copies register image of radio from to radio to (used to set up peers)
+**************************************************************************************************/
+void nrf_sim_clone(unsigned char to, unsigned char from){
+	memcpy(nrf_sim[to].reg, nrf_sim[from].reg, sizeof(nrf_sim[to].reg));
+	memcpy(nrf_sim[to].addr, nrf_sim[from].addr, sizeof(nrf_sim[to].addr));
+	nrf_sim[to].reg[0x07] = 0x0E;
+	nrf_sim[to].ready = nrf_sim_now;
+}
+
+#endif /* NRF_SIM_H_ */